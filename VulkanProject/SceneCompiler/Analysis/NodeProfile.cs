@@ -0,0 +1,127 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using Scene;
+
+namespace SceneCompiler.Analysis
+{
+    /// <summary>
+    /// Reads the .nprof node profile of a benchmark run (NodeProfile.h) and reports which nodes of the compiled scene
+    /// are worth flattening, merging, splitting or giving a LOD. Only valid for a scene compiled with the same settings
+    /// as the profiled one, the node indices have to match
+    /// </summary>
+    public class NodeProfile
+    {
+        private const uint Magic = 0x4652504E; // "NPRF"
+        private const uint Version = 1;
+
+        public struct NodeCost
+        {
+            public uint Queries;
+            public uint Candidates;
+            public uint Hits;
+        }
+
+        public uint Frames { get; private set; }
+        public uint Width { get; private set; }
+        public uint Height { get; private set; }
+        public uint Stride { get; private set; }
+        public NodeCost[] Costs { get; private set; }
+
+        /// <summary>pixels that were counted over all frames</summary>
+        public double Samples => (double)Frames * ((Width + Stride - 1) / Stride) * ((Height + Stride - 1) / Stride);
+
+        public static NodeProfile Read(string path)
+        {
+            using var reader = new BinaryReader(File.OpenRead(path));
+            if (reader.ReadUInt32() != Magic || reader.ReadUInt32() != Version)
+                throw new Exception(path + " is not a node profile of this version");
+            var profile = new NodeProfile();
+            var count = reader.ReadUInt32();
+            profile.Frames = reader.ReadUInt32();
+            profile.Width = reader.ReadUInt32();
+            profile.Height = reader.ReadUInt32();
+            profile.Stride = Math.Max(reader.ReadUInt32(), 1);
+            reader.ReadUInt32();
+            profile.Costs = new NodeCost[count];
+            for (var i = 0; i < count; i++)
+            {
+                profile.Costs[i].Queries = reader.ReadUInt32();
+                profile.Costs[i].Candidates = reader.ReadUInt32();
+                profile.Costs[i].Hits = reader.ReadUInt32();
+            }
+            return profile;
+        }
+
+        private class Entry
+        {
+            public SceneNode Node;
+            public int Index;
+            public double QueriesPerPixel;
+            public double CandidatesPerQuery;
+            public double HitRate;
+            public string Recommendation = "";
+        }
+
+        public void Report(SceneBuffers buffers, ProfileConfiguration config, string csvPath)
+        {
+            var nodeCount = buffers.Nodes.Count();
+            if (nodeCount != Costs.Length)
+            {
+                Console.WriteLine($"Node profile has {Costs.Length} nodes, the scene {nodeCount}. " +
+                                  "It was recorded with other settings and is skipped");
+                return;
+            }
+            var samples = Math.Max(Samples, 1);
+            Console.WriteLine($"Node profile of {Frames} frames at {Width}x{Height}, every {Stride}. pixel");
+
+            var entries = new List<Entry>(nodeCount);
+            for (var i = 0; i < nodeCount; i++)
+            {
+                var cost = Costs[i];
+                var entry = new Entry
+                {
+                    Node = buffers.NodeByIndex(i),
+                    Index = i,
+                    QueriesPerPixel = cost.Queries / samples,
+                    CandidatesPerQuery = cost.Queries > 0 ? (double)cost.Candidates / cost.Queries : 0,
+                    HitRate = cost.Queries > 0 ? (double)cost.Hits / cost.Queries : 0
+                };
+                entries.Add(entry);
+                if (entry.QueriesPerPixel < config.MinQueriesPerPixel)
+                    continue;
+
+                var node = entry.Node;
+                if (node.IsInstanceList && node.NumChildren <= config.MergeChildThreshold)
+                    entry.Recommendation = "merge"; // a query for a handful of instances, the parent can take them
+                else if (node.IsInstanceList && entry.HitRate < config.FlattenHitRate)
+                    entry.Recommendation = "flatten"; // mostly passed through on the way to other nodes
+                else if (node.NumTriangles > 0 && entry.CandidatesPerQuery >= config.CandidatesPerQueryThreshold)
+                    entry.Recommendation = node.NumTriangles >= config.LodTriangleCount ? "lod" : "split";
+            }
+
+            var total = entries.Sum(x => x.QueriesPerPixel);
+            Console.WriteLine($"{total:F2} queries per pixel, {entries.Count(x => x.QueriesPerPixel > 0)} of {nodeCount} nodes queried");
+            foreach (var group in entries.Where(x => x.Recommendation != "").GroupBy(x => x.Recommendation))
+            {
+                Console.WriteLine($"{group.Key}: {group.Count()} nodes, {group.Sum(x => x.QueriesPerPixel):F2} queries per pixel");
+                Console.WriteLine(" Node Level Queries/px Cand/query HitRate Triangles Children Name");
+                foreach (var e in group.OrderByDescending(x => x.QueriesPerPixel * Math.Max(x.CandidatesPerQuery, 1)).Take(config.ReportCount))
+                {
+                    Console.WriteLine($"{e.Index,5} {e.Node.Level,5} {e.QueriesPerPixel,10:F3} {e.CandidatesPerQuery,10:F1} " +
+                                      $"{e.HitRate,7:F2} {e.Node.NumTriangles,9} {e.Node.NumChildren,8} {e.Node.Name}");
+                }
+            }
+
+            using var writer = new StreamWriter(csvPath);
+            writer.WriteLine("node,level,name,instance_list,triangles,children,queries_per_pixel,candidates_per_query,hit_rate,recommendation");
+            foreach (var e in entries.Where(x => x.QueriesPerPixel > 0).OrderByDescending(x => x.QueriesPerPixel))
+            {
+                writer.WriteLine($"{e.Index},{e.Node.Level},\"{e.Node.Name}\",{(e.Node.IsInstanceList ? 1 : 0)},{e.Node.NumTriangles}," +
+                                 $"{e.Node.NumChildren},{e.QueriesPerPixel:F4},{e.CandidatesPerQuery:F2},{e.HitRate:F3},{e.Recommendation}");
+            }
+            Console.WriteLine("Node profile report written to " + csvPath);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+
+namespace SceneCompiler.Analysis
+{
+    /// <summary>
+    /// Reads the .qtrace dumps of the renderer (QueryTrace.h) and sums up the query cost per scene node
+    /// </summary>
+    public class QueryTraceAnalyzer
+    {
+        private const uint Magic = 0x43525451; // "QTRC"
+        private const uint Version = 1;
+
+        public class NodeCost
+        {
+            public uint Node;
+            public int Level;
+            public ulong Queries;
+            public ulong TriangleCandidates;
+            public ulong InstanceHits;
+            public HashSet<uint> Pixels = new();
+        }
+
+        public uint Width { get; private set; }
+        public uint Height { get; private set; }
+        public uint NodeCount { get; private set; }
+        public uint Overwritten { get; private set; }
+        public ulong Records { get; private set; }
+        public HashSet<uint> Pixels { get; } = new();
+        public Dictionary<uint, NodeCost> Nodes { get; } = new();
+
+        public void Read(string path)
+        {
+            using var reader = new BinaryReader(File.OpenRead(path));
+            if (reader.ReadUInt32() != Magic || reader.ReadUInt32() != Version)
+                throw new Exception(path + " is not a query trace of this version");
+            var count = reader.ReadUInt32();
+            Overwritten += reader.ReadUInt32();
+            Width = reader.ReadUInt32();
+            Height = reader.ReadUInt32();
+            NodeCount = reader.ReadUInt32();
+            reader.ReadUInt32();
+
+            for (var i = 0; i < count; i++)
+            {
+                var pixel = reader.ReadUInt32();
+                var node = reader.ReadUInt32();
+                reader.ReadSingle(); // t
+                var triangles = reader.ReadUInt32();
+                var instances = reader.ReadUInt32();
+                reader.ReadUInt16(); // sequence
+                var level = reader.ReadInt16();
+
+                if (!Nodes.TryGetValue(node, out var cost))
+                {
+                    cost = new NodeCost { Node = node, Level = level };
+                    Nodes.Add(node, cost);
+                }
+                cost.Queries++;
+                cost.TriangleCandidates += triangles;
+                cost.InstanceHits += instances;
+                cost.Pixels.Add(pixel);
+                Pixels.Add(pixel);
+                Records++;
+            }
+        }
+
+        public void Print(int top)
+        {
+            var pixels = Math.Max(Pixels.Count, 1);
+            Console.WriteLine($"{Records} queries of {Pixels.Count} pixels ({Width}x{Height}), {Overwritten} records overwritten");
+            Console.WriteLine($"{(double)Records / pixels:F2} queries per pixel, {Nodes.Count} of {NodeCount} nodes queried");
+
+            Console.WriteLine("Level  Queries  Candidates  InstanceHits");
+            foreach (var level in Nodes.Values.GroupBy(x => x.Level).OrderBy(x => x.Key))
+            {
+                Console.WriteLine($"{level.Key,5} {level.Sum(x => (double)x.Queries) / pixels,8:F2} " +
+                                  $"{level.Sum(x => (double)x.TriangleCandidates) / pixels,11:F2} " +
+                                  $"{level.Sum(x => (double)x.InstanceHits) / pixels,13:F2}");
+            }
+
+            Console.WriteLine($"Top {top} nodes by queries (per traced pixel)");
+            Console.WriteLine(" Node Level  Queries  Candidates  InstanceHits  Pixels");
+            foreach (var cost in Nodes.Values.OrderByDescending(x => x.Queries).Take(top))
+                PrintNode(cost, pixels);
+
+            Console.WriteLine($"Top {top} nodes by triangle candidates (per traced pixel)");
+            Console.WriteLine(" Node Level  Queries  Candidates  InstanceHits  Pixels");
+            foreach (var cost in Nodes.Values.OrderByDescending(x => x.TriangleCandidates).Take(top))
+                PrintNode(cost, pixels);
+        }
+
+        private static void PrintNode(NodeCost cost, int pixels)
+        {
+            Console.WriteLine($"{cost.Node,5} {cost.Level,5} {(double)cost.Queries / pixels,8:F3} " +
+                              $"{(double)cost.TriangleCandidates / pixels,11:F3} " +
+                              $"{(double)cost.InstanceHits / pixels,13:F3} {cost.Pixels.Count,7}");
+        }
+
+        // one row per node, for spreadsheets
+        public void WriteCsv(string path)
+        {
+            using var writer = new StreamWriter(path);
+            writer.WriteLine("node,level,queries,triangle_candidates,instance_hits,pixels");
+            foreach (var cost in Nodes.Values.OrderBy(x => x.Node))
+                writer.WriteLine($"{cost.Node},{cost.Level},{cost.Queries},{cost.TriangleCandidates},{cost.InstanceHits},{cost.Pixels.Count}");
+        }
+
+        // SceneCompiler --trace file.qtrace [more.qtrace ...], several dumps of the same scene are summed up
+        public static void Analyze(IEnumerable<string> files)
+        {
+            var analyzer = new QueryTraceAnalyzer();
+            string last = null;
+            foreach (var file in files)
+            {
+                analyzer.Read(file);
+                last = file;
+            }
+            if (last == null)
+            {
+                Console.WriteLine("no trace files given");
+                return;
+            }
+            analyzer.Print(20);
+            var csv = Path.ChangeExtension(last, ".nodes.csv");
+            analyzer.WriteCsv(csv);
+            Console.WriteLine("Node costs written to " + csv);
+        }
+    }
+}
@@ -22,6 +22,7 @@ namespace SceneCompiler
         public LodConfiguration LodConfiguration { get; set; } = new();
         public OptimizationConfiguration OptimizationConfiguration { get; set; } = new();
         public DebugConfiguration DebugConfiguration { get; set; } = new();
+        public ProfileConfiguration ProfileConfiguration { get; set; } = new();
         /// <summary>if this is not null, the .vksc file will be saved in that folder</summary>
         public string StorePath { get; set; }
 
@@ -211,6 +212,24 @@ namespace SceneCompiler
         public List<string> TriDecimatorArguments { get; set; } = new List<string>() { "-Ty", "-C" };
     }
 
+    public class ProfileConfiguration
+    {
+        /// <summary>node profile (.nprof) of a benchmark of this scene, compiled with the same settings. Reports where the traversal cost goes</summary>
+        public string NodeProfilePath { get; set; } = null;
+        /// <summary>nodes with fewer queries per pixel are not worth changing</summary>
+        public double MinQueriesPerPixel { get; set; } = 0.05;
+        /// <summary>instance lists with at most this many children are reported for merging into their parent</summary>
+        public int MergeChildThreshold { get; set; } = 4;
+        /// <summary>instance lists whose queries end in a hit less often than this are reported for flattening (ReduceInstanceListCount)</summary>
+        public double FlattenHitRate { get; set; } = 0.05;
+        /// <summary>geometry with more triangle candidates per query is reported for LOD or splitting</summary>
+        public double CandidatesPerQueryThreshold { get; set; } = 8;
+        /// <summary>geometry with at least this many triangles gets LOD instead of a split (see LodTriangleThreshold)</summary>
+        public int LodTriangleCount { get; set; } = 10000;
+        /// <summary>the number of nodes printed per recommendation</summary>
+        public int ReportCount { get; set; } = 20;
+    }
+
     public class DebugConfiguration
     {
         /// <summary>prints the scene in the console</summary>
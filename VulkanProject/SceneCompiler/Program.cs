@@ -4,6 +4,7 @@ using System.Threading;
 using System.Windows.Forms;
 using System.Reflection;
 using System.Text.RegularExpressions;
+using SceneCompiler.Analysis;
 using SceneCompiler.GLTFConversion.Compilation;
 using SceneCompiler.MoanaConversion;
 using SceneCompiler.Scene;
@@ -26,6 +27,13 @@ namespace SceneCompiler
                 Console.WriteLine(arg);
             }
 
+            // analyzes query traces of the renderer instead of compiling a scene
+            if (args.Length > 0 && args[0] == "--trace")
+            {
+                QueryTraceAnalyzer.Analyze(args.Skip(1));
+                return;
+            }
+
 
             var regex = new Regex(@"VulkanProject\\.*");
 
@@ -135,6 +143,12 @@ namespace SceneCompiler
             Console.WriteLine("Scene Contained " + idCount + " identity transforms");
             Console.WriteLine("Writing Scene");
             writer.WriteBuffers(dst, compiler);
+            // the node indices are final once the scene is written
+            if (config.ProfileConfiguration.NodeProfilePath != null)
+            {
+                var profile = NodeProfile.Read(config.ProfileConfiguration.NodeProfilePath);
+                profile.Report(buffers, config.ProfileConfiguration, Path.ChangeExtension(dst, ".nodes.csv"));
+            }
             Console.WriteLine("Total Number of Triangles: " + buffers.Root.TotalPrimitiveCount);
             var numTlas = buffers.Nodes.Count(x =>x.NeedsTlas);
             var numBlas = buffers.Nodes.Count(x => x.NeedsBlas);
@@ -0,0 +1,281 @@
+﻿#include "Allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Util.h"
+#include "VulkanUtil.h"
+
+#define POOL_MIN_CLASS 8 // 256 bytes
+#define POOL_MAX_CLASS 22 // 4mb, everything above gets a dedicated allocation
+#define POOL_BLOCK_MIN_SIZE (4ull << 20)
+#define POOL_BLOCK_MIN_SLOTS 8
+#define LINEAR_BLOCK_SIZE (64ull << 20)
+#define ALLOCATOR_BUCKETS 4096
+
+#define BLOCK_POOL 0
+#define BLOCK_LINEAR 1
+#define BLOCK_DEDICATED 2
+
+struct memoryBlock
+{
+	uint32_t kind; // BLOCK_*
+	uint32_t memory_type;
+	VkBool32 image; // images and buffers never share a block, so bufferImageGranularity does not matter
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	char* mapped; // NULL if not host visible
+	uint32_t live; // allocations in this block
+	// pool
+	uint32_t size_class;
+	uint32_t slot_count;
+	uint32_t* slot_bits; // 1 = used
+	// linear
+	VkDeviceSize head;
+	struct memoryBlock* next;
+};
+
+struct allocationEntry
+{
+	uint64_t handle; // VkBuffer or VkImage
+	MemoryBlock* block;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	uint32_t slot;
+	struct allocationEntry* next;
+};
+
+static uint32_t bucket(uint64_t handle)
+{
+	return (uint32_t)((handle >> 4) ^ (handle >> 20)) % ALLOCATOR_BUCKETS;
+}
+
+static uint32_t size_class(VkDeviceSize size)
+{
+	uint32_t c = POOL_MIN_CLASS;
+	while (((VkDeviceSize)1 << c) < size) c++;
+	return c;
+}
+
+static MemoryBlock* create_block(VkInfo* vk, uint32_t kind, uint32_t memory_type, VkBool32 image, VkDeviceSize size)
+{
+	GpuAllocator* a = &vk->allocator;
+	MemoryBlock* block = calloc(1, sizeof(MemoryBlock));
+	block->kind = kind;
+	block->memory_type = memory_type;
+	block->image = image;
+	block->size = size;
+
+	// buffers may ask for their device address, so every buffer block supports it
+	VkMemoryAllocateFlagsInfo flags = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+		.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
+		.deviceMask = 1,
+	};
+	VkMemoryAllocateInfo allocation_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.pNext = image ? NULL : &flags,
+		.allocationSize = size,
+		.memoryTypeIndex = memory_type
+	};
+	check(vkAllocateMemory(vk->device, &allocation_info, NULL, &block->memory), "Failed to allocate memory block");
+
+	if (vk->physical_device_memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		check(vkMapMemory(vk->device, block->memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->mapped), "Failed to map memory block");
+
+	block->next = a->blocks;
+	a->blocks = block;
+	a->stats.device_allocations++;
+	if (kind == BLOCK_DEDICATED) a->stats.dedicated_bytes += size;
+	else a->stats.reserved_bytes += size;
+	return block;
+}
+
+static void destroy_block(VkInfo* vk, MemoryBlock* block)
+{
+	GpuAllocator* a = &vk->allocator;
+	MemoryBlock** link = &a->blocks;
+	while (*link != block) link = &(*link)->next;
+	*link = block->next;
+
+	if (block->mapped) vkUnmapMemory(vk->device, block->memory);
+	vkFreeMemory(vk->device, block->memory, NULL);
+	a->stats.device_allocations--;
+	if (block->kind == BLOCK_DEDICATED) a->stats.dedicated_bytes -= block->size;
+	else a->stats.reserved_bytes -= block->size;
+	free(block->slot_bits);
+	free(block);
+}
+
+static int take_slot(MemoryBlock* block)
+{
+	for (uint32_t word = 0; word < (block->slot_count + 31) / 32; word++)
+	{
+		if (block->slot_bits[word] == 0xFFFFFFFF) continue;
+		for (uint32_t bit = 0; bit < 32; bit++)
+		{
+			uint32_t slot = word * 32 + bit;
+			if (slot >= block->slot_count) return -1;
+			if (!(block->slot_bits[word] & (1u << bit)))
+			{
+				block->slot_bits[word] |= 1u << bit;
+				return (int)slot;
+			}
+		}
+	}
+	return -1;
+}
+
+static void allocate(VkInfo* vk, uint64_t handle, VkMemoryRequirements req, VkMemoryPropertyFlags properties,
+	VkBool32 image, VkBool32 staging, VkDeviceMemory* memory, VkDeviceSize* offset)
+{
+	GpuAllocator* a = &vk->allocator;
+	uint32_t memory_type = findMemoryType(vk, req.memoryTypeBits, properties);
+	if (memory_type == (uint32_t)-1) error("Failed to find correct memory type");
+
+	AllocationEntry* entry = calloc(1, sizeof(AllocationEntry));
+	entry->handle = handle;
+	entry->size = req.size;
+	MemoryBlock* block = NULL;
+
+	if (staging && req.size <= LINEAR_BLOCK_SIZE)
+	{
+		for (MemoryBlock* b = a->blocks; b; b = b->next)
+		{
+			if (b->kind != BLOCK_LINEAR || b->memory_type != memory_type) continue;
+			VkDeviceSize start = (b->head + req.alignment - 1) / req.alignment * req.alignment;
+			if (start + req.size <= b->size) { block = b; entry->offset = start; break; }
+		}
+		if (!block) block = create_block(vk, BLOCK_LINEAR, memory_type, VK_FALSE, LINEAR_BLOCK_SIZE);
+		block->head = entry->offset + req.size;
+	}
+	else
+	{
+		// the slots are aligned to their own size, so an alignment above the size just picks a bigger class
+		uint32_t c = size_class(req.size > req.alignment ? req.size : req.alignment);
+		if (c <= POOL_MAX_CLASS)
+		{
+			for (MemoryBlock* b = a->blocks; b; b = b->next)
+			{
+				if (b->kind != BLOCK_POOL || b->memory_type != memory_type || b->image != image
+					|| b->size_class != c || b->live == b->slot_count) continue;
+				block = b;
+				break;
+			}
+			if (!block)
+			{
+				VkDeviceSize slot_size = (VkDeviceSize)1 << c;
+				VkDeviceSize block_size = slot_size * POOL_BLOCK_MIN_SLOTS;
+				if (block_size < POOL_BLOCK_MIN_SIZE) block_size = POOL_BLOCK_MIN_SIZE;
+				block = create_block(vk, BLOCK_POOL, memory_type, image, block_size);
+				block->size_class = c;
+				block->slot_count = (uint32_t)(block_size / slot_size);
+				block->slot_bits = calloc((block->slot_count + 31) / 32, sizeof(uint32_t));
+			}
+			entry->slot = (uint32_t)take_slot(block);
+			entry->offset = (VkDeviceSize)entry->slot << c;
+		}
+		else
+		{
+			block = create_block(vk, BLOCK_DEDICATED, memory_type, image, req.size);
+		}
+	}
+
+	block->live++;
+	entry->block = block;
+	uint32_t b = bucket(handle);
+	entry->next = a->table[b];
+	a->table[b] = entry;
+	a->stats.live_allocations++;
+	if (block->kind != BLOCK_DEDICATED) a->stats.used_bytes += req.size;
+
+	*memory = block->memory;
+	*offset = entry->offset;
+}
+
+static AllocationEntry* find_entry(GpuAllocator* a, uint64_t handle)
+{
+	for (AllocationEntry* e = a->table[bucket(handle)]; e; e = e->next)
+		if (e->handle == handle) return e;
+	return NULL;
+}
+
+void init_allocator(VkInfo* vk)
+{
+	memset(&vk->allocator, 0, sizeof(GpuAllocator));
+	vk->allocator.table = calloc(ALLOCATOR_BUCKETS, sizeof(AllocationEntry*));
+}
+
+void destroy_allocator(VkInfo* vk)
+{
+	GpuAllocator* a = &vk->allocator;
+	if (!a->table) return;
+	for (uint32_t b = 0; b < ALLOCATOR_BUCKETS; b++)
+	{
+		AllocationEntry* e = a->table[b];
+		while (e) { AllocationEntry* next = e->next; free(e); e = next; }
+	}
+	while (a->blocks) destroy_block(vk, a->blocks);
+	free(a->table);
+	memset(a, 0, sizeof(GpuAllocator));
+}
+
+void allocate_buffer_memory(VkInfo* vk, VkBuffer buffer, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkDeviceMemory* memory)
+{
+	VkMemoryRequirements req;
+	vkGetBufferMemoryRequirements(vk->device, buffer, &req);
+	VkDeviceSize offset;
+	allocate(vk, (uint64_t)buffer, req, properties, VK_FALSE, usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT, memory, &offset);
+	check(vkBindBufferMemory(vk->device, buffer, *memory, offset), "failed to bind buffer memory");
+}
+
+void allocate_image_memory(VkInfo* vk, VkImage image, VkMemoryPropertyFlags properties, VkDeviceMemory* memory)
+{
+	VkMemoryRequirements req;
+	vkGetImageMemoryRequirements(vk->device, image, &req);
+	VkDeviceSize offset;
+	allocate(vk, (uint64_t)image, req, properties, VK_TRUE, VK_FALSE, memory, &offset);
+	check(vkBindImageMemory(vk->device, image, *memory, offset), "failed to bind image memory");
+}
+
+void release_memory(VkInfo* vk, uint64_t handle)
+{
+	GpuAllocator* a = &vk->allocator;
+	AllocationEntry** link = &a->table[bucket(handle)];
+	while (*link && (*link)->handle != handle) link = &(*link)->next;
+	AllocationEntry* entry = *link;
+	if (!entry) return;
+	*link = entry->next;
+
+	MemoryBlock* block = entry->block;
+	block->live--;
+	a->stats.live_allocations--;
+	if (block->kind != BLOCK_DEDICATED) a->stats.used_bytes -= entry->size;
+
+	if (block->kind == BLOCK_POOL)
+		block->slot_bits[entry->slot / 32] &= ~(1u << (entry->slot % 32));
+	else if (block->kind == BLOCK_LINEAR && block->live == 0)
+		block->head = 0;
+	else if (block->kind == BLOCK_DEDICATED)
+		destroy_block(vk, block);
+	free(entry);
+}
+
+void* map_memory(VkInfo* vk, uint64_t handle)
+{
+	AllocationEntry* entry = find_entry(&vk->allocator, handle);
+	if (!entry || !entry->block->mapped) error("memory is not host visible");
+	return entry->block->mapped + entry->offset;
+}
+
+void defragment_allocator(VkInfo* vk)
+{
+	GpuAllocator* a = &vk->allocator;
+	MemoryBlock* block = a->blocks;
+	while (block)
+	{
+		MemoryBlock* next = block->next;
+		if (block->live == 0) destroy_block(vk, block);
+		block = next;
+	}
+}
@@ -0,0 +1,19 @@
+﻿#pragma once
+#include "Globals.h"
+
+// pooled device memory, every buffer and image gets a place in a bigger vkAllocateMemory block:
+// - pool blocks are split into equal slots of one power of two size class
+// - staging buffers (usage is only TRANSFER_SRC) are placed linearly in a block that restarts once all of them are freed
+// - everything above the largest size class gets its own allocation
+// host visible blocks stay mapped, use mapBuffer instead of vkMapMemory
+void init_allocator(VkInfo* vk);
+void destroy_allocator(VkInfo* vk);
+
+// allocates and binds the memory, memory receives the block it lives in
+void allocate_buffer_memory(VkInfo* vk, VkBuffer buffer, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkDeviceMemory* memory);
+void allocate_image_memory(VkInfo* vk, VkImage image, VkMemoryPropertyFlags properties, VkDeviceMemory* memory);
+void release_memory(VkInfo* vk, uint64_t handle);
+void* map_memory(VkInfo* vk, uint64_t handle);
+
+// frees the blocks nothing lives in anymore, called on scene change when everything of the old scene is gone
+void defragment_allocator(VkInfo* vk);
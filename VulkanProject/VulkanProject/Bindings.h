@@ -3,11 +3,10 @@
 #define GLOBAL_BUFFER_COUNT 8
 
 #define SCENE_DATA_BINDING 0
-#define VERTEX_BUFFER_BINDING 1
-#define INDEX_BUFFER_BINDING 2
+#define SCENE_POINTER_BINDING 1 // addresses of the vertex, index and node chunks
 #define MATERIAL_BUFFER_BINDING 3
 #define LIGHT_BUFFER_BINDING 4
-#define NODE_BUFFER_BINDING 5
+#define LIGHT_TREE_BINDING 5 // LightNodes, see LightTree.c
 #define TRANSFORM_BUFFER_BINDING 6
 #define NODE_CHILDREN_BINDING 7
 #define SAMPLER_BINDING 8
@@ -16,14 +15,31 @@
 #define FRAME_DATA_BINDING 11
 #define TLAS_BINDING 12
 #define TRACE_BINDING 13
+#define OUTPUT_IMAGE_BINDING 14
+#define WAVEFRONT_RAY_BINDING 15
+#define WAVEFRONT_HIT_BINDING 16
+#define WAVEFRONT_SHADOW_BINDING 17
+#define WAVEFRONT_COUNTER_BINDING 18
+#define WAVEFRONT_ACCUM_BINDING 19
+#define WAVEFRONT_STATS_BINDING 20
+#define VISIBILITY_BINDING 21
+#define FRAME_STATS_BINDING 22
+#define NODE_COST_BINDING 23
+#define HISTORY_BINDING 24
+#define REPROJECTION_BINDING 25
+#define INVERSE_TRANSFORM_BINDING 26 // next to the transforms in set 0
+
+// every ray tracing binding is visible to the fragment and the compute path
+#define RAY_SHADER_STAGES (VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
 
 #define GET_SCENE_DATA_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[0])
-#define GET_VERTEX_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[1])
-#define GET_INDEX_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[2])
-#define GET_MATERIAL_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[3])
-#define GET_LIGHT_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[4])
-#define GET_NODE_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[5])
-#define GET_TRANSFROM_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[6])
-#define GET_CHILD_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[7])
+#define GET_SCENE_POINTER_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[1])
+#define GET_MATERIAL_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[2])
+#define GET_LIGHT_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[3])
+#define GET_TRANSFROM_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[4])
+#define GET_CHILD_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[5])
+#define GET_LIGHT_TREE_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[6])
+#define GET_INVERSE_TRANSFORM_BUFFER(VK_INFO) (##VK_INFO->global_buffers.buffer_containers[0].buffers[7])
 
-#define GET_FRAMEDATA_BUFFER(VK_INFO, i) (##VK_INFO->per_frame_buffers.buffer_containers[##i].buffers[0])
\ No newline at end of file
+#define GET_FRAMEDATA_BUFFER(VK_INFO, i) (##VK_INFO->per_frame_buffers.buffer_containers[##i].buffers[0])
+#define GET_FRAMESTATS_BUFFER(VK_INFO, i) (##VK_INFO->per_frame_buffers.buffer_containers[##i].buffers[1])
\ No newline at end of file
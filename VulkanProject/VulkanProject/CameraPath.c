@@ -0,0 +1,211 @@
+﻿#include "CameraPath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "NodeProfile.h"
+#include "Platform.h"
+#include "Profiler.h"
+#include "Util.h"
+
+#define CAMERA_PATH_FILE "camera.path"
+#define CAMERA_PATH_MAGIC 0x48544150
+#define CAMERA_PATH_STEP (1.0 / 60.0) // seconds between two recorded samples
+
+typedef struct cameraPathHeader
+{
+	uint32_t magic;
+	uint32_t camera_size; // a path of an older Camera layout is refused
+	uint32_t sample_count;
+} CameraPathHeader;
+
+static void append_sample(Benchmark* b, const Camera* camera)
+{
+	if (b->sample_count == b->sample_capacity)
+	{
+		b->sample_capacity = b->sample_capacity ? b->sample_capacity * 2 : 1024;
+		b->samples = realloc(b->samples, sizeof(Camera) * b->sample_capacity);
+	}
+	b->samples[b->sample_count++] = *camera;
+}
+
+void start_path_recording(VkInfo* vk, const Camera* camera)
+{
+	Benchmark* b = &vk->benchmark;
+	if (b->state != BENCHMARK_IDLE) return;
+	b->sample_count = 0;
+	b->next_sample = get_time();
+	b->state = BENCHMARK_RECORDING;
+	append_sample(b, camera);
+}
+
+void stop_path_recording(VkInfo* vk)
+{
+	Benchmark* b = &vk->benchmark;
+	if (b->state != BENCHMARK_RECORDING) return;
+	b->state = BENCHMARK_IDLE;
+
+	CameraPathHeader header = { CAMERA_PATH_MAGIC, sizeof(Camera), b->sample_count };
+	FILE* file;
+	const char* name = b->path_file ? b->path_file : CAMERA_PATH_FILE;
+	fopen_s(&file, name, "wb");
+	if (!file)
+	{
+		printf("could not write %s\n", name);
+		return;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(b->samples, sizeof(Camera), b->sample_count, file);
+	fclose(file);
+	printf("camera path: %u samples written\n", b->sample_count);
+}
+
+static uint32_t load_camera_path(Benchmark* b)
+{
+	CameraPathHeader header;
+	const char* name = b->path_file ? b->path_file : CAMERA_PATH_FILE;
+	FILE* file;
+	fopen_s(&file, name, "rb");
+	if (!file)
+	{
+		printf("no %s recorded\n", name);
+		return 0;
+	}
+	uint32_t loaded = 0;
+	if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == CAMERA_PATH_MAGIC &&
+		header.camera_size == sizeof(Camera) && header.sample_count > 0)
+	{
+		b->samples = realloc(b->samples, sizeof(Camera) * header.sample_count);
+		b->sample_capacity = header.sample_count;
+		b->sample_count = (uint32_t)fread(b->samples, sizeof(Camera), header.sample_count, file);
+		loaded = b->sample_count > 0;
+	}
+	fclose(file);
+	if (!loaded) printf("%s does not match this build, record it again\n", name);
+	return loaded;
+}
+
+void start_benchmark(VkInfo* vk, const Camera* fixed_view)
+{
+	Benchmark* b = &vk->benchmark;
+	if (b->state != BENCHMARK_IDLE || b->measure_frames == 0) return;
+	if (fixed_view)
+	{
+		b->sample_count = 0;
+		append_sample(b, fixed_view);
+	}
+	else if (!load_camera_path(b))
+		return;
+
+	free(b->frame_ms);
+	b->frame_ms = malloc(sizeof(double) * b->measure_frames);
+	b->frame = 0;
+	b->state = BENCHMARK_WARMUP;
+	// vsync would measure the display, the swapchain is recreated with the next reload
+	b->restore_vsync = vk->vsync;
+	if (vk->vsync)
+	{
+		vk->vsync = 0;
+		vk->reload = 1;
+	}
+	printf("benchmark: %u samples, %u warm-up and %u measured frames\n", b->sample_count, b->warmup_frames, b->measure_frames);
+}
+
+static int compare_ms(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// nearest rank, p in (0, 1]
+static float percentile(const double* sorted, uint32_t count, double p)
+{
+	uint32_t rank = (uint32_t)(p * count + 0.999999);
+	return (float)sorted[min(max(rank, 1), count) - 1];
+}
+
+static void finish_benchmark(VkInfo* vk)
+{
+	Benchmark* b = &vk->benchmark;
+	uint32_t count = b->measure_frames;
+	qsort(b->frame_ms, count, sizeof(double), compare_ms);
+	double sum = 0;
+	for (uint32_t i = 0; i < count; i++)
+		sum += b->frame_ms[i];
+	b->min_ms = (float)b->frame_ms[0];
+	b->avg_ms = (float)(sum / count);
+	b->p95_ms = percentile(b->frame_ms, count, 0.95);
+	b->p99_ms = percentile(b->frame_ms, count, 0.99);
+	printf("benchmark: %u frames min %.3fms avg %.3fms p95 %.3fms p99 %.3fms\n",
+		count, b->min_ms, b->avg_ms, b->p95_ms, b->p99_ms);
+	if (b->write_node_profile) stop_node_profile(vk, b->node_profile_file);
+	stop_benchmark(vk);
+}
+
+void stop_benchmark(VkInfo* vk)
+{
+	Benchmark* b = &vk->benchmark;
+	if (b->state != BENCHMARK_WARMUP && b->state != BENCHMARK_MEASURE) return;
+	if (b->write_csv) stop_profile_capture(vk);
+	cancel_node_profile(vk); // a stopped run is not written
+	b->state = BENCHMARK_IDLE;
+	free(b->frame_ms);
+	b->frame_ms = NULL;
+	if (vk->vsync != b->restore_vsync)
+	{
+		vk->vsync = b->restore_vsync;
+		vk->reload = 1;
+	}
+}
+
+uint32_t update_camera_path(VkInfo* vk, Camera* camera)
+{
+	Benchmark* b = &vk->benchmark;
+	double now = get_time();
+
+	if (b->state == BENCHMARK_RECORDING)
+	{
+		// fixed steps, the replay does not depend on the frame rate of the recording
+		for (b->next_sample += CAMERA_PATH_STEP; b->next_sample <= now; b->next_sample += CAMERA_PATH_STEP)
+			append_sample(b, camera);
+		b->next_sample -= CAMERA_PATH_STEP;
+		return 0;
+	}
+	if (b->state != BENCHMARK_WARMUP && b->state != BENCHMARK_MEASURE)
+		return 0;
+
+	// the time since the last call is the whole previous frame
+	if (b->state == BENCHMARK_MEASURE && b->frame > 0)
+		b->frame_ms[b->frame - 1] = (now - b->last_time) * 1000.0;
+	b->last_time = now;
+
+	if (b->state == BENCHMARK_WARMUP && b->frame >= b->warmup_frames)
+	{
+		b->state = BENCHMARK_MEASURE;
+		b->frame = 0;
+		if (b->write_csv) start_profile_capture(vk, b->csv_file);
+		if (b->write_node_profile) start_node_profile(vk);
+	}
+	if (b->state == BENCHMARK_MEASURE && b->frame == b->measure_frames)
+	{
+		finish_benchmark(vk);
+		return 0;
+	}
+
+	*camera = b->samples[b->frame % b->sample_count];
+	b->frame++;
+	return 1;
+}
+
+void destroy_camera_path(VkInfo* vk)
+{
+	Benchmark* b = &vk->benchmark;
+	stop_path_recording(vk);
+	free(b->samples);
+	free(b->frame_ms);
+	b->samples = NULL;
+	b->frame_ms = NULL;
+	b->sample_count = b->sample_capacity = 0;
+	b->state = BENCHMARK_IDLE;
+}
@@ -0,0 +1,13 @@
+﻿#pragma once
+#include "Globals.h"
+
+// records the camera (pose and render settings) at fixed steps into a path file and replays it one step per frame.
+// the replay runs without vsync, warms up and then prints min, avg, p95 and p99 of the measured frame times
+void start_path_recording(VkInfo* vk, const Camera* camera);
+void stop_path_recording(VkInfo* vk); // writes the file
+// replays path_file, or holds fixed_view for every frame if it is set
+void start_benchmark(VkInfo* vk, const Camera* fixed_view);
+void stop_benchmark(VkInfo* vk);
+// once per frame before drawFrame, returns 1 while the replay drives the camera instead of the input
+uint32_t update_camera_path(VkInfo* vk, Camera* camera);
+void destroy_camera_path(VkInfo* vk);
@@ -0,0 +1,555 @@
+﻿#include "Compute.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Allocator.h"
+#include "Bindings.h"
+#include "RenderScale.h"
+#include "Shader.h"
+#include "Util.h"
+#include "VulkanUtil.h"
+
+#define COMPUTE_TARGET_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+#define VISIBILITY_TEXEL_SIZE 24 // see VisibilityTexel in visibility.comp
+
+static void create_target_buffer(VkInfo* vk, Buffer* buffer, VkDeviceSize size, VkBufferUsageFlags transfer)
+{
+	buffer->usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | transfer;
+	buffer->properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	buffer->buffer_size = size;
+	createBuffer(vk, size, buffer->usage, buffer->properties, &buffer->vk_buffer, &buffer->vk_buffer_memory);
+}
+
+void create_compute_target(VkInfo* vk)
+{
+	ComputeTarget* target = &vk->compute_target;
+	Swapchain* swapchain = &vk->swapchain;
+
+	// set 4 - the output image and the buffers of the deferred mode, the layout lives as long as the device
+	if (!target->set_layout)
+	{
+		VkDescriptorSetLayoutBinding image_binding = {
+			.binding = OUTPUT_IMAGE_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+		};
+		VkDescriptorSetLayoutBinding visibility_binding = {
+			.binding = VISIBILITY_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+		};
+		VkDescriptorSetLayoutBinding history_binding = visibility_binding;
+		history_binding.binding = HISTORY_BINDING;
+		VkDescriptorSetLayoutBinding reprojection_binding = visibility_binding;
+		reprojection_binding.binding = REPROJECTION_BINDING;
+		VkDescriptorSetLayoutBinding bindings[] = { image_binding, visibility_binding, history_binding, reprojection_binding };
+		VkDescriptorSetLayoutCreateInfo layout_create_info = { 0 };
+		layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_create_info.bindingCount = 4;
+		layout_create_info.pBindings = bindings;
+
+		check(vkCreateDescriptorSetLayout(vk->device, &layout_create_info, NULL, &target->set_layout), "");
+		target->imageBinding = OUTPUT_IMAGE_BINDING;
+		target->visibilityBinding = VISIBILITY_BINDING;
+		target->historyBinding = HISTORY_BINDING;
+		target->reprojectionBinding = REPROJECTION_BINDING;
+	}
+
+	// the image itself has the size of the swapchain
+	target->extent = swapchain->extent;
+
+	VkImageCreateInfo imageInfo = { 0 };
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = target->extent.width;
+	imageInfo.extent.height = target->extent.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = COMPUTE_TARGET_FORMAT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	check(vkCreateImage(vk->device, &imageInfo, NULL, &target->image), "failed to create compute target");
+
+	allocate_image_memory(vk, target->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &target->memory);
+
+	VkImageViewCreateInfo viewInfo = { 0 };
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = target->image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = COMPUTE_TARGET_FORMAT;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	check(vkCreateImageView(vk->device, &viewInfo, NULL, &target->view), "failed to create compute target view");
+
+	VkDeviceSize pixels = (VkDeviceSize)target->extent.width * target->extent.height;
+	create_target_buffer(vk, &target->visibility, pixels * VISIBILITY_TEXEL_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	// the visibility buffer is copied into the history at the end of a deferred frame
+	create_target_buffer(vk, &target->history, pixels * VISIBILITY_TEXEL_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	create_target_buffer(vk, &target->reprojection, pixels * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	target->timestamp_period = properties.limits.timestampPeriod;
+	VkQueryPoolCreateInfo query_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = DEFERRED_QUERIES * vk->swapchain.image_count
+	};
+	check(vkCreateQueryPool(vk->device, &query_info, NULL, &target->query_pool), "failed to create query pool");
+	VkCommandBuffer cb = beginSingleTimeCommands(vk);
+	vkCmdResetQueryPool(cb, target->query_pool, 0, query_info.queryCount);
+	endSingleTimeCommands(vk, cb);
+
+	// the set is freed whenever the pool is reset, otherwise it is just rewritten
+	if (!target->descriptor_set)
+	{
+		VkDescriptorSetAllocateInfo alloc_info = { 0 };
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = vk->descriptor_pool;
+		alloc_info.descriptorSetCount = 1;
+		alloc_info.pSetLayouts = &target->set_layout;
+
+		check(vkAllocateDescriptorSets(vk->device, &alloc_info, &target->descriptor_set), "");
+	}
+
+	VkDescriptorImageInfo image_info = {
+		.imageView = target->view,
+		.imageLayout = VK_IMAGE_LAYOUT_GENERAL
+	};
+	VkDescriptorBufferInfo visibility_info = {
+		.buffer = target->visibility.vk_buffer,
+		.offset = 0,
+		.range = target->visibility.buffer_size
+	};
+	VkDescriptorBufferInfo history_info = {
+		.buffer = target->history.vk_buffer,
+		.offset = 0,
+		.range = target->history.buffer_size
+	};
+	VkDescriptorBufferInfo reprojection_info = {
+		.buffer = target->reprojection.vk_buffer,
+		.offset = 0,
+		.range = target->reprojection.buffer_size
+	};
+	VkWriteDescriptorSet writes[] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = target->descriptor_set,
+			.dstBinding = target->imageBinding,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.pImageInfo = &image_info
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = target->descriptor_set,
+			.dstBinding = target->visibilityBinding,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &visibility_info
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = target->descriptor_set,
+			.dstBinding = target->historyBinding,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &history_info
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = target->descriptor_set,
+			.dstBinding = target->reprojectionBinding,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &reprojection_info
+		}
+	};
+	vkUpdateDescriptorSets(vk->device, 4, writes, 0, NULL);
+}
+
+void create_compute_pipeline(VkInfo* vk)
+{
+	char path[128];
+	ray_shader_binary(vk, "shader.comp", path, sizeof(path));
+	load_shader(vk, &vk->compute_shader, path);
+	ray_shader_binary(vk, "visibility.comp", path, sizeof(path));
+	load_shader(vk, &vk->deferred_shader, path);
+
+	// sets 0-3 are shared with the fragment path, 4 is the output image
+	VkDescriptorSetLayout layouts[] = {
+		vk->global_buffers.set_layout,
+		vk->texture_container.layout,
+		vk->per_frame_buffers.set_layout,
+		vk->ray_descriptor.set_layout,
+		vk->compute_target.set_layout
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 5;
+	pipeline_layout_info.pSetLayouts = layouts;
+
+	check(vkCreatePipelineLayout(vk->device, &pipeline_layout_info, NULL, &vk->compute_pipeline_layout),
+		"failed to create compute pipeline layout");
+
+	// the workgroup has to fit the device, shrink y first since rows are the cheaper dimension to lose
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	if (vk->workgroup_width < 1) vk->workgroup_width = 1;
+	if (vk->workgroup_height < 1) vk->workgroup_height = 1;
+	if (vk->workgroup_width > properties.limits.maxComputeWorkGroupSize[0])
+		vk->workgroup_width = properties.limits.maxComputeWorkGroupSize[0];
+	if (vk->workgroup_height > properties.limits.maxComputeWorkGroupSize[1])
+		vk->workgroup_height = properties.limits.maxComputeWorkGroupSize[1];
+	while (vk->workgroup_height > 1 &&
+		vk->workgroup_width * vk->workgroup_height > properties.limits.maxComputeWorkGroupInvocations)
+		vk->workgroup_height--;
+
+	create_compute_variants(vk, &vk->variant, &vk->compute_pipeline, vk->deferred_pipelines);
+}
+
+VkBool32 compute_full_subgroups(VkInfo* vk)
+{
+	// without varying subgroup sizes the tile width has to be a multiple of the subgroup size
+	return vk->full_subgroups && vk->workgroup_width % vk->subgroup.subgroupSize == 0;
+}
+
+void create_compute_variants(VkInfo* vk, const ShaderVariant* variant, VkPipeline* compute, VkPipeline* deferred)
+{
+	// constant ids match tiles.frag, 3 is the pass of visibility.comp, the shader variant follows
+	// and then whether the tiles run in full subgroups
+	VkBool32 full_subgroups = compute_full_subgroups(vk);
+	uint32_t spec_data[5 + SHADER_VARIANT_CONSTANTS] = { vk->workgroup_width, vk->workgroup_height, vk->tile_order, DEFERRED_PASS_VISIBILITY };
+	VkSpecializationMapEntry spec_entries[5 + SHADER_VARIANT_CONSTANTS] = {
+		{.constantID = 0, .offset = 0, .size = sizeof(uint32_t) },
+		{.constantID = 1, .offset = sizeof(uint32_t), .size = sizeof(uint32_t) },
+		{.constantID = 2, .offset = 2 * sizeof(uint32_t), .size = sizeof(uint32_t) },
+		{.constantID = 3, .offset = 3 * sizeof(uint32_t), .size = sizeof(uint32_t) },
+	};
+	uint32_t count = append_variant_constants(variant, spec_data, spec_entries, 4);
+	spec_data[count] = full_subgroups;
+	spec_entries[count] = (VkSpecializationMapEntry){
+		.constantID = FULL_SUBGROUPS_CONSTANT_ID, .offset = count * sizeof(uint32_t), .size = sizeof(uint32_t) };
+	VkSpecializationInfo spec_info = {
+		.mapEntryCount = count + 1,
+		.pMapEntries = spec_entries,
+		.dataSize = sizeof(spec_data),
+		.pData = spec_data
+	};
+
+	VkComputePipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.flags = full_subgroups ? VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT_EXT : 0,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = vk->compute_shader.module,
+			.pName = "main",
+			.pSpecializationInfo = &spec_info
+		},
+		.layout = vk->compute_pipeline_layout
+	};
+
+	check(vkCreateComputePipelines(vk->device, vk->pipeline_cache, 1, &pipeline_info, NULL, compute),
+		"failed to create compute pipeline");
+
+	// the passes of the deferred mode
+	pipeline_info.stage.module = vk->deferred_shader.module;
+	for (uint32_t pass = 0; pass < DEFERRED_PASS_COUNT; pass++)
+	{
+		spec_data[3] = pass;
+		check(vkCreateComputePipelines(vk->device, vk->pipeline_cache, 1, &pipeline_info, NULL, &deferred[pass]),
+			"failed to create deferred pipeline");
+	}
+}
+
+void record_compute_target_begin(VkInfo* vk, VkCommandBuffer cb)
+{
+	VkImageSubresourceRange range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	// the previous contents are not needed, only wait for the last blit to finish reading
+	VkImageMemoryBarrier to_general = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = vk->compute_target.image,
+		.subresourceRange = range
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, NULL, 0, NULL, 1, &to_general);
+}
+
+// target_layout is GENERAL right after the dispatch, a frame that is presented again finds it as the last blit left it
+static void blit_compute_target(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index, VkImageLayout target_layout,
+	VkExtent2D traced)
+{
+	ComputeTarget* target = &vk->compute_target;
+	VkImage swapchain_image = vk->swapchain.images[image_index];
+	VkBool32 scaled = traced.width != vk->swapchain.extent.width || traced.height != vk->swapchain.extent.height;
+
+	VkImageSubresourceRange range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	// storage image -> blit source, swapchain image -> blit destination
+	// the swapchain barrier hangs off the color output stage so it chains with the acquire semaphore
+	VkImageMemoryBarrier to_blit[] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = target_layout == VK_IMAGE_LAYOUT_GENERAL ? VK_ACCESS_SHADER_WRITE_BIT : 0,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+			.oldLayout = target_layout,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = target->image,
+			.subresourceRange = range
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = swapchain_image,
+			.subresourceRange = range
+		}
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT |
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, to_blit);
+
+	VkImageBlit blit = {
+		.srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+		.srcOffsets = { {0, 0, 0}, {(int32_t)traced.width, (int32_t)traced.height, 1} },
+		.dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+		.dstOffsets = { {0, 0, 0}, {(int32_t)vk->swapchain.extent.width, (int32_t)vk->swapchain.extent.height, 1} },
+	};
+	// a lower render scale only covers the top left corner of the target, it is stretched with a bilinear filter
+	vkCmdBlitImage(cb, target->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		swapchain_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, scaled ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+
+	// hand the swapchain image over in the layout the imgui pass expects
+	VkImageMemoryBarrier to_attachment = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = swapchain_image,
+		.subresourceRange = range
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		0, 0, NULL, 0, NULL, 1, &to_attachment);
+}
+
+void record_compute_target_blit(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index)
+{
+	blit_compute_target(vk, cb, image_index, VK_IMAGE_LAYOUT_GENERAL, traced_extent(vk, image_index));
+}
+
+void record_compute_target_present(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index)
+{
+	blit_compute_target(vk, cb, image_index, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, vk->swapchain.extent);
+}
+
+void record_compute_dispatch(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index)
+{
+	ComputeTarget* target = &vk->compute_target;
+
+	record_compute_target_begin(vk, cb);
+
+	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, vk->compute_pipeline);
+	VkDescriptorSet sets[] = {
+		vk->global_buffers.descriptor_sets[0],
+		vk->texture_container.descriptor_set,
+		vk->per_frame_buffers.descriptor_sets[image_index],
+		vk->ray_descriptor.descriptor_set,
+		target->descriptor_set
+	};
+	vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, vk->compute_pipeline_layout,
+		0, 5, sets, 0, NULL);
+
+	VkExtent2D traced = traced_extent(vk, image_index);
+	uint32_t groups_x = (traced.width + vk->workgroup_width - 1) / vk->workgroup_width;
+	uint32_t groups_y = (traced.height + vk->workgroup_height - 1) / vk->workgroup_height;
+	vkCmdDispatch(cb, groups_x, groups_y, 1);
+
+	record_compute_target_blit(vk, cb, image_index);
+}
+
+void record_deferred_dispatch(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index)
+{
+	ComputeTarget* target = &vk->compute_target;
+	uint32_t first_query = image_index * DEFERRED_QUERIES;
+
+	vkCmdResetQueryPool(cb, target->query_pool, first_query, DEFERRED_QUERIES);
+	record_compute_target_begin(vk, cb);
+
+	VkDescriptorSet sets[] = {
+		vk->global_buffers.descriptor_sets[0],
+		vk->texture_container.descriptor_set,
+		vk->per_frame_buffers.descriptor_sets[image_index],
+		vk->ray_descriptor.descriptor_set,
+		target->descriptor_set
+	};
+	vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, vk->compute_pipeline_layout,
+		0, 5, sets, 0, NULL);
+
+	VkExtent2D traced = traced_extent(vk, image_index);
+	uint32_t groups_x = (traced.width + vk->workgroup_width - 1) / vk->workgroup_width;
+	uint32_t groups_y = (traced.height + vk->workgroup_height - 1) / vk->workgroup_height;
+
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+	};
+
+	// reprojection: the hits of the last frame are scattered into this one, the shader skips it unless the frame
+	// data allows reuse (Temporal.c). the barrier after the clear also covers the history copy of the last frame
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, target->query_pool, first_query);
+	vkCmdFillBuffer(cb, target->reprojection.vk_buffer, 0, VK_WHOLE_SIZE, 0xFFFFFFFF);
+	VkMemoryBarrier cleared = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &cleared, 0, NULL, 0, NULL);
+	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, vk->deferred_pipelines[DEFERRED_PASS_REPROJECT]);
+	vkCmdDispatch(cb, groups_x, groups_y, 1);
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, NULL, 0, NULL);
+
+	// visibility: only traversal for the pixels nothing could be reused for, writes the primary hit per pixel
+	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, vk->deferred_pipelines[DEFERRED_PASS_VISIBILITY]);
+	vkCmdDispatch(cb, groups_x, groups_y, 1);
+
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, NULL, 0, NULL);
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, target->query_pool, first_query + 1);
+
+	// shading: material, lights and the secondary rays
+	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, vk->deferred_pipelines[DEFERRED_PASS_SHADING]);
+	vkCmdDispatch(cb, groups_x, groups_y, 1);
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, target->query_pool, first_query + 2);
+
+	// the hits of this frame are what the next one reprojects
+	VkMemoryBarrier to_history = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &to_history, 0, NULL, 0, NULL);
+	VkBufferCopy region = { .srcOffset = 0, .dstOffset = 0,
+		.size = (VkDeviceSize)traced.width * traced.height * VISIBILITY_TEXEL_SIZE };
+	vkCmdCopyBuffer(cb, target->visibility.vk_buffer, target->history.vk_buffer, 1, &region);
+
+	record_compute_target_blit(vk, cb, image_index);
+}
+
+void read_deferred_timings(VkInfo* vk, uint32_t image_index)
+{
+	ComputeTarget* target = &vk->compute_target;
+	if (!target->query_pool) return;
+
+	uint64_t timestamps[DEFERRED_QUERIES];
+	if (vkGetQueryPoolResults(vk->device, target->query_pool, image_index * DEFERRED_QUERIES, DEFERRED_QUERIES,
+		sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+
+	float ms = target->timestamp_period / 1000000.0f;
+	target->visibility_ms = (float)(timestamps[1] - timestamps[0]) * ms;
+	target->shading_ms = (float)(timestamps[2] - timestamps[1]) * ms;
+}
+
+void destroy_compute_target(VkInfo* vk)
+{
+	ComputeTarget* target = &vk->compute_target;
+	if (target->view) vkDestroyImageView(vk->device, target->view, NULL);
+	destroyImage(vk, target->image);
+	target->view = NULL;
+	target->image = NULL;
+	target->memory = NULL;
+
+	destroyBuffer(vk, target->visibility.vk_buffer);
+	destroyBuffer(vk, target->history.vk_buffer);
+	destroyBuffer(vk, target->reprojection.vk_buffer);
+	memset(&target->visibility, 0, sizeof(Buffer));
+	memset(&target->history, 0, sizeof(Buffer));
+	memset(&target->reprojection, 0, sizeof(Buffer));
+
+	if (target->query_pool) vkDestroyQueryPool(vk->device, target->query_pool, NULL);
+	target->query_pool = NULL;
+}
+
+void destroy_compute_variants(VkInfo* vk)
+{
+	if (vk->compute_pipeline)
+		vkDestroyPipeline(vk->device, vk->compute_pipeline, NULL);
+	vk->compute_pipeline = NULL;
+
+	for (uint32_t pass = 0; pass < DEFERRED_PASS_COUNT; pass++)
+	{
+		if (vk->deferred_pipelines[pass])
+			vkDestroyPipeline(vk->device, vk->deferred_pipelines[pass], NULL);
+		vk->deferred_pipelines[pass] = NULL;
+	}
+}
+
+void destroy_compute_pipeline(VkInfo* vk)
+{
+	destroy_compute_variants(vk);
+
+	if (vk->compute_pipeline_layout)
+		vkDestroyPipelineLayout(vk->device, vk->compute_pipeline_layout, NULL);
+	vk->compute_pipeline_layout = NULL;
+
+	if (vk->compute_shader.module)
+		vkDestroyShaderModule(vk->device, vk->compute_shader.module, NULL);
+	vk->compute_shader.module = NULL;
+	free(vk->compute_shader.code);
+	vk->compute_shader.code = 0;
+
+	if (vk->deferred_shader.module)
+		vkDestroyShaderModule(vk->device, vk->deferred_shader.module, NULL);
+	vk->deferred_shader.module = NULL;
+	free(vk->deferred_shader.code);
+	vk->deferred_shader.code = 0;
+}
@@ -0,0 +1,22 @@
+﻿#pragma once
+#include "Globals.h"
+
+// compute path, traces the frame in tiles into a storage image which is then blitted to the swapchain
+void create_compute_target(VkInfo* vk);
+void create_compute_pipeline(VkInfo* vk);
+// the tiled and the two deferred pipelines of a variant, the layout and modules have to exist
+void create_compute_variants(VkInfo* vk, const ShaderVariant* variant, VkPipeline* compute, VkPipeline* deferred);
+// the tiles run in full subgroups, only then the quad pairs of the ray rates are horizontal neighbours
+VkBool32 compute_full_subgroups(VkInfo* vk);
+void record_compute_dispatch(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index);
+// deferred mode, a visibility pass and a shading pass over the same tiles
+void record_deferred_dispatch(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index);
+void read_deferred_timings(VkInfo* vk, uint32_t image_index);
+// storage image -> GENERAL before it is written, and the blit onto the swapchain image afterwards
+void record_compute_target_begin(VkInfo* vk, VkCommandBuffer cb);
+void record_compute_target_blit(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index);
+// blits what the target still holds from the last full resolution frame, nothing is traced
+void record_compute_target_present(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index);
+void destroy_compute_target(VkInfo* vk);
+void destroy_compute_variants(VkInfo* vk);
+void destroy_compute_pipeline(VkInfo* vk);
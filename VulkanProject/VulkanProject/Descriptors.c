@@ -102,11 +102,15 @@ void create_descriptor_pool(VkInfo* vk)
 	tlas.type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
 	tlas.descriptorCount = 50;
 
-	VkDescriptorPoolSize poolSizes[] = { uniCount, uniDynCount , sampler_image, sampler, texture_image, tlas };
+	VkDescriptorPoolSize storage_image = { 0 };
+	storage_image.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	storage_image.descriptorCount = 50;
+
+	VkDescriptorPoolSize poolSizes[] = { uniCount, uniDynCount , sampler_image, sampler, texture_image, tlas, storage_image };
 
 	VkDescriptorPoolCreateInfo poolInfo = { 0 };
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = 6;
+	poolInfo.poolSizeCount = 7;
 	poolInfo.pPoolSizes = poolSizes;
 	poolInfo.maxSets = 30;
 
@@ -166,9 +170,7 @@ void destroy_buffer(VkInfo* vk, DescriptorSetContainer* container)
 		BufferContainer bufContainer = container->buffer_containers[con];
 		for(uint32_t buf = 0;buf < bufContainer.buffer_count;buf++)
 		{
-			Buffer buffer = bufContainer.buffers[buf];
-			vkFreeMemory(vk->device, buffer.vk_buffer_memory, NULL);
-			vkDestroyBuffer(vk->device, buffer.vk_buffer, NULL);
+			destroyBuffer(vk, bufContainer.buffers[buf].vk_buffer);
 		}
 		free(bufContainer.buffers);
 	}
@@ -28,6 +28,53 @@ typedef struct buffer
 	size_t buffer_size;
 } Buffer;
 
+// one persistently mapped FrameData per swapchain image, the descriptor sets and command buffers are per image as well
+typedef struct frameRing
+{
+	uint32_t count;
+	FrameData** mapped; // into the per frame buffers
+	FrameData* written; // what each slot got last, only the changed ranges are written again
+	uint32_t dirty_bytes; // written by the last frame
+} FrameRing;
+
+typedef struct memoryBlock MemoryBlock; // Allocator.c
+typedef struct allocationEntry AllocationEntry;
+
+typedef struct allocatorStats
+{
+	uint32_t live_allocations; // buffers and images
+	uint32_t device_allocations; // vkAllocateMemory calls that are alive
+	VkDeviceSize used_bytes; // requested by the allocations in pool and linear blocks
+	VkDeviceSize reserved_bytes; // size of the pool and linear blocks
+	VkDeviceSize dedicated_bytes; // allocations too big for a pool
+} AllocatorStats;
+
+typedef struct gpuAllocator
+{
+	MemoryBlock* blocks;
+	AllocationEntry** table; // live allocations by buffer / image handle
+	AllocatorStats stats;
+} GpuAllocator;
+
+#define SCENE_CHUNK_SIZE (256ull << 20) // max bytes per chunk buffer
+#define MAX_SCENE_CHUNKS 32 // same as in structs.frag
+
+// an array split over several buffers, each holding 2^chunk_shift elements (the last one less)
+typedef struct chunkedBuffer
+{
+	uint32_t chunk_count;
+	uint32_t chunk_shift;
+	Buffer chunks[MAX_SCENE_CHUNKS];
+} ChunkedBuffer;
+
+// the scene data that is reached through buffer device addresses
+typedef struct sceneGeometry
+{
+	ChunkedBuffer vertices;
+	ChunkedBuffer triangles; // 3 indices per element
+	ChunkedBuffer nodes;
+} SceneGeometry;
+
 typedef struct bufferContainer
 {
 	uint32_t buffer_count;
@@ -56,16 +103,274 @@ typedef struct descriptorSet
 	uint32_t completed; // indicates that this container is fully operational
 } DescriptorSetContainer;
 
+#define TRACE_IDLE 0
+#define TRACE_RECORDING 1 // the trace buffer was reset, the next frame records into it
+#define TRACE_READING 2 // the copy into the staging buffer is in flight
+
+// readback of the query trace ring, polled every frame so the capture never waits on the gpu (QueryTrace.c)
+typedef struct queryTraceCapture
+{
+	uint32_t state;
+	VkBuffer staging; // host visible copy of the trace buffer
+	VkCommandBuffer reset_commands; // clears the ring before the captured frame
+	VkCommandBuffer copy_commands; // copies it to the staging buffer after the frame
+	VkFence fence; // signaled with the copy
+} QueryTraceCapture;
+
 typedef struct rayTracingDescriptor
 {
 	VkDescriptorSetLayout set_layout;
 	VkDescriptorSet descriptor_set;
 	uint32_t tlassBinding;
 	uint32_t traceBinding;
-	VkBuffer traceBuffer;
+	VkBuffer traceBuffer; // device local ring of QueryTrace records
 	VkDeviceMemory traceMemory;
+	QueryTraceCapture traceCapture;
 } RayTracingDescriptor;
 
+// passes of the deferred mode, each is its own pipeline specialized from visibility.comp
+#define DEFERRED_PASS_VISIBILITY 0
+#define DEFERRED_PASS_SHADING 1
+#define DEFERRED_PASS_REPROJECT 2 // scatters the primary hits of the previous frame, runs first
+#define DEFERRED_PASS_COUNT 3
+#define DEFERRED_QUERIES 3 // timestamps per swapchain image
+
+// the storage image the compute path traces into, it is blitted to the swapchain afterwards
+typedef struct computeTarget
+{
+	VkDescriptorSetLayout set_layout;
+	VkDescriptorSet descriptor_set;
+	uint32_t imageBinding;
+	uint32_t visibilityBinding;
+	uint32_t historyBinding;
+	uint32_t reprojectionBinding;
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+	VkExtent2D extent;
+	Buffer visibility; // primary hits of the deferred mode, one texel per pixel
+	Buffer history; // visibility of the last deferred frame, reprojected into the next one
+	Buffer reprojection; // per pixel the closest reprojected history texel
+
+	// timestamps of the deferred passes, start / after visibility / after shading per swapchain image
+	VkQueryPool query_pool;
+	float timestamp_period;
+	float visibility_ms;
+	float shading_ms;
+} ComputeTarget;
+
+// wavefront passes, each is its own compute pipeline specialized from wavefront.comp
+#define WAVEFRONT_PASS_GENERATE 0 // one primary ray per pixel
+#define WAVEFRONT_PASS_ARGS 1 // turns queue counts into indirect dispatch arguments
+#define WAVEFRONT_PASS_TRACE 2 // multi level traversal of the ray queue
+#define WAVEFRONT_PASS_SHADE 3 // shades the hits, emits shadow rays and the next bounce
+#define WAVEFRONT_PASS_SHADOW 4 // occlusion test of the shadow queue
+#define WAVEFRONT_PASS_RESOLVE 5 // accumulation -> output image
+#define WAVEFRONT_PASS_COUNT 6
+
+#define WAVEFRONT_MAX_BOUNCES 11 // recorded bounces, the rayMaxDepth slider goes up to 10
+#define WAVEFRONT_STAT_PASSES 3 // trace, shade and shadow report divergence
+
+typedef struct wavefront
+{
+	VkDescriptorSetLayout set_layout;
+	VkDescriptorPool descriptor_pool; // own pool, the set is rebuilt with the swapchain
+	VkDescriptorSet descriptor_set; // set 5
+	Buffer rays; // ping-pong ray queues, binned by ray type
+	Buffer hits;
+	Buffer shadow_rays;
+	Buffer counters; // queue counts and indirect dispatch arguments
+	Buffer accumulation;
+	Buffer stats; // one WavefrontStats per swapchain image, host visible
+	uint32_t capacity; // rays per queue bin, one per pixel
+
+	Shader shader;
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipelines[WAVEFRONT_PASS_COUNT];
+
+	VkQueryPool query_pool;
+	uint32_t queries_per_image;
+	float timestamp_period;
+
+	// last read back values, displayed in imgui
+	float pass_ms[WAVEFRONT_PASS_COUNT];
+	float efficiency[WAVEFRONT_STAT_PASSES];
+	uint32_t rays_per_pass[WAVEFRONT_STAT_PASSES];
+	uint32_t dropped;
+	uint32_t pruned;
+} Wavefront;
+
+// specialization constants of every ray tracing pipeline, member i is constant_id SHADER_VARIANT_FIRST_ID + i
+#define SHADER_VARIANT_FIRST_ID 4 // 0-3 are used by the entry points
+#define SHADER_VARIANT_CONSTANTS 4
+#define FULL_SUBGROUPS_CONSTANT_ID 9 // tiles.frag, compute only
+typedef struct shaderVariant
+{
+	VkBool32 opaque_check; // alpha test for triangle candidates
+	VkBool32 debug_displays; // follows the debug setting, off compiles the debug views out
+	uint32_t traversal_stack_size;
+	uint32_t max_ray_depth; // the MaxDepth setting is clamped to this
+} ShaderVariant;
+
+// a variant that is built on a worker thread while the current pipelines keep rendering (Pipelines.c)
+typedef struct pipelineBuild
+{
+	void* thread; // NULL if no build is running
+	volatile long done;
+	uint32_t with_wavefront; // the wavefront layout existed when the build started
+	ShaderVariant variant;
+	VkPipeline graphics;
+	VkPipeline compute;
+	VkPipeline deferred[DEFERRED_PASS_COUNT];
+	VkPipeline wavefront[WAVEFRONT_PASS_COUNT];
+} PipelineBuild;
+
+// gpu timestamps and per frame aggregates (Profiler.c)
+#define PROFILE_PASS_RAY 0 // the whole ray tracing command buffer, whatever the dispatch mode
+#define PROFILE_PASS_IMGUI 1
+#define PROFILE_PASS_COUNT 2
+#define PROFILER_QUERIES (PROFILE_PASS_COUNT * 2) // begin and end per pass and swapchain image
+#define PROFILER_MAX_IMAGES 8 // images past this are not profiled
+
+#define STATS_HISTOGRAM_BINS 16 // binning of the per pixel values is done in recordFrameStats
+#define STATS_LOD_LEVELS 8 // lods past this count to the last level
+#define PROFILER_HISTORY 128 // frames kept for the imgui plots
+
+// added up by every dispatch mode while collectStats is set, same as FrameStats in render.frag
+typedef struct frameStats
+{
+	uint32_t queries;
+	uint32_t traversals;
+	uint32_t max_traversal_depth;
+	uint32_t pixels;
+	uint32_t instance_hits; // aabb candidates pushed onto the traversal stack
+	uint32_t triangle_candidates;
+	uint32_t overflow_drops; // instance hits dropped because the traversal stack or the frames were full
+	uint32_t max_stack;
+	// per pixel histograms, deferred only counts the visibility ray and wavefront leaves them empty
+	uint32_t query_histogram[STATS_HISTOGRAM_BINS]; // one bin per query, the last one takes the rest
+	uint32_t instance_histogram[STATS_HISTOGRAM_BINS]; // log2 bins: 0, 1, 2-3, 4-7 ...
+	uint32_t candidate_histogram[STATS_HISTOGRAM_BINS]; // log2 bins
+	uint32_t stack_histogram[STATS_HISTOGRAM_BINS]; // high-water mark of the stack, one bin per 4 entries
+	uint32_t lod_histogram[STATS_LOD_LEVELS]; // every lod selection, not per pixel
+	uint32_t secondary_rays; // reflection and transmission rays that were traced
+	uint32_t pruned_rays; // and the ones that were saved by the contribution threshold
+	uint32_t evicted_rays; // rays that found the ray stack of the pixel (or the wavefront queue) full
+} FrameStats;
+
+typedef struct profiler
+{
+	VkQueryPool frame_pool; // PROFILER_QUERIES per swapchain image
+	VkQueryPool build_pool; // begin and end of one acceleration structure build
+	float timestamp_period;
+
+	// what was submitted with each image, the row is written once its fence has passed
+	VkBool32 submitted[PROFILER_MAX_IMAGES];
+	uint64_t submitted_frame[PROFILER_MAX_IMAGES];
+	double submitted_cpu_ms[PROFILER_MAX_IMAGES];
+	const char* submitted_scene[PROFILER_MAX_IMAGES];
+	uint64_t frame; // frames submitted since the capture started
+
+	// last read back values, displayed in imgui
+	float pass_ms[PROFILE_PASS_COUNT];
+	float build_ms; // all acceleration structure builds of the current scene
+	uint32_t builds;
+	FrameStats stats;
+	VkBool32 live_stats; // collect stats without a capture, set while the statistics are shown
+
+	// per pixel averages of the last PROFILER_HISTORY frames, ring buffers starting at history_offset
+	float history_queries[PROFILER_HISTORY];
+	float history_instances[PROFILER_HISTORY];
+	float history_candidates[PROFILER_HISTORY];
+	float history_drops[PROFILER_HISTORY]; // frame total
+	float history_pruned[PROFILER_HISTORY]; // frame total
+	uint32_t history_offset;
+
+	void* csv; // FILE*, open while a capture runs
+	char csv_name[128];
+} Profiler;
+
+// traversal cost per scene node, summed up over the measured frames of a benchmark (NodeProfile.c)
+#define NODE_PROFILE_STRIDE 4 // only every 4th pixel in both directions counts, keeps the counters from overflowing
+
+// same as NodeCost in QueryTraceRecord.frag, indexed by SceneNode.Index
+typedef struct nodeCost
+{
+	uint32_t queries; // ray queries on the node's acceleration structure
+	uint32_t candidates; // triangle candidates of these queries
+	uint32_t hits; // queries that ended with a confirmed triangle
+} NodeCost;
+
+typedef struct nodeProfile
+{
+	VkBuffer buffer; // NodeCost per scene node, device local
+	uint32_t node_count;
+	VkBool32 collecting; // sets collectNodeCosts in the frame data
+	uint32_t frames; // frames submitted while collecting
+} NodeProfile;
+
+// dynamic resolution of the compute and deferred paths (RenderScale.c)
+#define RENDER_SCALE_MAX_IMAGES 8 // images past this are always traced at full resolution
+#define RENDER_SCALE_STEP 0.0625f // the scale snaps to it, every change records a command buffer again
+#define RENDER_SCALE_SETTLE_FRAMES 4 // frames without camera movement until full resolution
+
+typedef struct renderScale
+{
+	VkBool32 enabled;
+	float target_ms; // budget of the ray pass
+	float min_scale;
+	float scale; // of width and height while the camera moves, 1 is the swapchain resolution
+	float ns_per_pixel; // ray pass time over the traced pixels, smoothed over the last measured frames
+	float camera[5]; // position and rotation of the last frame
+	uint32_t still_frames;
+	VkExtent2D recorded[RENDER_SCALE_MAX_IMAGES]; // what the command buffer of each image traces at
+} RenderScale;
+
+// reuse of the last traced frame (Temporal.c)
+typedef struct temporalCache
+{
+	VkBool32 enabled; // unchanged frames only blit the compute target again
+	VkBool32 reproject; // the deferred mode carries primary hits over to the next frame while the camera moves
+	VkBool32 valid; // the compute target and the history still hold traced
+	FrameData traced; // the last frame that was traced
+	VkCommandBuffer* present_buffers; // per swapchain image, the blit of the compute target without any tracing
+	VkBool32 reused[RENDER_SCALE_MAX_IMAGES]; // the image only presented the cached frame
+	uint32_t reused_frames; // in a row, displayed in imgui
+} TemporalCache;
+
+// camera path recording and the benchmark that replays it (CameraPath.c)
+#define BENCHMARK_IDLE 0
+#define BENCHMARK_RECORDING 1 // samples the camera at CAMERA_PATH_STEP
+#define BENCHMARK_WARMUP 2
+#define BENCHMARK_MEASURE 3
+
+typedef struct benchmark
+{
+	uint32_t state; // BENCHMARK_*
+	Camera* samples; // pose and render settings, one per fixed step
+	uint32_t sample_count;
+	uint32_t sample_capacity;
+	double next_sample; // recording time of the next step
+
+	uint32_t warmup_frames;
+	uint32_t measure_frames; // the path is repeated if it is shorter
+	const char* path_file; // NULL for camera.path
+	const char* csv_file; // NULL names the capture after the time
+	VkBool32 write_csv; // profiler capture of the measured frames
+	const char* node_profile_file; // NULL names it after the time
+	VkBool32 write_node_profile; // per node traversal cost of the measured frames
+	uint32_t frame; // in the current phase
+	double last_time;
+	double* frame_ms; // measure_frames
+	uint32_t restore_vsync;
+
+	// last run, displayed in imgui
+	float min_ms;
+	float avg_ms;
+	float p95_ms;
+	float p99_ms;
+} Benchmark;
+
 typedef struct shader
 {
 	VkShaderModule module;
@@ -111,7 +416,15 @@ typedef struct vkInfo {
 	const char** device_extension_names;
 
 	VkBool32 ray_tracing;
+	VkPhysicalDeviceSubgroupProperties subgroup; // size, stages and operations of the subgroup builtins
+	VkBool32 full_subgroups; // VK_EXT_subgroup_size_control, compute pipelines can require full subgroups
+	VkBool32 subgroup_arithmetic; // off loads the ray shaders built with NO_SUBGROUP_ARITHMETIC, see ray_shader_binary
+	VkBool32 subgroup_quad; // same with NO_SUBGROUP_QUAD, the ray rates then stay at full
 	VkBool32 rasterize;
+	VkBool32 unified_memory; // integrated gpu, the scene buffers stay host visible there
+	VkBool32 headless; // no window and no surface, the swapchain images are plain offscreen images
+	uint32_t device_index; // into physical_devices, a software implementation can be picked this way
+	GpuAllocator allocator;
 	// command pool
 	VkCommandPool command_pool;
 	VkCommandPool imgui_command_pool;
@@ -125,12 +438,24 @@ typedef struct vkInfo {
 	// shader objects
 	Shader vertex_shader;
 	Shader fragment_shader;
+	Shader compute_shader;
+	Shader deferred_shader;
 
 	uint32_t numSets; // 3-4
 	DescriptorSetContainer global_buffers; // set 0
+	SceneGeometry scene_geometry; // behind SCENE_POINTER_BINDING of set 0
 	TextureContainer texture_container; // set 1
 	DescriptorSetContainer per_frame_buffers; // set 2
+	FrameRing frame_ring; // mapped per_frame_buffers
+	uint32_t dirty_lights_begin; // lights edited in the ui, empty if begin == end
+	uint32_t dirty_lights_end;
 	RayTracingDescriptor ray_descriptor; // set 3
+	ComputeTarget compute_target; // set 4, compute only
+	Wavefront wavefront; // set 5, wavefront only
+	Profiler profiler;
+	NodeProfile node_profile; // set 3, ray tracing only
+	RenderScale render_scale; // compute and deferred only
+	TemporalCache temporal; // every mode that traces into the compute target
 
 	VkSampler skyboxSampler;
 	VkImage skyboxImage;
@@ -147,6 +472,9 @@ typedef struct vkInfo {
 	VkRenderPass imguiPass;
 	VkPipelineLayout pipeline_layout;
 	VkPipeline pipeline;
+	VkPipelineLayout compute_pipeline_layout;
+	VkPipeline compute_pipeline;
+	VkPipeline deferred_pipelines[DEFERRED_PASS_COUNT];
 	VkSemaphore* imageAvailableSemaphore;
 	VkSemaphore* renderFinishedSemaphore;
 	VkFence* inFlightFences;
@@ -157,7 +485,18 @@ typedef struct vkInfo {
 	uint32_t reloadButton;
 	uint32_t reload;
 	uint32_t vsync;
-	uint32_t opacity_check;
+	Benchmark benchmark;
+	uint32_t recompile; // runs glslangValidator before the shaders are loaded
+	ShaderVariant variant; // requested by the ui
+	ShaderVariant built_variant; // what the pipelines were created with
+	PipelineBuild pipeline_build;
+	VkPipelineCache pipeline_cache; // stored in pipeline.cache on exit
+	uint64_t pipeline_cache_hash; // of the shader binaries the cache was loaded for
+	uint32_t dispatch_mode; // RAY_DISPATCH_*
+	uint32_t recorded_dispatch_mode; // what the command buffers were recorded with
+	uint32_t workgroup_width;
+	uint32_t workgroup_height;
+	uint32_t tile_order; // TILE_ORDER_*
 } VkInfo;
 
 typedef void (*ChangeSceneCallback)(void);
@@ -169,4 +508,15 @@ typedef struct app {
 	SceneSelection sceneSelection;
 } App;
 
-#define MAX_FRAMES_IN_FLIGHT 2
\ No newline at end of file
+#define MAX_FRAMES_IN_FLIGHT 2
+
+// how the rays of a frame are dispatched
+#define RAY_DISPATCH_FRAGMENT 0 // fullscreen triangle, one fragment per pixel
+#define RAY_DISPATCH_COMPUTE 1 // compute shader in tiles, written to a storage image
+#define RAY_DISPATCH_WAVEFRONT 2 // separate compute passes connected by ray queues
+#define RAY_DISPATCH_DEFERRED 3 // visibility buffer for the primary hit, then a separate shading pass
+
+// order in which the tiles (workgroups) of the compute dispatch are walked
+#define TILE_ORDER_ROW 0
+#define TILE_ORDER_COLUMN 1
+#define TILE_ORDER_STRIPS 2
\ No newline at end of file
@@ -0,0 +1,223 @@
+﻿#include "Headless.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CameraPath.h"
+#include "Platform.h"
+#include "Presentation.h"
+#include "Profiler.h"
+#include "Util.h"
+#include "Vulkan.h"
+#include "VulkanUtil.h"
+
+static const char* dispatch_names[] = { "fragment", "compute", "wavefront", "deferred" };
+
+uint32_t parse_headless_options(int argc, char** argv, HeadlessOptions* options)
+{
+	HeadlessOptions defaults = {
+		.scene = "default",
+		.output = "headless",
+		.width = 1600,
+		.height = 900,
+		.warmup_frames = 60,
+		.measure_frames = 300,
+		.dispatch_mode = RAY_DISPATCH_FRAGMENT
+	};
+	*options = defaults;
+
+	uint32_t headless = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "--headless") == 0)
+		{
+			headless = 1;
+			continue;
+		}
+		if (i + 1 == argc)
+		{
+			printf("%s needs a value\n", arg);
+			break;
+		}
+		const char* value = argv[++i];
+		if (strcmp(arg, "--scene") == 0) options->scene = value;
+		else if (strcmp(arg, "--path") == 0) options->path = value;
+		else if (strcmp(arg, "--out") == 0) options->output = value;
+		else if (strcmp(arg, "--size") == 0) sscanf_s(value, "%ux%u", &options->width, &options->height);
+		else if (strcmp(arg, "--warmup") == 0) options->warmup_frames = (uint32_t)atoi(value);
+		else if (strcmp(arg, "--frames") == 0) options->measure_frames = (uint32_t)atoi(value);
+		else if (strcmp(arg, "--device") == 0) options->device_index = (uint32_t)atoi(value);
+		else if (strcmp(arg, "--dispatch") == 0)
+		{
+			for (uint32_t mode = 0; mode < sizeof(dispatch_names) / sizeof(dispatch_names[0]); mode++)
+				if (strcmp(value, dispatch_names[mode]) == 0)
+					options->dispatch_mode = mode;
+		}
+		else printf("unknown option %s\n", arg);
+	}
+	return headless;
+}
+
+// one offscreen image per frame in flight, so the fence of the frame is the fence of the image
+static uint32_t render_headless_frame(VkInfo* vk, Scene* scene, const char* scene_name, double* last_time)
+{
+	uint32_t image_index = (uint32_t)vk->currentFrame;
+	vkWaitForFences(vk->device, 1, &vk->inFlightFences[image_index], VK_TRUE, UINT64_MAX);
+	read_finished_frame(vk, image_index);
+
+	flush_light_edits(vk, scene);
+	set_frame_buffers(vk, scene, image_index);
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &vk->command_buffers[image_index]
+	};
+	vkResetFences(vk->device, 1, &vk->inFlightFences[image_index]);
+	check(vkQueueSubmit(vk->graphics_queue, 1, &submit_info, vk->inFlightFences[image_index]), "failed to submit frame");
+	vk->currentFrame = (image_index + 1) % MAX_FRAMES_IN_FLIGHT;
+
+	double now = get_time();
+	profile_submit(vk, image_index, now - *last_time, scene_name);
+	*last_time = now;
+	return image_index;
+}
+
+// the image is left as a color attachment by every dispatch mode, the device has to be idle
+static void save_offscreen_image(VkInfo* vk, uint32_t image_index, const char* file_name)
+{
+	Swapchain* swapchain = &vk->swapchain;
+	uint32_t width = swapchain->extent.width, height = swapchain->extent.height;
+	VkDeviceSize size = (VkDeviceSize)width * height * 4;
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	createBuffer(vk, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer, &memory);
+
+	VkCommandBuffer cb = beginSingleTimeCommands(vk);
+	VkImageMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = swapchain->images[image_index],
+		.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, NULL, 0, NULL, 1, &barrier);
+	VkBufferImageCopy region = {
+		.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+		.imageExtent = { width, height, 1 }
+	};
+	vkCmdCopyImageToBuffer(cb, swapchain->images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+	endSingleTimeCommands(vk, cb);
+
+	// binary ppm, the offscreen images are BGRA
+	const uint8_t* pixels = mapBuffer(vk, buffer);
+	FILE* file;
+	fopen_s(&file, file_name, "wb");
+	if (file)
+	{
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+		uint8_t* row = malloc((size_t)width * 3);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			const uint8_t* src = pixels + (size_t)y * width * 4;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				row[x * 3 + 0] = src[x * 4 + 2];
+				row[x * 3 + 1] = src[x * 4 + 1];
+				row[x * 3 + 2] = src[x * 4 + 0];
+			}
+			fwrite(row, 3, width, file);
+		}
+		free(row);
+		fclose(file);
+	}
+	else printf("could not write %s\n", file_name);
+	destroyBuffer(vk, buffer);
+}
+
+static void write_summary(VkInfo* vk, const HeadlessOptions* options, const char* file_name)
+{
+	Benchmark* b = &vk->benchmark;
+	FILE* file;
+	fopen_s(&file, file_name, "w");
+	if (!file)
+	{
+		printf("could not write %s\n", file_name);
+		return;
+	}
+	fprintf(file, "scene %s\n", options->scene);
+	fprintf(file, "path %s\n", options->path ? options->path : "scene camera");
+	fprintf(file, "dispatch %s\n", dispatch_names[vk->recorded_dispatch_mode]);
+	fprintf(file, "size %ux%u\n", options->width, options->height);
+	fprintf(file, "frames %u warmup %u\n", options->measure_frames, options->warmup_frames);
+	fprintf(file, "as_build_ms %.3f\n", vk->profiler.build_ms);
+	fprintf(file, "min_ms %.3f\navg_ms %.3f\np95_ms %.3f\np99_ms %.3f\n", b->min_ms, b->avg_ms, b->p95_ms, b->p99_ms);
+	fclose(file);
+}
+
+int run_headless(App* app, const HeadlessOptions* options)
+{
+	VkInfo* vk = &app->vk_info;
+	vk->headless = VK_TRUE;
+	vk->vsync = 0;
+	vk->device_index = options->device_index;
+	vk->dispatch_mode = options->dispatch_mode;
+	WINDOW_WIDTH = options->width;
+	WINDOW_HEIGHT = options->height;
+	if (options->width == 0 || options->height == 0 || options->measure_frames == 0)
+	{
+		printf("headless: size and frames have to be positive\n");
+		return 1;
+	}
+
+	load_scene(&app->scene, (char*)options->scene);
+	init_vulkan(vk, NULL, &app->scene);
+	vk->variant.debug_displays = app->scene.camera.settings.debug;
+	create_or_resize_swapchain(vk, NULL, options->width, options->height, &app->scene);
+	set_global_buffers(vk, &app->scene);
+	printSceneSizes(&app->scene);
+
+	char csv_name[260], image_name[260], summary_name[260], node_name[260];
+	sprintf_s(csv_name, sizeof(csv_name), "%s.csv", options->output);
+	sprintf_s(node_name, sizeof(node_name), "%s.nprof", options->output);
+	sprintf_s(image_name, sizeof(image_name), "%s.ppm", options->output);
+	sprintf_s(summary_name, sizeof(summary_name), "%s.txt", options->output);
+
+	Benchmark* b = &vk->benchmark;
+	b->warmup_frames = options->warmup_frames;
+	b->measure_frames = options->measure_frames;
+	b->path_file = options->path;
+	b->csv_file = csv_name;
+	b->write_csv = VK_TRUE;
+	b->node_profile_file = node_name;
+	b->write_node_profile = VK_TRUE;
+	Camera view = app->scene.camera;
+	start_benchmark(vk, options->path ? NULL : &view);
+
+	int result = 1;
+	if (b->state != BENCHMARK_IDLE)
+	{
+		uint32_t last_image = 0;
+		double last_time = get_time();
+		while (update_camera_path(vk, &app->scene.camera))
+			last_image = render_headless_frame(vk, &app->scene, options->scene, &last_time);
+		vkDeviceWaitIdle(vk->device);
+		save_offscreen_image(vk, last_image, image_name);
+		write_summary(vk, options, summary_name);
+		printf("headless: wrote %s, %s, %s and %s\n", image_name, csv_name, node_name, summary_name);
+		result = 0;
+	}
+
+	destroy_camera_path(vk);
+	destroy_vulkan(vk, &app->scene, &app->sceneSelection);
+	destroy_scene(&app->scene);
+	return result;
+}
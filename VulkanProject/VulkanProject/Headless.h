@@ -0,0 +1,22 @@
+﻿#pragma once
+#include "Globals.h"
+
+// renders without a window into offscreen images, replays a camera path (or holds the scene camera) through the
+// benchmark and writes <out>.ppm of the last frame, <out>.csv per frame and <out>.txt with the summary, then exits.
+// meant for batch runs over scene configurations, e.g. the SL/ML/LOD test scenes, also with software implementations
+typedef struct headlessOptions
+{
+	const char* scene; // name in ../Scenes without .vksc
+	const char* path; // camera path file, NULL renders the camera of the scene
+	const char* output; // prefix of the written files
+	uint32_t width;
+	uint32_t height;
+	uint32_t warmup_frames;
+	uint32_t measure_frames;
+	uint32_t dispatch_mode; // RAY_DISPATCH_*
+	uint32_t device_index;
+} HeadlessOptions;
+
+// returns 1 if --headless was given
+uint32_t parse_headless_options(int argc, char** argv, HeadlessOptions* options);
+int run_headless(App* app, const HeadlessOptions* options);
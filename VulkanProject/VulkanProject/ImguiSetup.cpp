@@ -5,17 +5,25 @@
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_vulkan.h>
 
+#ifdef _WIN32
 #include <windows.h>
 #include <tchar.h> 
-#include <stdio.h>
 #include <strsafe.h>
 #pragma comment(lib, "User32.lib")
+#else
+#include <dirent.h>
+#endif
+#include <stdio.h>
 
+#include <algorithm>
 #include <string>
 
 #include "Util.h"
 extern "C" {
 	#include "VulkanUtil.h"
+	#include "Profiler.h"
+	#include "CameraPath.h"
+	#include "RenderScale.h"
 }
 void check_result(VkResult res)
 {
@@ -183,11 +191,13 @@ void update_imgui_commandBuffer(VkInfo* vk, Scene* scene, SceneSelection* scene_
 	info.renderArea.extent = vk->swapchain.extent;
 	info.clearValueCount = 1;
 	info.pClearValues = &clearColor;
+	profile_pass_begin(vk, vk->imgui_command_buffers[index], index, PROFILE_PASS_IMGUI);
 	vkCmdBeginRenderPass(vk->imgui_command_buffers[index], &info, VK_SUBPASS_CONTENTS_INLINE);
 
 	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), vk->imgui_command_buffers[index]);
 
 	vkCmdEndRenderPass(vk->imgui_command_buffers[index]);
+	profile_pass_end(vk, vk->imgui_command_buffers[index], index, PROFILE_PASS_IMGUI);
 
 	check_result(vkEndCommandBuffer(vk->imgui_command_buffers[index]));
 }
@@ -215,7 +225,7 @@ void draw_imgui_frame(VkInfo* info, Scene* scene, SceneSelection* scene_selectio
 			average += values[n];
 		average /= (float)IM_ARRAYSIZE(values);
 		char overlay[32];
-		sprintf_s(overlay, "Framerate %.0f", average);
+		snprintf(overlay, sizeof(overlay), "Framerate %.0f", average);
 		ImGui::PlotLines("", values, IM_ARRAYSIZE(values), values_offset, overlay, 0, 200, ImVec2(0, 80));
 	}
 	ImGui::Text("POS:%.2f:%.2f:%.2f", scene->camera.pos[0], scene->camera.pos[1], scene->camera.pos[2]);
@@ -231,14 +241,216 @@ void draw_imgui_frame(VkInfo* info, Scene* scene, SceneSelection* scene_selectio
 	ImGui::Checkbox("Reflections", (bool*)&scene->camera.settings.reflection);
 	ImGui::Checkbox("Transmission", (bool*)&scene->camera.settings.transmission);
 	ImGui::SliderInt("MaxDepth", (int*) &scene->camera.settings.maxDepth, 0, 10);
+	// pixels at a reduced rate take the rays of their neighbour, fragment and compute dispatches only
+	const char* ray_rates[] = { "Full", "Checkerboard", "Adaptive" };
+	ImGui::Combo("Secondary rays", (int*)&scene->camera.settings.secondaryRate, ray_rates, IM_ARRAYSIZE(ray_rates));
+	ImGui::Combo("Shadow rays", (int*)&scene->camera.settings.shadowRate, ray_rates, IM_ARRAYSIZE(ray_rates));
+	if (scene->camera.settings.secondaryRate == RAY_RATE_ADAPTIVE || scene->camera.settings.shadowRate == RAY_RATE_ADAPTIVE) {
+		ImGui::SliderFloat("Rate normal cosine", &scene->camera.settings.rateNormal, 0.5f, 1.0f);
+		ImGui::SliderFloat("Rate depth ratio", &scene->camera.settings.rateDepth, 0.001f, 0.5f);
+	}
+	// rays that add less than this to their pixel are not traced
+	ImGui::SliderFloat("Min contribution", &scene->camera.settings.minContribution, 0.0f, 0.1f, "%.4f");
+	ImGui::Checkbox("Russian roulette", (bool*)&scene->camera.settings.russianRoulette);
+	// coarser lods for the rays that are not seen directly
+	ImGui::SliderInt("Shadow LOD bias", &scene->camera.settings.shadowLodBias, -2, 4);
+	ImGui::SliderInt("Secondary LOD bias", &scene->camera.settings.secondaryLodBias, -2, 4);
 
 	ImGui::Text("Rendersettings");
 	ImGui::Checkbox("Vsync (RELOAD)", (bool*)&info->vsync);
-	ImGui::Checkbox("OpacityCheck (RELOAD)", (bool*)&info->opacity_check);
+	// shader variant, switching only creates the pipelines again
+	ImGui::Checkbox("OpacityCheck", (bool*)&info->variant.opaque_check);
+	ImGui::SliderInt("Traversal stack", (int*)&info->variant.traversal_stack_size, 4, 64);
+	ImGui::SliderInt("Depth cap", (int*)&info->variant.max_ray_depth, 0, 10);
+	if (info->pipeline_build.thread)
+		ImGui::Text("Building pipelines...");
+	const char* dispatch_modes[] = { "Fragment", "Compute", "Wavefront", "Deferred" };
+	ImGui::BeginDisabled(!info->ray_tracing);
+	ImGui::Combo("Dispatch", (int*)&info->dispatch_mode, dispatch_modes, IM_ARRAYSIZE(dispatch_modes));
+	ImGui::EndDisabled();
+	ImGui::BeginDisabled(info->dispatch_mode != RAY_DISPATCH_COMPUTE && info->dispatch_mode != RAY_DISPATCH_DEFERRED);
+	ImGui::SliderInt("Workgroup X (RELOAD)", (int*)&info->workgroup_width, 1, 32);
+	ImGui::SliderInt("Workgroup Y (RELOAD)", (int*)&info->workgroup_height, 1, 32);
+	const char* tile_orders[] = { "Row major", "Column major", "Strips" };
+	ImGui::Combo("Tile order (RELOAD)", (int*)&info->tile_order, tile_orders, IM_ARRAYSIZE(tile_orders));
+	ImGui::Checkbox("Dynamic resolution", (bool*)&info->render_scale.enabled);
+	ImGui::SliderFloat("Ray pass budget (ms)", &info->render_scale.target_ms, 1.0f, 100.0f);
+	ImGui::SliderFloat("Min scale", &info->render_scale.min_scale, 0.25f, 1.0f);
+	if (info->render_scale.enabled) {
+		VkExtent2D traced = render_scale_extent(info);
+		ImGui::Text("Scale %.2f, traced at %ux%u", info->render_scale.scale, traced.width, traced.height);
+	}
+	ImGui::EndDisabled();
+	ImGui::BeginDisabled(info->dispatch_mode == RAY_DISPATCH_FRAGMENT);
+	ImGui::Checkbox("Reuse unchanged frames", (bool*)&info->temporal.enabled);
+	ImGui::EndDisabled();
+	ImGui::BeginDisabled(info->dispatch_mode != RAY_DISPATCH_DEFERRED);
+	ImGui::Checkbox("Reproject primary hits", (bool*)&info->temporal.reproject);
+	ImGui::EndDisabled();
+	if (info->temporal.reused_frames)
+		ImGui::Text("Presenting the cached frame (%u)", info->temporal.reused_frames);
+
+	if (info->dispatch_mode == RAY_DISPATCH_DEFERRED) {
+		ImGui::Text("Visibility %6.2fms", info->compute_target.visibility_ms);
+		ImGui::Text("Shading    %6.2fms", info->compute_target.shading_ms);
+	}
+	if (info->dispatch_mode == RAY_DISPATCH_WAVEFRONT && ImGui::CollapsingHeader("WAVEFRONT")) {
+		Wavefront* wf = &info->wavefront;
+		const char* pass_names[] = { "Generate", "Args", "Trace", "Shade", "Shadow", "Resolve" };
+		for (int pass = 0; pass < WAVEFRONT_PASS_COUNT; pass++) {
+			if (pass == WAVEFRONT_PASS_ARGS) continue; // counted to the pass it prepares
+			if (pass >= WAVEFRONT_PASS_TRACE && pass < WAVEFRONT_PASS_TRACE + WAVEFRONT_STAT_PASSES) {
+				int stat = pass - WAVEFRONT_PASS_TRACE;
+				ImGui::Text("%-8s %6.2fms %8u rays %5.1f%% SIMD", pass_names[pass], wf->pass_ms[pass],
+					wf->rays_per_pass[stat], wf->efficiency[stat] * 100.0f);
+			}
+			else {
+				ImGui::Text("%-8s %6.2fms", pass_names[pass], wf->pass_ms[pass]);
+			}
+		}
+		ImGui::Text("Dropped rays %u", wf->dropped);
+		ImGui::Text("Pruned rays %u", wf->pruned);
+	}
+
+	if (ImGui::CollapsingHeader("PROFILER")) {
+		Profiler* p = &info->profiler;
+		ImGui::Text("Ray pass   %6.2fms", p->pass_ms[PROFILE_PASS_RAY]);
+		ImGui::Text("ImGui pass %6.2fms", p->pass_ms[PROFILE_PASS_IMGUI]);
+		ImGui::Text("AS builds  %6.2fms (%u)", p->build_ms, p->builds);
+		if (!p->csv) {
+			if (ImGui::Button("Start capture"))
+				start_profile_capture(info, NULL);
+		}
+		else {
+			if (ImGui::Button("Stop capture"))
+				stop_profile_capture(info);
+			ImGui::SameLine();
+			ImGui::Text("%s", p->csv_name);
+			ImGui::Text("Queries %u Traversals %u MaxDepth %u", p->stats.queries, p->stats.traversals, p->stats.max_traversal_depth);
+		}
+	}
+
+	// the shaders only collect stats while this is open or a capture runs
+	info->profiler.live_stats = ImGui::CollapsingHeader("STATISTICS");
+	if (info->profiler.live_stats) {
+		Profiler* p = &info->profiler;
+		const FrameStats* s = &p->stats;
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "Queries/pixel %.2f", s->pixels ? (float)s->queries / (float)s->pixels : 0.0f);
+		ImGui::PlotLines("##queries", p->history_queries, PROFILER_HISTORY, p->history_offset, overlay, 0, FLT_MAX, ImVec2(0, 60));
+		snprintf(overlay, sizeof(overlay), "Instance hits/pixel %.2f", s->pixels ? (float)s->instance_hits / (float)s->pixels : 0.0f);
+		ImGui::PlotLines("##instances", p->history_instances, PROFILER_HISTORY, p->history_offset, overlay, 0, FLT_MAX, ImVec2(0, 60));
+		snprintf(overlay, sizeof(overlay), "Triangle candidates/pixel %.2f", s->pixels ? (float)s->triangle_candidates / (float)s->pixels : 0.0f);
+		ImGui::PlotLines("##candidates", p->history_candidates, PROFILER_HISTORY, p->history_offset, overlay, 0, FLT_MAX, ImVec2(0, 60));
+		snprintf(overlay, sizeof(overlay), "Overflow drops %u", s->overflow_drops);
+		ImGui::PlotLines("##drops", p->history_drops, PROFILER_HISTORY, p->history_offset, overlay, 0, FLT_MAX, ImVec2(0, 60));
+		ImGui::Text("Max traversal depth %u, max stack %u", s->max_traversal_depth, s->max_stack);
+		snprintf(overlay, sizeof(overlay), "Pruned rays %u", s->pruned_rays);
+		ImGui::PlotLines("##pruned", p->history_pruned, PROFILER_HISTORY, p->history_offset, overlay, 0, FLT_MAX, ImVec2(0, 60));
+		ImGui::Text("Secondary rays %u, evicted %u", s->secondary_rays, s->evicted_rays);
+
+		// histograms of the last frame, plotted as fractions of the pixels
+		struct { const char* label; const uint32_t* bins; int count; bool per_pixel; } histograms[] = {
+			{ "Queries", s->query_histogram, STATS_HISTOGRAM_BINS, true },
+			{ "Instance hits (log2)", s->instance_histogram, STATS_HISTOGRAM_BINS, true },
+			{ "Candidates (log2)", s->candidate_histogram, STATS_HISTOGRAM_BINS, true },
+			{ "Stack (x4)", s->stack_histogram, STATS_HISTOGRAM_BINS, true },
+			{ "LOD selections", s->lod_histogram, STATS_LOD_LEVELS, false },
+		};
+		bool per_pixel = pixel_histograms_recorded(info->recorded_dispatch_mode);
+		if (!per_pixel)
+			ImGui::Text("No per pixel histograms in this mode");
+		for (int h = 0; h < IM_ARRAYSIZE(histograms); h++) {
+			if (histograms[h].per_pixel && !per_pixel)
+				continue;
+			float values[STATS_HISTOGRAM_BINS];
+			float total = 0.0f;
+			for (int i = 0; i < histograms[h].count; i++)
+				total += (float)histograms[h].bins[i];
+			for (int i = 0; i < histograms[h].count; i++)
+				values[i] = total > 0.0f ? (float)histograms[h].bins[i] / total : 0.0f;
+			ImGui::PlotHistogram(histograms[h].label, values, histograms[h].count, 0, NULL, 0, 1, ImVec2(0, 50));
+		}
+	}
+
+	if (ImGui::CollapsingHeader("BENCHMARK")) {
+		Benchmark* b = &info->benchmark;
+		bool idle = b->state == BENCHMARK_IDLE;
+		if (b->state == BENCHMARK_RECORDING) {
+			if (ImGui::Button("Stop recording"))
+				stop_path_recording(info);
+			ImGui::SameLine();
+			ImGui::Text("%u samples", b->sample_count);
+		}
+		else {
+			ImGui::BeginDisabled(!idle);
+			if (ImGui::Button("Record path"))
+				start_path_recording(info, &scene->camera);
+			ImGui::EndDisabled();
+		}
+		ImGui::BeginDisabled(!idle);
+		ImGui::InputScalar("Warm-up frames", ImGuiDataType_U32, &b->warmup_frames);
+		ImGui::InputScalar("Measured frames", ImGuiDataType_U32, &b->measure_frames);
+		ImGui::Checkbox("Write CSV", (bool*)&b->write_csv);
+		ImGui::Checkbox("Write node profile", (bool*)&b->write_node_profile);
+		ImGui::EndDisabled();
+		if (b->state == BENCHMARK_WARMUP || b->state == BENCHMARK_MEASURE) {
+			if (ImGui::Button("Stop benchmark"))
+				stop_benchmark(info);
+			ImGui::SameLine();
+			ImGui::Text("%s %u", b->state == BENCHMARK_WARMUP ? "Warm-up" : "Measuring", b->frame);
+		}
+		else {
+			ImGui::BeginDisabled(!idle);
+			if (ImGui::Button("Replay path"))
+				start_benchmark(info, NULL);
+			ImGui::EndDisabled();
+		}
+		ImGui::Text("min %.2f avg %.2f p95 %.2f p99 %.2fms", b->min_ms, b->avg_ms, b->p95_ms, b->p99_ms);
+	}
+
+	if (ImGui::CollapsingHeader("LIGHTS")) {
+		// shadow rays per shading point, picked from the light tree. 0 traces every light
+		ImGui::SliderInt("Light samples", (int*)&scene->camera.settings.lightSamples, 0, 16);
+		for (uint32_t i = 0; i < scene->scene_data.numLights; i++) {
+			Light* light = &scene->lights[i];
+			bool on = (light->type & LIGHT_ON) != 0;
+			ImGui::PushID(i);
+			if (ImGui::Checkbox(light->type & LIGHT_TYPE_SUN ? "Sun" : light->type & LIGHT_TYPE_DIRECTIONAL_LIGHT ? "Directional" : "Point", &on)) {
+				light->type ^= LIGHT_ON;
+				// grow the range that is uploaded with the next frame
+				if (info->dirty_lights_begin == info->dirty_lights_end) {
+					info->dirty_lights_begin = i;
+					info->dirty_lights_end = i + 1;
+				}
+				else {
+					// in parentheses so the min/max macros of windows.h do not expand
+					info->dirty_lights_begin = (std::min)(info->dirty_lights_begin, i);
+					info->dirty_lights_end = (std::max)(info->dirty_lights_end, i + 1);
+				}
+			}
+			ImGui::SameLine();
+			ImGui::Text("%u %.1f:%.1f:%.1f", i, light->position[0], light->position[1], light->position[2]);
+			ImGui::PopID();
+		}
+	}
+
+	if (ImGui::CollapsingHeader("MEMORY")) {
+		AllocatorStats* mem = &info->allocator.stats;
+		float mb = 1.0f / 1048576.0f;
+		// unused bytes in the pool and linear blocks, slot rounding and free slots
+		float fragmentation = mem->reserved_bytes ? 1.0f - (float)mem->used_bytes / (float)mem->reserved_bytes : 0.0f;
+		ImGui::Text("Allocations %u in %u device allocations", mem->live_allocations, mem->device_allocations);
+		ImGui::Text("Pools %.1f / %.1fmb used", mem->used_bytes * mb, mem->reserved_bytes * mb);
+		ImGui::Text("Dedicated %.1fmb", mem->dedicated_bytes * mb);
+		ImGui::Text("Fragmentation %.1f%%", fragmentation * 100.0f);
+		ImGui::Text("FrameData written %u / %u bytes", info->frame_ring.dirty_bytes, (uint32_t)sizeof(FrameData));
+	}
 
 	bool reload = ImGui::Button("Reload shader");
 	if (info->reloadButton == 0 && reload == 1) {
 		info->reload = 1;
+		info->recompile = 1;
 		printf("Reload\n");
 	}
 	info->reloadButton = reload;
@@ -275,6 +487,25 @@ void draw_imgui_frame(VkInfo* info, Scene* scene, SceneSelection* scene_selectio
 		ImGui::Unindent(10);
 		ImGui::EndDisabled();
 		ImGui::EndDisabled();
+
+		// R + click records the region at the mouse. recording does not need the debug views
+		RenderSettings* settings = &scene->camera.settings;
+		ImGui::InputScalar("Trace X", ImGuiDataType_U32, &settings->pixelX);
+		ImGui::InputScalar("Trace Y", ImGuiDataType_U32, &settings->pixelY);
+		ImGui::InputScalar("Trace width", ImGuiDataType_U32, &settings->traceWidth);
+		ImGui::InputScalar("Trace height", ImGuiDataType_U32, &settings->traceHeight);
+		ImGui::InputScalar("Trace stride", ImGuiDataType_U32, &settings->traceStride);
+		if (settings->traceStride < 1) settings->traceStride = 1;
+		if (ImGui::Button("Trace region"))
+			settings->recordQueryTrace = 1;
+		ImGui::SameLine();
+		if (ImGui::Button("Trace frame")) {
+			settings->pixelX = 0;
+			settings->pixelY = 0;
+			settings->traceWidth = info->swapchain.extent.width;
+			settings->traceHeight = info->swapchain.extent.height;
+			settings->recordQueryTrace = 1;
+		}
 	}
 
 	if (ImGui::CollapsingHeader("VIEWPOS")) {
@@ -294,17 +525,32 @@ bool hasEnding(std::string const& fullString, std::string const& ending) {
 		return false;
 	}
 }
+// keeps a .vksc file as a scene, names has room for 32
+static void add_scene(const std::string& fileName, char** names, int* numScenes, int* defaultSceneIndex)
+{
+	const std::string fileEnding(".vksc");
+	const std::string defaultFile("default.vksc");
+	if (!hasEnding(fileName, fileEnding) || *numScenes == 32)
+		return;
+	if (fileName == defaultFile)
+		*defaultSceneIndex = *numScenes;
+	std::string name = fileName.substr(0, fileName.length() - fileEnding.length());
+	char* buffer = (char*)malloc(name.length() + 1);
+	memcpy(buffer, name.c_str(), name.length() + 1);
+	names[*numScenes] = buffer;
+	(*numScenes)++;
+}
+
+#ifdef _WIN32
 // https://docs.microsoft.com/en-us/windows/win32/fileio/listing-the-files-in-a-directory
 void get_available_scenes(SceneSelection* scene_selection)
 {
 	TCHAR text[] =  TEXT("../Scenes");
 
 	WIN32_FIND_DATA ffd;
-	LARGE_INTEGER filesize;
 	TCHAR szDir[MAX_PATH];
 	size_t length_of_arg;
 	HANDLE hFind = INVALID_HANDLE_VALUE;
-	DWORD dwError = 0;
 	
 	// Check that the input path plus 3 is not longer than MAX_PATH.
 	// Three characters are for the "\*" plus NULL appended below.
@@ -335,11 +581,6 @@ void get_available_scenes(SceneSelection* scene_selection)
 		return;
 	}
 
-	// List all the files in the directory with some info about them.
-	const std::string fileEnding(".vksc");
-	const int extensionOffset = 6;
-
-	const std::string defaultFile("default.vksc");
 	int defaultSceneIndex = -1;
 
 	char** names = static_cast<char**>(malloc(sizeof(char*) * 32));
@@ -354,30 +595,18 @@ void get_available_scenes(SceneSelection* scene_selection)
 		{
 #define BUFFER_SIZE 100
 			size_t i;
-			char* pMBBuffer = (char*)malloc(BUFFER_SIZE);
+			char pMBBuffer[BUFFER_SIZE];
 			const wchar_t* pWCBuffer = ffd.cFileName;
 
 			wcstombs_s(&i, pMBBuffer, (size_t)BUFFER_SIZE,
 				pWCBuffer, (size_t)BUFFER_SIZE - 1);
 
-			std::string stringName(pMBBuffer);
-			if(!hasEnding(stringName, ".vksc"))
-			{
-				free(pMBBuffer);
-				continue;
-			}
-
-			if(stringName == defaultFile)
-			{
-				defaultSceneIndex = numScenes;
-			}
-
-			pMBBuffer[i - extensionOffset] = '\0';
-			names[numScenes] = pMBBuffer;
-			numScenes++;
+			add_scene(std::string(pMBBuffer), names, &numScenes, &defaultSceneIndex);
 		}
 	} while (FindNextFile(hFind, &ffd) != 0);
 
+	FindClose(hFind);
+
 	printf("Available Scenes:\n");
 	for(int i = 0;i<numScenes;i++)
 	{
@@ -385,13 +614,43 @@ void get_available_scenes(SceneSelection* scene_selection)
 		printf("\n");
 	}
 
-	FindClose(hFind);
+	scene_selection->availableScenes = names;
+	scene_selection->numScenes = numScenes;
+	scene_selection->nextScene = defaultSceneIndex;
+	scene_selection->currentScene = defaultSceneIndex;
+}
+#else
+// same as above with dirent
+void get_available_scenes(SceneSelection* scene_selection)
+{
+	DIR* dir = opendir("../Scenes");
+	if (!dir)
+	{
+		printf("\nCan not open ../Scenes\n\n");
+		return;
+	}
+
+	int defaultSceneIndex = -1;
+	char** names = static_cast<char**>(malloc(sizeof(char*) * 32));
+	int numScenes = 0;
+	for (struct dirent* entry = readdir(dir); entry; entry = readdir(dir))
+	{
+		if (entry->d_type == DT_DIR)
+			continue;
+		add_scene(std::string(entry->d_name), names, &numScenes, &defaultSceneIndex);
+	}
+	closedir(dir);
+
+	printf("Available Scenes:\n");
+	for (int i = 0; i < numScenes; i++)
+		printf("%s\n", names[i]);
 
 	scene_selection->availableScenes = names;
 	scene_selection->numScenes = numScenes;
 	scene_selection->nextScene = defaultSceneIndex;
 	scene_selection->currentScene = defaultSceneIndex;
 }
+#endif
 
 void resize_callback_imgui(VkInfo* vk, Scene* scene, SceneSelection* scene_selection)
 {
@@ -0,0 +1,143 @@
+﻿#include "LightTree.h"
+
+#include <float.h>
+#include <stdlib.h>
+
+#include "Platform.h"
+
+#define LIGHT_POWER(light) (0.2126f * (light)->intensity[0] + 0.7152f * (light)->intensity[1] + 0.0722f * (light)->intensity[2])
+
+static int is_sun(const Light* light)
+{
+	return (light->type & LIGHT_TYPE_SUN) != 0;
+}
+
+// qsort_s context, sorts light indices along an axis of their positions
+typedef struct lightSort
+{
+	const Light* lights;
+	int axis;
+} LightSort;
+
+static int compare_lights(void* context, const void* a, const void* b)
+{
+	LightSort* sort = (LightSort*)context;
+	float pa = sort->lights[*(const uint32_t*)a].position[sort->axis];
+	float pb = sort->lights[*(const uint32_t*)b].position[sort->axis];
+	return (pa > pb) - (pa < pb);
+}
+
+static int compare_types(void* context, const void* a, const void* b)
+{
+	const Light* lights = (const Light*)context;
+	return is_sun(&lights[*(const uint32_t*)b]) - is_sun(&lights[*(const uint32_t*)a]);
+}
+
+// fills the node at index for the lights in indices, its children are taken from next
+static void build_node(Scene* scene, uint32_t index, uint32_t* indices, uint32_t count, uint32_t* next)
+{
+	LightNode* node = &scene->light_nodes[index];
+	if (count == 1)
+	{
+		node->child = -1 - (int32_t)indices[0];
+		return;
+	}
+
+	// suns are split off first, their importance does not depend on the distance
+	uint32_t suns = 0;
+	for (uint32_t i = 0; i < count; i++)
+		suns += is_sun(&scene->lights[indices[i]]);
+	uint32_t split;
+	if (suns > 0 && suns < count)
+	{
+		qsort_s(indices, count, sizeof(uint32_t), compare_types, scene->lights);
+		split = suns;
+	}
+	else
+	{
+		// median along the longest axis of the positions
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const float* p = scene->lights[indices[i]].position;
+			for (int a = 0; a < 3; a++)
+			{
+				lo[a] = p[a] < lo[a] ? p[a] : lo[a];
+				hi[a] = p[a] > hi[a] ? p[a] : hi[a];
+			}
+		}
+		LightSort sort = { scene->lights, 0 };
+		for (int a = 1; a < 3; a++)
+			if (hi[a] - lo[a] > hi[sort.axis] - lo[sort.axis]) sort.axis = a;
+		qsort_s(indices, count, sizeof(uint32_t), compare_lights, &sort);
+		split = count / 2;
+	}
+
+	uint32_t child = *next;
+	*next += 2;
+	node->child = (int32_t)child;
+	build_node(scene, child, indices, split, next);
+	build_node(scene, child + 1, indices + split, count - split, next);
+}
+
+void build_light_tree(Scene* scene)
+{
+	uint32_t count = scene->scene_data.numLights;
+	scene->scene_data.numLightNodes = count > 0 ? 2 * count - 1 : 0;
+	scene->light_nodes = calloc(scene->scene_data.numLightNodes > 0 ? scene->scene_data.numLightNodes : 1, sizeof(LightNode));
+	if (count == 0) return;
+
+	uint32_t* indices = malloc(sizeof(uint32_t) * count);
+	for (uint32_t i = 0; i < count; i++)
+		indices[i] = i;
+	uint32_t next = 1;
+	build_node(scene, 0, indices, count, &next);
+	free(indices);
+	refit_light_tree(scene);
+}
+
+void refit_light_tree(Scene* scene)
+{
+	scene->scene_data.numEnabledLights = 0;
+	for (uint32_t i = scene->scene_data.numLightNodes; i-- > 0;)
+	{
+		LightNode* node = &scene->light_nodes[i];
+		if (node->child < 0)
+		{
+			const Light* light = &scene->lights[-1 - node->child];
+			for (int a = 0; a < 3; a++)
+			{
+				node->aabb_min[a] = light->position[a];
+				node->aabb_max[a] = light->position[a];
+				node->power[a] = 0;
+			}
+			node->max_dst = light->maxDst;
+			// same as lightContribution, the falloff only applies to point lights and other types add nothing
+			if ((light->type & LIGHT_ON) == 0)
+				continue;
+			scene->scene_data.numEnabledLights++;
+			if (is_sun(light))
+			{
+				node->power[0] = LIGHT_POWER(light);
+				node->max_dst = FLT_MAX;
+			}
+			else if (light->type & LIGHT_TYPE_POINT_LIGHT)
+			{
+				for (int a = 0; a < 3; a++)
+					node->power[a] = LIGHT_POWER(light) * light->quadratic[a];
+			}
+			continue;
+		}
+
+		const LightNode* left = &scene->light_nodes[node->child];
+		const LightNode* right = &scene->light_nodes[node->child + 1];
+		for (int a = 0; a < 3; a++)
+		{
+			node->aabb_min[a] = left->aabb_min[a] < right->aabb_min[a] ? left->aabb_min[a] : right->aabb_min[a];
+			node->aabb_max[a] = left->aabb_max[a] > right->aabb_max[a] ? left->aabb_max[a] : right->aabb_max[a];
+			node->power[a] = left->power[a] + right->power[a];
+		}
+		node->max_dst = left->max_dst > right->max_dst ? left->max_dst : right->max_dst;
+	}
+}
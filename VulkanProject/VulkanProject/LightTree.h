@@ -0,0 +1,8 @@
+﻿#pragma once
+#include "Scene.h"
+
+// bounding volume hierarchy over the lights of a scene, the shaders walk it to pick the lights they trace shadow rays to.
+// every inner node has its two children next to each other and after itself, so a refit runs from the back to the front
+void build_light_tree(Scene* scene); // on load, sets scene_data.numLightNodes
+// after lights were switched on or off, only the powers and bounds change
+void refit_light_tree(Scene* scene);
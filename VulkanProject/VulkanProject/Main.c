@@ -3,22 +3,32 @@
 
 #include <stdio.h>
 #define GLFW_INCLUDE_VULKAN
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif
 #include <GLFW/glfw3.h>
+#ifdef _WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
+#endif
 
-#include <corecrt_math_defines.h>
+#define _USE_MATH_DEFINES
 #include <math.h>
 #include <string.h>
 
 #include "Vulkan.h"
+#include "Allocator.h"
+#include "CameraPath.h"
+#include "Headless.h"
 #include "Window.h"
 #include "Globals.h"
 #include "Util.h"
+#include "Pipelines.h"
+#include "Platform.h"
 #include "Presentation.h"
-#include "Raytrace.h"
+#include "QueryTrace.h"
 #include "ImguiSetup.h"
 #include "Shader.h"
+#include "VulkanStructs.h"
 
 int resizeW = -1;
 int resizeH = -1;
@@ -146,6 +156,8 @@ void changeScene(App* app)
 
     destroy_shaders(&app->vk_info, &app->scene);
     destroy_scene(&app->scene);
+    // nothing of the old scene is alive anymore, give the empty blocks back before the new one is loaded
+    defragment_allocator(&app->vk_info);
     load_scene(&app->scene, app->sceneSelection.availableScenes[app->sceneSelection.nextScene]);
 
     destroy_imgui_buffers(&app->vk_info);
@@ -158,26 +170,46 @@ void changeScene(App* app)
     app->sceneSelection.currentScene = app->sceneSelection.nextScene;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     App app = {0};
 
-    // lists all scenes and sets the selected scene to default.vksc
-    get_available_scenes(&app.sceneSelection);
-    if (app.sceneSelection.numScenes == 0) {
-        error("no scenes found. Please make sure that are scenes in ../Scenes/ with the .vksc extension");
-    }
-
     App* appPtr = &app;
     globalApplication = appPtr;
     setExceptionCallback(exception_callback_impl);
     app.vk_info.rasterize = VK_TRUE;
     app.vk_info.vsync = 1;
-    app.vk_info.opacity_check = 1;
+    app.vk_info.benchmark.warmup_frames = 120;
+    app.vk_info.benchmark.measure_frames = 1000;
+    app.vk_info.variant.opaque_check = VK_TRUE;
+    app.vk_info.variant.traversal_stack_size = 30;
+    app.vk_info.variant.max_ray_depth = 10;
+    app.vk_info.dispatch_mode = RAY_DISPATCH_FRAGMENT;
+    app.vk_info.workgroup_width = 8;
+    app.vk_info.workgroup_height = 8;
+    app.vk_info.tile_order = TILE_ORDER_ROW;
+    app.vk_info.render_scale.target_ms = 16.0f;
+    app.vk_info.render_scale.min_scale = 0.25f;
+    app.vk_info.render_scale.scale = 1.0f;
+
+    // batch runs render without a window and exit
+    HeadlessOptions headless_options;
+    if (parse_headless_options(argc, argv, &headless_options))
+        return run_headless(&app, &headless_options);
+    // only the window reuses frames, batch runs always trace
+    app.vk_info.temporal.enabled = VK_TRUE;
+    app.vk_info.temporal.reproject = VK_TRUE;
+
+    // lists all scenes and sets the selected scene to default.vksc
+    get_available_scenes(&app.sceneSelection);
+    if (app.sceneSelection.numScenes == 0) {
+        error("no scenes found. Please make sure that are scenes in ../Scenes/ with the .vksc extension");
+    }
     // loads the default scene
     load_scene(&app.scene, app.sceneSelection.availableScenes[app.sceneSelection.nextScene]);
     init_window(&app.window);
     init_vulkan(&app.vk_info, &app.window, &app.scene);
+    app.vk_info.variant.debug_displays = app.scene.camera.settings.debug;
 
 	glfwSetFramebufferSizeCallback(app.window, resize_callback);
 	glfwSetCursorPosCallback(app.window, mouse_move_callback);
@@ -197,7 +229,10 @@ int main()
         // draws the frame if the window is not minimized
 		if(WINDOW_WIDTH > 0 && WINDOW_HEIGHT > 0)
             {
-                updatePosition(app.window, &app.scene.camera);
+                // a replayed camera path ignores the input
+                if (!update_camera_path(&app.vk_info, &app.scene.camera))
+                    updatePosition(app.window, &app.scene.camera);
+                begin_query_trace(&app.vk_info, &app.scene);
                 drawFrame(&app.vk_info, &app.scene, &app.sceneSelection);
                 compile_query_trace(&app.vk_info, &app.scene);
             }
@@ -211,7 +246,11 @@ int main()
 
             vkDeviceWaitIdle(app.vk_info.device);
 			destroy_imgui_buffers(&app.vk_info);
-			create_or_resize_swapchain(&app.vk_info, &app.window, resizeW, resizeH, &app.scene);
+            // a reload rebuilds everything, a plain resize only the swapchain images
+            if (app.vk_info.reload)
+                create_or_resize_swapchain(&app.vk_info, &app.window, resizeW, resizeH, &app.scene);
+            else
+                resize_swapchain(&app.vk_info, &app.window, resizeW, resizeH, &app.scene);
             if (resizeW != 0 && resizeH != 0) {
                 resize_callback_imgui(&app.vk_info, &app.scene, &app.sceneSelection);
             }
@@ -223,10 +262,24 @@ int main()
             resizeH = -1;
             app.vk_info.reload = 0;
 		}
+        // the dispatch mode can be switched without a reload, unless the wavefront queues have to be created first
+        if (app.vk_info.dispatch_mode != app.vk_info.recorded_dispatch_mode && app.vk_info.command_buffers) {
+            if (app.vk_info.dispatch_mode == RAY_DISPATCH_WAVEFRONT && !app.vk_info.wavefront.pipeline_layout)
+                app.vk_info.reload = 1;
+            else
+                rerecord_command_buffers(&app.vk_info);
+        }
+        // shader toggles only switch the pipeline variant, it is built in the background while the old one renders
+        app.vk_info.variant.debug_displays = app.scene.camera.settings.debug;
+        if (app.vk_info.command_buffers && !app.vk_info.reload &&
+            memcmp(&app.vk_info.variant, &app.vk_info.built_variant, sizeof(ShaderVariant)) != 0)
+            start_variant_build(&app.vk_info);
+        finish_variant_build(&app.vk_info);
         // changes the scene if requested
         if (app.sceneSelection.currentScene != app.sceneSelection.nextScene)
             changeScene(&app);
 	}
+	destroy_camera_path(&app.vk_info);
 	destroy_vulkan(&app.vk_info, &app.scene, &app.sceneSelection);
 	destroy_scene(&app.scene);
 	destroy_window(app.window);
@@ -0,0 +1,90 @@
+﻿#include "NodeProfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Platform.h"
+#include "VulkanUtil.h"
+
+static void clear_node_costs(VkInfo* vk)
+{
+	VkCommandBuffer cb = beginSingleTimeCommands(vk);
+	vkCmdFillBuffer(cb, vk->node_profile.buffer, 0, VK_WHOLE_SIZE, 0);
+	endSingleTimeCommands(vk, cb);
+}
+
+void create_node_profile(VkInfo* vk, Scene* scene)
+{
+	NodeProfile* p = &vk->node_profile;
+	VkDeviceMemory memory;
+	p->node_count = scene->scene_data.numSceneNodes;
+	createBuffer(vk, sizeof(NodeCost) * (VkDeviceSize)max(p->node_count, 1),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &p->buffer, &memory);
+	clear_node_costs(vk);
+}
+
+void destroy_node_profile(VkInfo* vk)
+{
+	destroyBuffer(vk, vk->node_profile.buffer);
+	memset(&vk->node_profile, 0, sizeof(NodeProfile));
+}
+
+void start_node_profile(VkInfo* vk)
+{
+	NodeProfile* p = &vk->node_profile;
+	if (!p->buffer) return;
+	// frames still in flight did not collect, clearing under them is fine
+	clear_node_costs(vk);
+	p->frames = 0;
+	p->collecting = VK_TRUE;
+}
+
+void cancel_node_profile(VkInfo* vk)
+{
+	vk->node_profile.collecting = VK_FALSE;
+}
+
+void stop_node_profile(VkInfo* vk, const char* file_name)
+{
+	NodeProfile* p = &vk->node_profile;
+	if (!p->collecting) return;
+	p->collecting = VK_FALSE;
+
+	// happens once at the end of a benchmark, so a plain copy that waits for the queue is good enough
+	VkDeviceSize size = sizeof(NodeCost) * (VkDeviceSize)p->node_count;
+	VkBuffer staging;
+	VkDeviceMemory staging_memory;
+	createBuffer(vk, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging, &staging_memory);
+	check(vkQueueWaitIdle(vk->graphics_queue), "");
+	copyBuffer(vk, p->buffer, staging, size);
+
+	char name[128];
+	if (file_name)
+		strcpy_s(name, sizeof(name), file_name);
+	else
+		sprintf_s(name, sizeof(name), "nodes_%lld.nprof", (long long)time(NULL));
+	NodeProfileHeader header = {
+		.magic = NODE_PROFILE_MAGIC,
+		.version = NODE_PROFILE_VERSION,
+		.node_count = p->node_count,
+		.frames = p->frames,
+		.width = vk->swapchain.extent.width,
+		.height = vk->swapchain.extent.height,
+		.stride = NODE_PROFILE_STRIDE
+	};
+	FILE* file;
+	if (fopen_s(&file, name, "wb") != 0) {
+		printf("could not open %s\n", name);
+	}
+	else {
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(mapBuffer(vk, staging), sizeof(NodeCost), p->node_count, file);
+		fclose(file);
+		printf("node profile of %u frames written to %s\n", p->frames, name);
+	}
+	destroyBuffer(vk, staging);
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+#include "Globals.h"
+
+// counts queries, triangle candidates and confirmed hits per scene node while a benchmark measures. the dump is read
+// by the SceneCompiler to see which nodes the traversal spends its time in
+#define NODE_PROFILE_MAGIC 0x4652504E // "NPRF"
+#define NODE_PROFILE_VERSION 1
+
+// file: NodeProfileHeader followed by node_count NodeCosts
+typedef struct nodeProfileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t node_count;
+	uint32_t frames;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride; // NODE_PROFILE_STRIDE, the counts are from every stride-th pixel in both directions
+	uint32_t padding;
+} NodeProfileHeader;
+
+void create_node_profile(VkInfo* vk, Scene* scene);
+void destroy_node_profile(VkInfo* vk);
+
+void start_node_profile(VkInfo* vk); // clears the counters
+void stop_node_profile(VkInfo* vk, const char* file_name); // waits for the gpu, NULL names it after the time
+void cancel_node_profile(VkInfo* vk);
@@ -0,0 +1,176 @@
+﻿#include "Pipelines.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Compute.h"
+#include "Platform.h"
+#include "Shader.h"
+#include "Util.h"
+#include "VulkanStructs.h"
+#include "Wavefront.h"
+
+#define PIPELINE_CACHE_FILE "pipeline.cache"
+#define PIPELINE_CACHE_MAGIC 0x48435056
+
+// the driver checks its own header as well, but a cache of old shaders would only grow
+typedef struct pipelineCacheKey
+{
+	uint32_t magic;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint32_t driver_version;
+	uint8_t uuid[VK_UUID_SIZE];
+	uint64_t shader_hash;
+} PipelineCacheKey;
+
+static void get_cache_key(VkInfo* vk, uint64_t shader_hash, PipelineCacheKey* key)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	memset(key, 0, sizeof(PipelineCacheKey));
+	key->magic = PIPELINE_CACHE_MAGIC;
+	key->vendor_id = properties.vendorID;
+	key->device_id = properties.deviceID;
+	key->driver_version = properties.driverVersion;
+	memcpy(key->uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	key->shader_hash = shader_hash;
+}
+
+void init_pipeline_cache(VkInfo* vk)
+{
+	PipelineCacheKey key, stored;
+	vk->pipeline_cache_hash = hash_shader_binaries();
+	get_cache_key(vk, vk->pipeline_cache_hash, &key);
+
+	// a missing or foreign file is not an error, the cache just starts empty
+	void* data = NULL;
+	size_t size = 0;
+	FILE* file;
+	fopen_s(&file, PIPELINE_CACHE_FILE, "rb");
+	if (file)
+	{
+		if (fread(&stored, sizeof(stored), 1, file) == 1 && memcmp(&stored, &key, sizeof(key)) == 0)
+		{
+			long start = ftell(file);
+			fseek(file, 0, SEEK_END);
+			size = ftell(file) - start;
+			fseek(file, start, SEEK_SET);
+			data = malloc(size);
+			size = fread(data, 1, size, file);
+		}
+		fclose(file);
+	}
+	printf("pipeline cache: %zu bytes loaded\n", size);
+
+	VkPipelineCacheCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = size,
+		.pInitialData = data
+	};
+	check(vkCreatePipelineCache(vk->device, &create_info, NULL, &vk->pipeline_cache), "failed to create pipeline cache");
+	free(data);
+}
+
+void destroy_pipeline_cache(VkInfo* vk)
+{
+	if (!vk->pipeline_cache) return;
+
+	size_t size = 0;
+	check(vkGetPipelineCacheData(vk->device, vk->pipeline_cache, &size, NULL), "failed to get pipeline cache size");
+	void* data = malloc(size);
+	check(vkGetPipelineCacheData(vk->device, vk->pipeline_cache, &size, data), "failed to get pipeline cache data");
+
+	PipelineCacheKey key;
+	get_cache_key(vk, vk->pipeline_cache_hash, &key);
+	FILE* file;
+	fopen_s(&file, PIPELINE_CACHE_FILE, "wb");
+	if (file)
+	{
+		fwrite(&key, sizeof(key), 1, file);
+		fwrite(data, 1, size, file);
+		fclose(file);
+	}
+	free(data);
+
+	vkDestroyPipelineCache(vk->device, vk->pipeline_cache, NULL);
+	vk->pipeline_cache = NULL;
+}
+
+static void destroy_pipelines(VkInfo* vk, VkPipeline* pipelines, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (pipelines[i]) vkDestroyPipeline(vk->device, pipelines[i], NULL);
+		pipelines[i] = NULL;
+	}
+}
+
+// pipeline creation and the cache are thread safe, the layouts and modules stay until cancel_variant_build
+static void build_variant(void* param)
+{
+	VkInfo* vk = param;
+	PipelineBuild* build = &vk->pipeline_build;
+	create_graphics_pipeline(vk, &build->variant, &build->graphics);
+	if (vk->ray_tracing)
+		create_compute_variants(vk, &build->variant, &build->compute, build->deferred);
+	if (build->with_wavefront)
+		create_wavefront_pipelines(vk, &build->variant, build->wavefront);
+	set_flag(&build->done, 1);
+}
+
+void start_variant_build(VkInfo* vk)
+{
+	PipelineBuild* build = &vk->pipeline_build;
+	if (build->thread) return;
+
+	memset(build, 0, sizeof(PipelineBuild));
+	build->variant = vk->variant;
+	build->with_wavefront = vk->wavefront.pipeline_layout != NULL;
+	build->thread = start_thread(build_variant, vk);
+	if (!build->thread)
+		error("failed to start the pipeline build");
+}
+
+uint32_t finish_variant_build(VkInfo* vk)
+{
+	PipelineBuild* build = &vk->pipeline_build;
+	if (!build->thread || !build->done) return 0;
+	join_thread(build->thread);
+
+	// the recorded command buffers still reference the old pipelines
+	vkDeviceWaitIdle(vk->device);
+	destroy_pipelines(vk, &vk->pipeline, 1);
+	vk->pipeline = build->graphics;
+	if (vk->ray_tracing)
+	{
+		destroy_compute_variants(vk);
+		vk->compute_pipeline = build->compute;
+		memcpy(vk->deferred_pipelines, build->deferred, sizeof(build->deferred));
+	}
+	if (build->with_wavefront)
+	{
+		destroy_wavefront_pipelines(vk);
+		memcpy(vk->wavefront.pipelines, build->wavefront, sizeof(build->wavefront));
+	}
+	vk->built_variant = build->variant;
+	memset(build, 0, sizeof(PipelineBuild));
+
+	if (vk->command_buffers) // none while minimized
+		rerecord_command_buffers(vk);
+	return 1;
+}
+
+void cancel_variant_build(VkInfo* vk)
+{
+	PipelineBuild* build = &vk->pipeline_build;
+	if (!build->thread) return;
+	join_thread(build->thread);
+
+	destroy_pipelines(vk, &build->graphics, 1);
+	destroy_pipelines(vk, &build->compute, 1);
+	destroy_pipelines(vk, build->deferred, DEFERRED_PASS_COUNT);
+	destroy_pipelines(vk, build->wavefront, WAVEFRONT_PASS_COUNT);
+	memset(build, 0, sizeof(PipelineBuild));
+}
@@ -0,0 +1,13 @@
+﻿#pragma once
+#include "Globals.h"
+
+// the driver's pipeline cache, kept in pipeline.cache behind a key of the device and the shader binaries
+void init_pipeline_cache(VkInfo* vk);
+void destroy_pipeline_cache(VkInfo* vk); // writes it back to disk
+
+// builds the pipelines of vk->variant on a worker thread, the current ones keep rendering until
+// finish_variant_build swaps them in. returns 1 if it did
+void start_variant_build(VkInfo* vk);
+uint32_t finish_variant_build(VkInfo* vk);
+// waits for a running build and throws its pipelines away, called before the layouts it uses are destroyed
+void cancel_variant_build(VkInfo* vk);
@@ -0,0 +1,119 @@
+﻿#ifndef _WIN32
+#define _GNU_SOURCE // qsort_r
+#endif
+#include "Platform.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef struct platformThread
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	ThreadFunction function;
+	void* param;
+} PlatformThread;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID param)
+#else
+static void* thread_main(void* param)
+#endif
+{
+	PlatformThread* thread = param;
+	thread->function(thread->param);
+	return 0;
+}
+
+Thread start_thread(ThreadFunction function, void* param)
+{
+	PlatformThread* thread = malloc(sizeof(PlatformThread));
+	thread->function = function;
+	thread->param = param;
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+	if (thread->handle) return thread;
+#else
+	if (pthread_create(&thread->handle, NULL, thread_main, thread) == 0) return thread;
+#endif
+	free(thread);
+	return NULL;
+}
+
+void join_thread(Thread handle)
+{
+	PlatformThread* thread = handle;
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	free(thread);
+}
+
+void set_flag(volatile long* flag, long value)
+{
+#ifdef _WIN32
+	InterlockedExchange(flag, value);
+#else
+	__atomic_store_n(flag, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#ifndef _WIN32
+int fopen_s(FILE** file, const char* name, const char* mode)
+{
+	*file = fopen(name, mode);
+	return *file ? 0 : errno;
+}
+
+int strcpy_s(char* destination, size_t size, const char* source)
+{
+	size_t length = strlen(source);
+	if (length >= size)
+	{
+		if (size > 0) destination[0] = '\0';
+		return ERANGE;
+	}
+	memcpy(destination, source, length + 1);
+	return 0;
+}
+
+int strcat_s(char* destination, size_t size, const char* source)
+{
+	size_t length = strnlen(destination, size);
+	if (length == size) return EINVAL;
+	return strcpy_s(destination + length, size - length, source);
+}
+
+// qsort_s hands the context first, qsort_r last
+typedef struct sortContext
+{
+	int (*compare)(void* context, const void* a, const void* b);
+	void* context;
+} SortContext;
+
+static int sort_compare(const void* a, const void* b, void* param)
+{
+	SortContext* sort = param;
+	return sort->compare(sort->context, a, b);
+}
+
+void qsort_s(void* base, size_t count, size_t size, int (*compare)(void* context, const void* a, const void* b), void* context)
+{
+	SortContext sort = { compare, context };
+	qsort_r(base, count, size, sort_compare, &sort);
+}
+#endif
@@ -0,0 +1,43 @@
+﻿#pragma once
+#include <stddef.h>
+#include <stdio.h>
+
+// the few things that differ between windows and linux. it is meant to let the headless runs build against a software
+// vulkan on linux, the project only has the visual studio build so far and nothing checks that on linux
+
+// a worker thread, join_thread waits for it and frees it
+typedef void* Thread;
+typedef void (*ThreadFunction)(void* param);
+Thread start_thread(ThreadFunction function, void* param); // NULL if the thread could not be started
+void join_thread(Thread thread);
+// sets a flag that another thread polls
+void set_flag(volatile long* flag, long value);
+
+#ifndef _WIN32
+// the msvc secure crt functions the project uses, on top of the standard ones
+int fopen_s(FILE** file, const char* name, const char* mode);
+int strcpy_s(char* destination, size_t size, const char* source);
+int strcat_s(char* destination, size_t size, const char* source);
+void qsort_s(void* base, size_t count, size_t size, int (*compare)(void* context, const void* a, const void* b), void* context);
+#define sprintf_s snprintf
+#define sscanf_s sscanf // only used with numbers, which take no buffer sizes
+// macros in the stdlib.h of msvc, the c files use them as such
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#endif
+
+// msvc only has it with _USE_MATH_DEFINES, strict c11 not at all
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// the shader compiler of the vulkan sdk
+#ifdef _WIN32
+#define GLSLANG_VALIDATOR "glslangValidator.exe"
+#else
+#define GLSLANG_VALIDATOR "glslangValidator"
+#endif
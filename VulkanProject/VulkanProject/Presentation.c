@@ -1,123 +1,174 @@
-﻿#include <corecrt_math.h>
-#include <corecrt_math_defines.h>
+﻿#define _USE_MATH_DEFINES
+#include <math.h>
 #include <string.h>
 
 #include "Globals.h"
+#include "Platform.h"
 #include "Util.h"
 #include "Presentation.h"
 
 #include <stdlib.h>
 
 #include "Bindings.h"
+#include "VulkanUtil.h"
 
 #include "ImguiSetup.h"
+#include "Compute.h"
+#include "SceneBuffers.h"
+#include "Temporal.h"
+#include "Wavefront.h"
+#include "Profiler.h"
+#include "RenderScale.h"
+#include "LightTree.h"
 
 void set_global_buffers(VkInfo* vk, Scene* scene)
 {
 
 	// Scene Data
-	SceneData* sceneData;
-	check(vkMapMemory(vk->device, GET_SCENE_DATA_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(SceneData), 0, &sceneData), "");
-	memcpy(sceneData, &scene->scene_data, sizeof(SceneData));
-	vkUnmapMemory(vk->device, GET_SCENE_DATA_BUFFER(vk).vk_buffer_memory);
-
-	// Vertex buffer
-	Vertex* vertexData;
-	check(vkMapMemory(vk->device, GET_VERTEX_BUFFER(vk).vk_buffer_memory, 
-		0, sizeof(Vertex) * scene->scene_data.numVertices, 0, &vertexData), "");
-	memcpy(vertexData, scene->vertices, sizeof(Vertex) * scene->scene_data.numVertices);
-	vkUnmapMemory(vk->device, GET_VERTEX_BUFFER(vk).vk_buffer_memory);
-
-	// IndexBuffer
-	uint32_t* indexData;
-	check(vkMapMemory(vk->device, GET_INDEX_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(uint32_t) * scene->scene_data.numTriangles * 3, 0, &indexData), "");
-	memcpy(indexData, scene->indices, sizeof(uint32_t) * scene->scene_data.numTriangles * 3);
-	vkUnmapMemory(vk->device, GET_INDEX_BUFFER(vk).vk_buffer_memory);
-
-	// materialBuffer
-	Material* materialData;
-	check(vkMapMemory(vk->device, GET_MATERIAL_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(Material) * scene->texture_data.num_materials, 0, &materialData), "");
-	memcpy(materialData, scene->texture_data.materials, sizeof(Material) * scene->texture_data.num_materials);
-	vkUnmapMemory(vk->device, GET_MATERIAL_BUFFER(vk).vk_buffer_memory);
-
-	Light* lightData;
-	check(vkMapMemory(vk->device, GET_LIGHT_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(Light) * scene->scene_data.numLights, 0, &lightData), "");
-	memcpy(lightData, scene->lights, sizeof(Light) * scene->scene_data.numLights);
-	vkUnmapMemory(vk->device, GET_LIGHT_BUFFER(vk).vk_buffer_memory);
-
-	// Scenenodes
-	SceneNode* sceneNodeData;
-	check(vkMapMemory(vk->device, GET_NODE_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(SceneNode) * scene->scene_data.numSceneNodes, 0, (void**) &sceneNodeData), "");
-	memcpy(sceneNodeData, scene->scene_nodes, sizeof(SceneNode) * scene->scene_data.numSceneNodes);
-	vkUnmapMemory(vk->device, GET_NODE_BUFFER(vk).vk_buffer_memory);
-
-	Mat4x3* transfromData;
-	check(vkMapMemory(vk->device, GET_TRANSFROM_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(Mat4x3) * scene->scene_data.numTransforms, 0, (void**)&transfromData), "");
-	memcpy(transfromData, scene->node_transforms, sizeof(Mat4x3) * scene->scene_data.numTransforms);
-	vkUnmapMemory(vk->device, GET_TRANSFROM_BUFFER(vk).vk_buffer_memory);
-
-	// child indices
-	uint32_t* childrenData;
-	check(vkMapMemory(vk->device, GET_CHILD_BUFFER(vk).vk_buffer_memory,
-		0, sizeof(uint32_t) * scene->scene_data.numNodeIndices, 0, &childrenData), "");
-	memcpy(childrenData, scene->node_indices, sizeof(uint32_t) * scene->scene_data.numNodeIndices);
-	vkUnmapMemory(vk->device, GET_CHILD_BUFFER(vk).vk_buffer_memory);
+	memcpy(mapBuffer(vk, GET_SCENE_DATA_BUFFER(vk).vk_buffer), &scene->scene_data, sizeof(SceneData));
+
+	upload_scene_geometry(vk, scene);
+	uploadBuffer(vk, &GET_MATERIAL_BUFFER(vk), scene->texture_data.materials, sizeof(Material) * scene->texture_data.num_materials);
+	uploadBuffer(vk, &GET_LIGHT_BUFFER(vk), scene->lights, sizeof(Light) * scene->scene_data.numLights);
+	uploadBuffer(vk, &GET_LIGHT_TREE_BUFFER(vk), scene->light_nodes, sizeof(LightNode) * scene->scene_data.numLightNodes);
+	uploadBuffer(vk, &GET_TRANSFROM_BUFFER(vk), scene->node_transforms, sizeof(Mat4x3) * scene->scene_data.numTransforms);
+	uploadBuffer(vk, &GET_INVERSE_TRANSFORM_BUFFER(vk), scene->inverse_transforms, sizeof(Mat4x3) * scene->scene_data.numTransforms);
+	uploadBuffer(vk, &GET_CHILD_BUFFER(vk), scene->node_indices, sizeof(uint32_t) * scene->scene_data.numNodeIndices);
+}
+
+void init_frame_ring(VkInfo* vk)
+{
+	FrameRing* ring = &vk->frame_ring;
+	ring->count = vk->per_frame_buffers.sets_count;
+	ring->mapped = malloc(sizeof(FrameData*) * ring->count);
+	ring->written = calloc(ring->count, sizeof(FrameData));
+	for (uint32_t i = 0; i < ring->count; i++)
+	{
+		ring->mapped[i] = mapBuffer(vk, GET_FRAMEDATA_BUFFER(vk, i).vk_buffer);
+		memset(ring->mapped[i], 0, sizeof(FrameData)); // same as written
+		memset(mapBuffer(vk, GET_FRAMESTATS_BUFFER(vk, i).vk_buffer), 0, sizeof(FrameStats));
+	}
+}
+
+void destroy_frame_ring(VkInfo* vk)
+{
+	free(vk->frame_ring.mapped);
+	free(vk->frame_ring.written);
+	memset(&vk->frame_ring, 0, sizeof(FrameRing));
+}
+
+// the uniform is write combined memory, so only the 16 byte pieces that differ from what this slot got last time are written
+static void write_frame_data(FrameRing* ring, const FrameData* frame, uint32_t slot)
+{
+	const char* src = (const char*)frame;
+	char* last = (char*)&ring->written[slot];
+	char* dst = (char*)ring->mapped[slot];
+	size_t size = sizeof(FrameData);
+
+	ring->dirty_bytes = 0;
+	size_t run_start = 0, run_size = 0;
+	for (size_t offset = 0; offset < size; offset += 16)
+	{
+		size_t piece = size - offset < 16 ? size - offset : 16;
+		if (memcmp(src + offset, last + offset, piece) != 0)
+		{
+			if (run_size == 0) run_start = offset;
+			run_size += piece;
+			continue;
+		}
+		if (run_size)
+		{
+			memcpy(dst + run_start, src + run_start, run_size);
+			ring->dirty_bytes += (uint32_t)run_size;
+			run_size = 0;
+		}
+	}
+	if (run_size)
+	{
+		memcpy(dst + run_start, src + run_start, run_size);
+		ring->dirty_bytes += (uint32_t)run_size;
+	}
+	memcpy(last, src, size);
+}
 
+// the ray rates borrow rays from the other pixel of a quad pair, see borrowsRays in raytrace.frag
+static VkBool32 pairs_rays(VkInfo* vk)
+{
+	if (!vk->subgroup_quad)
+		return VK_FALSE; // the shaders were loaded without the quad operations
+	switch (vk->dispatch_mode)
+	{
+	case RAY_DISPATCH_FRAGMENT:
+		return VK_TRUE;
+	case RAY_DISPATCH_COMPUTE:
+	case RAY_DISPATCH_DEFERRED:
+		return compute_full_subgroups(vk);
+	default:
+		return VK_FALSE; // the wavefront passes trace every ray
+	}
 }
 
-void set_frame_buffers(VkInfo* vk, Scene* scene, uint32_t image_index) {
+VkBool32 set_frame_buffers(VkInfo* vk, Scene* scene, uint32_t image_index) {
 	FrameData frame = { 0 };
 	Camera c = scene->camera;
 
-
 	float x_radians = c.rotation_x * (float)M_PI / 180.0f;
 	float y_radians = c.rotation_y * (float)M_PI / 180.0f;
 
 	float cos_x = cosf(x_radians), sin_x = sinf(x_radians);
 	float cos_y = cosf(y_radians), sin_y = sinf(y_radians);
 
-	float rotation_x[3][3] = {
-		{1.0f, 0.0f, 0.0f},
-		{0.0f, cos_x, sin_x},
-		{0.0f, -sin_x, cos_x}
-	};
-	float rotation_z[3][3] = {
-		{cos_y, 0, sin_y},
-		{0, 1, 0},
-		{-sin_y, 0.0f, cos_y}
-	};
-	float rotation[3][3] = {0};
-	for (uint32_t i = 0; i != 3; i++)
-		for (uint32_t j = 0; j != 3; j++)
-			for (uint32_t k = 0; k != 3; k++)
-				rotation[i][j] += rotation_x[i][k] * rotation_z[k][j];
-
-
+	// rotation around x times the rotation around y, multiplied out
 	float mat[4][4] = {
-		{rotation[0][0], rotation[0][1], rotation[0][2], 0},
-		{rotation[1][0], rotation[1][1], rotation[1][2], 0},
-		{rotation[2][0], rotation[2][1], rotation[2][2], 0},
+		{cos_y, 0.0f, sin_y, 0},
+		{-sin_x * sin_y, cos_x, sin_x * cos_y, 0},
+		{-cos_x * sin_y, -sin_x, cos_x * cos_y, 0},
 		{c.pos[0], c.pos[1], c.pos[2], 1.0f}
 	};
 
-
 	memcpy(&frame.view_to_world, &mat, sizeof(float) * 4 * 4);
 	frame.width = WINDOW_WIDTH;
 	frame.height = WINDOW_HEIGHT;
+	VkExtent2D traced = traced_extent(vk, image_index);
+	if (traced.width != vk->swapchain.extent.width || traced.height != vk->swapchain.extent.height)
+	{
+		// the compute paths trace at a lower resolution while the camera moves
+		frame.width = traced.width;
+		frame.height = traced.height;
+	}
 	frame.settings = scene->camera.settings;
+	if (!pairs_rays(vk))
+		frame.settings.secondaryRate = frame.settings.shadowRate = RAY_RATE_FULL;
+	frame.collectStats = vk->profiler.csv != NULL || vk->profiler.live_stats;
+	frame.collectNodeCosts = vk->node_profile.collecting;
 	//frame.settings.fov = (float)M_PI / 180.f * scene->camera.settings.fov;
 
-	void* data;
-	check(vkMapMemory(vk->device, GET_FRAMEDATA_BUFFER(vk, image_index).vk_buffer_memory,
-		0, sizeof(FrameData), 0, &data), "");
-	memcpy(data, &frame, sizeof(FrameData));
-	vkUnmapMemory(vk->device, GET_FRAMEDATA_BUFFER(vk,image_index).vk_buffer_memory);
+	// nothing is written if the image only presents the cached frame, it would not read it anyway
+	if (update_temporal_cache(vk, &frame, image_index))
+		return VK_TRUE;
+	if (vk->node_profile.collecting)
+		vk->node_profile.frames++;
+	write_frame_data(&vk->frame_ring, &frame, image_index);
+	return VK_FALSE;
+}
+
+// lights toggled in the ui, only the edited range goes to the gpu
+void flush_light_edits(VkInfo* vk, Scene* scene)
+{
+	uint32_t first = vk->dirty_lights_begin;
+	uint32_t count = vk->dirty_lights_end - vk->dirty_lights_begin;
+	vk->dirty_lights_begin = vk->dirty_lights_end = 0;
+	if (count == 0) return;
+	vk->temporal.valid = VK_FALSE; // the cached frame was lit differently
+
+	// the other frames in flight still read the light buffer
+	vkQueueWaitIdle(vk->graphics_queue);
+	uploadBufferRange(vk, &GET_LIGHT_BUFFER(vk), first * sizeof(Light), &scene->lights[first], count * sizeof(Light));
+	// the powers of the whole path up to the root change, the tree is small enough to go up in one piece
+	refit_light_tree(scene);
+	uploadBuffer(vk, &GET_LIGHT_TREE_BUFFER(vk), scene->light_nodes, sizeof(LightNode) * scene->scene_data.numLightNodes);
+	// and the number of lights that are on
+	memcpy(mapBuffer(vk, GET_SCENE_DATA_BUFFER(vk).vk_buffer), &scene->scene_data, sizeof(SceneData));
 }
 
 void printSceneSizes(Scene* scene) {
@@ -132,7 +183,7 @@ void printSceneSizes(Scene* scene) {
 	uint64_t sizeVertices = numVertices * sizeof(Vertex) / mb;
 	uint64_t sizeIndices = numIndices * sizeof(uint32_t) / mb;
 	uint64_t sizeNode = numNodes * sizeof(SceneNode) / mb;
-	uint64_t sizeTransforms = numTransforms * sizeof(Mat4x3) / mb;
+	uint64_t sizeTransforms = 2 * numTransforms * sizeof(Mat4x3) / mb; // and their inverses
 	uint64_t sizeChildIndices = numIndices * sizeof(uint32_t) / mb;
 
 	uint64_t numStructures = 0;
@@ -158,6 +209,17 @@ void printSceneSizes(Scene* scene) {
 	printf("SceneSize: %lu mb\n", sceneSize);
 }
 
+// the last submission of this image is done, what it measured can be read
+void read_finished_frame(VkInfo* info, uint32_t image_index)
+{
+	if (info->recorded_dispatch_mode == RAY_DISPATCH_WAVEFRONT)
+		read_wavefront_stats(info, image_index);
+	if (info->recorded_dispatch_mode == RAY_DISPATCH_DEFERRED)
+		read_deferred_timings(info, image_index);
+	read_frame_profile(info, image_index);
+	measure_render_scale(info, image_index);
+}
+
 void drawFrame(VkInfo* info, Scene* scene, SceneSelection* scene_selection) // see https://vulkan-tutorial.com/
 {
 	size_t currentFrame = info->currentFrame;
@@ -170,6 +232,7 @@ void drawFrame(VkInfo* info, Scene* scene, SceneSelection* scene_selection) // s
 
 	if (info->imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
 		vkWaitForFences(info->device, 1, &info->imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+		read_finished_frame(info, imageIndex);
 	}
 	info->imagesInFlight[imageIndex] = info->inFlightFences[currentFrame];
 	VkSemaphore waitSemaphores[] = { info->imageAvailableSemaphore[currentFrame] };
@@ -177,9 +240,13 @@ void drawFrame(VkInfo* info, Scene* scene, SceneSelection* scene_selection) // s
 	VkSemaphore signalSemaphores[] = { info->renderFinishedSemaphore[currentFrame] };
 
 
-	set_frame_buffers(info, scene, imageIndex);
+	flush_light_edits(info, scene);
+	update_render_scale(info, scene, imageIndex);
+	// an unchanged frame only blits the compute target again
+	VkBool32 reuse = set_frame_buffers(info, scene, imageIndex);
+	VkCommandBuffer ray_buffer = reuse ? info->temporal.present_buffers[imageIndex] : info->command_buffers[imageIndex];
 
-	VkCommandBuffer buffers[] = { info->command_buffers[imageIndex] , info->imgui_command_buffers[imageIndex] };
+	VkCommandBuffer buffers[] = { ray_buffer, info->imgui_command_buffers[imageIndex] };
 
 	VkSubmitInfo submitInfo = {
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -214,4 +281,5 @@ void drawFrame(VkInfo* info, Scene* scene, SceneSelection* scene_selection) // s
 	double diff = now - info->lastFrame;
 	info->lastFrame = now;
 	info->frameRate = 1 / diff;
+	profile_submit(info, imageIndex, diff, scene_selection->availableScenes[scene_selection->currentScene]);
 }
\ No newline at end of file
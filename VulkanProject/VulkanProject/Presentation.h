@@ -2,6 +2,10 @@
 #include "Globals.h"
 #include "Scene.h"
 void set_global_buffers(VkInfo* vk, Scene* scene);
-void set_frame_buffers(VkInfo* vk, Scene* scene, uint32_t image_index);
+VkBool32 set_frame_buffers(VkInfo* vk, Scene* scene, uint32_t image_index); // VK_TRUE if the cached frame is presented
+void init_frame_ring(VkInfo* vk);
+void destroy_frame_ring(VkInfo* vk);
+void flush_light_edits(VkInfo* vk, Scene* scene);
 void printSceneSizes(Scene* scene);
+void read_finished_frame(VkInfo* info, uint32_t image_index);
 void drawFrame(VkInfo* info, Scene* scene, SceneSelection* scene_selection);
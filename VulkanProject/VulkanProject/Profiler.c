@@ -0,0 +1,214 @@
+﻿#include "Profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Bindings.h"
+#include "Platform.h"
+#include "Util.h"
+#include "VulkanUtil.h"
+
+static const char* dispatch_names[] = { "fragment", "compute", "wavefront", "deferred" };
+
+static void write_histogram_header(FILE* file, const char* name, uint32_t bins)
+{
+	for (uint32_t i = 0; i < bins; i++)
+		fprintf(file, ",%s_%u", name, i);
+}
+
+// a mode that does not record the histogram leaves the cells empty instead of writing zeros
+static void write_histogram(FILE* file, const uint32_t* histogram, uint32_t bins, VkBool32 recorded)
+{
+	for (uint32_t i = 0; i < bins; i++)
+	{
+		if (recorded)
+			fprintf(file, ",%u", histogram[i]);
+		else
+			fprintf(file, ",");
+	}
+}
+
+VkBool32 pixel_histograms_recorded(uint32_t dispatch_mode)
+{
+	return dispatch_mode != RAY_DISPATCH_WAVEFRONT;
+}
+
+// per pixel averages for the imgui plots
+static void push_history(Profiler* p)
+{
+	const FrameStats* s = &p->stats;
+	float pixels = s->pixels ? (float)s->pixels : 1.0f;
+	uint32_t i = p->history_offset;
+	p->history_queries[i] = (float)s->queries / pixels;
+	p->history_instances[i] = (float)s->instance_hits / pixels;
+	p->history_candidates[i] = (float)s->triangle_candidates / pixels;
+	p->history_drops[i] = (float)s->overflow_drops;
+	p->history_pruned[i] = (float)s->pruned_rays;
+	p->history_offset = (i + 1) % PROFILER_HISTORY;
+}
+
+void init_profiler(VkInfo* vk)
+{
+	Profiler* p = &vk->profiler;
+	// queues without timestamps leave the pools empty, every other function checks for that
+	if (vk->queue_family_properties[vk->queue_family_index].timestampValidBits == 0)
+		return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	p->timestamp_period = properties.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo query_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = PROFILER_QUERIES * PROFILER_MAX_IMAGES
+	};
+	check(vkCreateQueryPool(vk->device, &query_info, NULL, &p->frame_pool), "failed to create query pool");
+	query_info.queryCount = 2;
+	check(vkCreateQueryPool(vk->device, &query_info, NULL, &p->build_pool), "failed to create query pool");
+}
+
+void destroy_profiler(VkInfo* vk)
+{
+	Profiler* p = &vk->profiler;
+	stop_profile_capture(vk);
+	if (p->frame_pool) vkDestroyQueryPool(vk->device, p->frame_pool, NULL);
+	if (p->build_pool) vkDestroyQueryPool(vk->device, p->build_pool, NULL);
+	memset(p, 0, sizeof(Profiler));
+}
+
+void profile_pass_begin(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index, uint32_t pass)
+{
+	Profiler* p = &vk->profiler;
+	if (!p->frame_pool || image_index >= PROFILER_MAX_IMAGES) return;
+	uint32_t query = image_index * PROFILER_QUERIES + pass * 2;
+	vkCmdResetQueryPool(cb, p->frame_pool, query, 2);
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, p->frame_pool, query);
+}
+
+void profile_pass_end(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index, uint32_t pass)
+{
+	Profiler* p = &vk->profiler;
+	if (!p->frame_pool || image_index >= PROFILER_MAX_IMAGES) return;
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, p->frame_pool, image_index * PROFILER_QUERIES + pass * 2 + 1);
+}
+
+void profile_build_begin(VkInfo* vk, VkCommandBuffer cb)
+{
+	Profiler* p = &vk->profiler;
+	if (!p->build_pool) return;
+	vkCmdResetQueryPool(cb, p->build_pool, 0, 2);
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, p->build_pool, 0);
+}
+
+void profile_build_end(VkInfo* vk, VkCommandBuffer cb)
+{
+	Profiler* p = &vk->profiler;
+	if (!p->build_pool) return;
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, p->build_pool, 1);
+}
+
+// the builds are submitted and waited for one by one anyway, so the result is there already
+void profile_build_collect(VkInfo* vk)
+{
+	Profiler* p = &vk->profiler;
+	if (!p->build_pool) return;
+	uint64_t timestamps[2];
+	if (vkGetQueryPoolResults(vk->device, p->build_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+	p->build_ms += (float)(timestamps[1] - timestamps[0]) * p->timestamp_period / 1000000.0f;
+	p->builds++;
+}
+
+void profile_submit(VkInfo* vk, uint32_t image_index, double cpu_seconds, const char* scene_name)
+{
+	Profiler* p = &vk->profiler;
+	if (image_index >= PROFILER_MAX_IMAGES) return;
+	p->submitted[image_index] = VK_TRUE;
+	p->submitted_frame[image_index] = p->frame++;
+	p->submitted_cpu_ms[image_index] = cpu_seconds * 1000.0;
+	p->submitted_scene[image_index] = scene_name;
+}
+
+void read_frame_profile(VkInfo* vk, uint32_t image_index)
+{
+	Profiler* p = &vk->profiler;
+	if (image_index >= PROFILER_MAX_IMAGES || !p->submitted[image_index]) return;
+	p->submitted[image_index] = VK_FALSE;
+
+	if (p->frame_pool) {
+		uint64_t timestamps[PROFILER_QUERIES];
+		if (vkGetQueryPoolResults(vk->device, p->frame_pool, image_index * PROFILER_QUERIES, PROFILER_QUERIES,
+			sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			float ms = p->timestamp_period / 1000000.0f;
+			for (uint32_t pass = 0; pass < PROFILE_PASS_COUNT; pass++)
+				p->pass_ms[pass] = (float)(timestamps[pass * 2 + 1] - timestamps[pass * 2]) * ms;
+		}
+	}
+
+	// the shaders only add to it while stats are collected, the next submission of this image starts from zero again.
+	// the fence of the image has passed, so this does not wait for anything
+	FrameStats* stats = mapBuffer(vk, GET_FRAMESTATS_BUFFER(vk, image_index).vk_buffer);
+	p->stats = *stats;
+	memset(stats, 0, sizeof(FrameStats));
+	if (p->stats.pixels)
+		push_history(p);
+
+	if (!p->csv) return;
+	const FrameStats* s = &p->stats;
+	FILE* file = (FILE*)p->csv;
+	fprintf(file, "%llu,%s,%s,%u,%u,%.3f,%.3f,%.3f,%.3f,%u,%u,%u,%u,%.2f,%u,%u,%u,%u,%u,%u,%u",
+		p->submitted_frame[image_index], p->submitted_scene[image_index], dispatch_names[vk->recorded_dispatch_mode],
+		vk->swapchain.extent.width, vk->swapchain.extent.height,
+		p->submitted_cpu_ms[image_index], p->pass_ms[PROFILE_PASS_RAY], p->pass_ms[PROFILE_PASS_IMGUI], p->build_ms,
+		s->queries, s->traversals, s->max_traversal_depth, s->pixels,
+		s->pixels ? (float)s->queries / (float)s->pixels : 0.0f,
+		s->instance_hits, s->triangle_candidates, s->overflow_drops, s->max_stack,
+		s->secondary_rays, s->pruned_rays, s->evicted_rays);
+	VkBool32 per_pixel = pixel_histograms_recorded(vk->recorded_dispatch_mode);
+	write_histogram(file, s->query_histogram, STATS_HISTOGRAM_BINS, per_pixel);
+	write_histogram(file, s->instance_histogram, STATS_HISTOGRAM_BINS, per_pixel);
+	write_histogram(file, s->candidate_histogram, STATS_HISTOGRAM_BINS, per_pixel);
+	write_histogram(file, s->stack_histogram, STATS_HISTOGRAM_BINS, per_pixel);
+	write_histogram(file, s->lod_histogram, STATS_LOD_LEVELS, VK_TRUE);
+	fprintf(file, "\n");
+}
+
+void start_profile_capture(VkInfo* vk, const char* file_name)
+{
+	Profiler* p = &vk->profiler;
+	if (p->csv) return;
+	if (file_name)
+		strcpy_s(p->csv_name, sizeof(p->csv_name), file_name);
+	else
+		sprintf_s(p->csv_name, sizeof(p->csv_name), "profile_%lld.csv", (long long)time(NULL));
+	FILE* file;
+	if (fopen_s(&file, p->csv_name, "w") != 0) {
+		printf("could not open %s\n", p->csv_name);
+		return;
+	}
+	fprintf(file, "frame,scene,dispatch,width,height,cpu_ms,ray_ms,imgui_ms,as_build_ms,queries,traversals,max_traversal_depth,pixels,queries_per_pixel,"
+		"instance_hits,triangle_candidates,overflow_drops,max_stack,secondary_rays,pruned_rays,evicted_rays");
+	write_histogram_header(file, "query_bin", STATS_HISTOGRAM_BINS);
+	write_histogram_header(file, "instance_bin", STATS_HISTOGRAM_BINS);
+	write_histogram_header(file, "candidate_bin", STATS_HISTOGRAM_BINS);
+	write_histogram_header(file, "stack_bin", STATS_HISTOGRAM_BINS);
+	write_histogram_header(file, "lod", STATS_LOD_LEVELS);
+	fprintf(file, "\n");
+	p->csv = file;
+	p->frame = 0;
+	// frames that were submitted before the capture have no stats, they are left out
+	memset(p->submitted, 0, sizeof(p->submitted));
+}
+
+void stop_profile_capture(VkInfo* vk)
+{
+	Profiler* p = &vk->profiler;
+	if (!p->csv) return;
+	fclose((FILE*)p->csv);
+	p->csv = NULL;
+	printf("profile written to %s\n", p->csv_name);
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+#include "Globals.h"
+
+// gpu timestamps around the ray pass, the imgui pass and the acceleration structure builds. the frame timestamps
+// and the traversal stats are read once the fence of their image has passed, so nothing waits on them. a capture
+// writes one csv row per frame
+void init_profiler(VkInfo* vk);
+void destroy_profiler(VkInfo* vk);
+
+// PROFILE_PASS_*, begin resets the queries of the pass and has to be outside of a render pass
+void profile_pass_begin(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index, uint32_t pass);
+void profile_pass_end(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index, uint32_t pass);
+
+// around a single acceleration structure build, collect after its command buffer has finished
+void profile_build_begin(VkInfo* vk, VkCommandBuffer cb);
+void profile_build_end(VkInfo* vk, VkCommandBuffer cb);
+void profile_build_collect(VkInfo* vk);
+
+// remembers what went into the submission of an image, read_frame_profile picks it up next time the image comes around
+void profile_submit(VkInfo* vk, uint32_t image_index, double cpu_seconds, const char* scene_name);
+void read_frame_profile(VkInfo* vk, uint32_t image_index);
+// the wavefront rays are not traced per pixel, so that mode leaves the per pixel histograms of FrameStats empty
+VkBool32 pixel_histograms_recorded(uint32_t dispatch_mode);
+
+void start_profile_capture(VkInfo* vk, const char* file_name); // NULL names it after the time
+void stop_profile_capture(VkInfo* vk);
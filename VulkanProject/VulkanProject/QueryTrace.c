@@ -0,0 +1,185 @@
+﻿#include "QueryTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Platform.h"
+#include "VulkanUtil.h"
+
+static VkDeviceSize trace_buffer_size(Scene* scene)
+{
+	return sizeof(QueryTraceHeader) + (VkDeviceSize)scene->camera.settings.traceMax * sizeof(QueryTrace);
+}
+
+// both command buffers are done once the fence of the copy has passed
+static void free_capture_commands(VkInfo* info)
+{
+	QueryTraceCapture* capture = &info->ray_descriptor.traceCapture;
+	if (capture->reset_commands)
+		vkFreeCommandBuffers(info->device, info->command_pool, 1, &capture->reset_commands);
+	if (capture->copy_commands)
+		vkFreeCommandBuffers(info->device, info->command_pool, 1, &capture->copy_commands);
+	capture->reset_commands = NULL;
+	capture->copy_commands = NULL;
+}
+
+static void submit_capture_commands(VkInfo* info, VkCommandBuffer cb, VkFence fence)
+{
+	check(vkEndCommandBuffer(cb), "");
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cb
+	};
+	check(vkQueueSubmit(info->graphics_queue, 1, &submit_info, fence), "failed to submit query trace commands");
+}
+
+void create_trace_buffer(VkInfo* info, Scene* scene)
+{
+	QueryTraceCapture* capture = &info->ray_descriptor.traceCapture;
+	VkDeviceSize size = trace_buffer_size(scene);
+	createBuffer(info, size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&info->ray_descriptor.traceBuffer,
+		&info->ray_descriptor.traceMemory);
+	VkDeviceMemory staging_memory;
+	createBuffer(info, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&capture->staging, &staging_memory);
+
+	VkCommandBuffer cb = beginSingleTimeCommands(info);
+	vkCmdFillBuffer(cb, info->ray_descriptor.traceBuffer, 0, VK_WHOLE_SIZE, 0);
+	endSingleTimeCommands(info, cb);
+
+	VkFenceCreateInfo fence_info = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	check(vkCreateFence(info->device, &fence_info, NULL, &capture->fence), "failed to create fence");
+	capture->state = TRACE_IDLE;
+}
+
+void destroy_trace_buffer(VkInfo* info)
+{
+	QueryTraceCapture* capture = &info->ray_descriptor.traceCapture;
+	if (capture->state == TRACE_READING)
+		vkWaitForFences(info->device, 1, &capture->fence, VK_TRUE, UINT64_MAX);
+	free_capture_commands(info);
+	vkDestroyFence(info->device, capture->fence, NULL);
+	destroyBuffer(info, capture->staging);
+	destroyBuffer(info, info->ray_descriptor.traceBuffer);
+	memset(capture, 0, sizeof(QueryTraceCapture));
+	info->ray_descriptor.traceBuffer = NULL;
+}
+
+void begin_query_trace(VkInfo* info, Scene* scene)
+{
+	QueryTraceCapture* capture = &info->ray_descriptor.traceCapture;
+	if (!info->ray_tracing || scene->camera.settings.recordQueryTrace == 0) return;
+	if (capture->state != TRACE_IDLE) {
+		// the previous capture is still being read, this one is dropped instead of mixing into it
+		if (capture->state == TRACE_READING)
+			scene->camera.settings.recordQueryTrace = 0;
+		return;
+	}
+	free_capture_commands(info);
+
+	// only the head has to be reset, the records behind it are overwritten
+	capture->reset_commands = beginSingleTimeCommands(info);
+	vkCmdFillBuffer(capture->reset_commands, info->ray_descriptor.traceBuffer, 0, sizeof(QueryTraceHeader), 0);
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(capture->reset_commands, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	submit_capture_commands(info, capture->reset_commands, VK_NULL_HANDLE);
+	capture->state = TRACE_RECORDING;
+}
+
+static void write_query_trace(VkInfo* info, Scene* scene)
+{
+	const char* data = mapBuffer(info, info->ray_descriptor.traceCapture.staging);
+	const QueryTraceHeader* header = (const QueryTraceHeader*)data;
+	const QueryTrace* traces = (const QueryTrace*)(data + sizeof(QueryTraceHeader));
+	uint32_t trace_max = scene->camera.settings.traceMax;
+	uint32_t count = header->head < trace_max ? header->head : trace_max;
+	uint32_t first = header->head > trace_max ? header->head % trace_max : 0;
+
+	QueryTraceRecord* records = malloc(sizeof(QueryTraceRecord) * (count ? count : 1));
+	uint32_t queries = 0;
+	uint32_t lod_selections = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const QueryTrace* t = &traces[(first + i) % trace_max];
+		if (t->isValid == 2)
+			lod_selections++;
+		if (t->isValid != 1)
+			continue;
+		QueryTraceRecord* r = &records[queries++];
+		r->pixel = t->pixel;
+		r->node = t->nodeNumber;
+		r->t = t->t;
+		r->triangle_candidates = t->triangleIntersections;
+		r->instance_hits = t->instanceIntersections;
+		r->sequence = (uint16_t)t->sequence;
+		r->level = (int16_t)t->nodeLevel;
+	}
+
+	QueryTraceFileHeader file_header = {
+		.magic = QUERY_TRACE_MAGIC,
+		.version = QUERY_TRACE_VERSION,
+		.record_count = queries,
+		.overwritten = header->head - count,
+		.width = info->swapchain.extent.width,
+		.height = info->swapchain.extent.height,
+		.node_count = scene->scene_data.numSceneNodes
+	};
+	char file_name[64];
+	sprintf_s(file_name, sizeof(file_name), "trace_%lld.qtrace", (long long)time(NULL));
+	FILE* file;
+	if (fopen_s(&file, file_name, "wb") != 0) {
+		printf("could not open %s\n", file_name);
+		free(records);
+		return;
+	}
+	fwrite(&file_header, sizeof(file_header), 1, file);
+	fwrite(records, sizeof(QueryTraceRecord), queries, file);
+	fclose(file);
+	free(records);
+	printf("Query trace: %u queries, %u lod selections, %u overwritten, written to %s\n",
+		queries, lod_selections, file_header.overwritten, file_name);
+}
+
+void compile_query_trace(VkInfo* info, Scene* scene)
+{
+	QueryTraceCapture* capture = &info->ray_descriptor.traceCapture;
+	if (capture->state == TRACE_RECORDING)
+	{
+		// the recorded frame was just submitted, the copy goes behind it on the same queue
+		capture->copy_commands = beginSingleTimeCommands(info);
+		VkMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+		};
+		vkCmdPipelineBarrier(capture->copy_commands, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+		VkBufferCopy region = { .size = trace_buffer_size(scene) };
+		vkCmdCopyBuffer(capture->copy_commands, info->ray_descriptor.traceBuffer, capture->staging, 1, &region);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(capture->copy_commands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, NULL, 0, NULL);
+		check(vkResetFences(info->device, 1, &capture->fence), "");
+		submit_capture_commands(info, capture->copy_commands, capture->fence);
+		capture->state = TRACE_READING;
+		scene->camera.settings.recordQueryTrace = 0;
+		return;
+	}
+	if (capture->state != TRACE_READING || vkGetFenceStatus(info->device, capture->fence) != VK_SUCCESS) return;
+
+	capture->state = TRACE_IDLE;
+	write_query_trace(info, scene);
+}
@@ -0,0 +1,59 @@
+﻿#pragma once
+#include "Globals.h"
+
+// the query trace records the ray queries of a region of pixels into a ring on the gpu (QueryTraceRecord.frag).
+// a capture clears the ring before its frame and copies it into a staging buffer behind the frame, the dump is
+// written once the fence of the copy has passed, so the render loop never waits for it
+typedef struct queryTrace {
+	float matrix[4][4];
+	float start[3];
+	float t;
+	float end[3];
+	uint32_t nodeNumber;
+	uint32_t isValid; // 1 for a query, 2 for a lod selection, otherwise invalid
+	int32_t nodeLevel; // the nodeNumber for this
+	uint32_t triangleIntersections; // triangle candidates of the query
+	uint32_t instanceIntersections;
+	uint32_t pixel; // x | y << 16
+	uint32_t sequence; // order of the records of one pixel
+	uint32_t padding[2];
+} QueryTrace;
+
+// in front of the records in the trace buffer
+typedef struct queryTraceHeader {
+	uint32_t head; // records written since the last reset, the ring wraps at traceMax
+	uint32_t padding[3];
+} QueryTraceHeader;
+
+// dump file: QueryTraceFileHeader followed by record_count QueryTraceRecords, lod selections are left out
+#define QUERY_TRACE_MAGIC 0x43525451 // "QTRC"
+#define QUERY_TRACE_VERSION 1
+
+typedef struct queryTraceFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_count;
+	uint32_t overwritten; // records lost because the ring wrapped
+	uint32_t width; // of the traced frame
+	uint32_t height;
+	uint32_t node_count; // of the scene, the node indices are the ones of the .vksc
+	uint32_t padding;
+} QueryTraceFileHeader;
+
+typedef struct queryTraceRecord {
+	uint32_t pixel; // x | y << 16
+	uint32_t node;
+	float t;
+	uint32_t triangle_candidates;
+	uint32_t instance_hits;
+	uint16_t sequence;
+	int16_t level;
+} QueryTraceRecord;
+
+void create_trace_buffer(VkInfo* info, Scene* scene);
+void destroy_trace_buffer(VkInfo* info);
+
+// before drawFrame, clears the ring if a capture was requested
+void begin_query_trace(VkInfo* info, Scene* scene);
+// after drawFrame, copies the recorded frame and writes the dump once the copy is done
+void compile_query_trace(VkInfo* info, Scene* scene);
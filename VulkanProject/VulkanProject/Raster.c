@@ -4,6 +4,7 @@
 #include <string.h>
 #include <vulkan/vulkan_core.h>
 
+#include "Allocator.h"
 #include "Util.h"
 #include "VulkanUtil.h"
 uint32_t vertex_count = 3;
@@ -66,21 +67,9 @@ void create_vertex_buffer(VkInfo* vk)
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	check(vkCreateBuffer(vk->device, &bufferInfo, NULL, &vk->vertexBuffer),"Failed to create vertex buffer");
 
-	VkMemoryRequirements memRequirements;
-	vkGetBufferMemoryRequirements(vk->device, vk->vertexBuffer, &memRequirements);
+	allocate_buffer_memory(vk, vk->vertexBuffer, bufferInfo.usage,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vk->vertexBufferMemory);
 
-	VkMemoryAllocateInfo allocInfo = {0};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(vk, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	check(vkAllocateMemory(vk->device, &allocInfo, NULL, &vk->vertexBufferMemory),"Failed to allocate vertex memory");
-
-	check(vkBindBufferMemory(vk->device, vk->vertexBuffer, vk->vertexBufferMemory, 0), "");
-
-	void* data;
-	check(vkMapMemory(vk->device, vk->vertexBufferMemory, 0, bufferInfo.size, 0, &data), "");
-	memcpy(data, vertices, bufferInfo.size);
-	vkUnmapMemory(vk->device, vk->vertexBufferMemory);
+	memcpy(mapBuffer(vk, vk->vertexBuffer), vertices, bufferInfo.size);
 }
 
@@ -1,15 +1,20 @@
-#include "Raytrace.h"
+﻿#include "Raytrace.h"
 
 #include <float.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "Bindings.h"
+#include "NodeProfile.h"
+#include "Platform.h"
+#include "Profiler.h"
+#include "QueryTrace.h"
 #include "VulkanUtil.h"
 #include "Util.h"
 #include <vulkan/vulkan_core.h>
 // credits to christoph peters for the general structure of AS construction and for this useful macro
 // see https://github.com/MomentsInGraphics/vulkan_renderer, this macro creates a function pointer for dynamic function handles of vulkan
-#define VK_LOAD(FUNCTION_NAME) PFN_##FUNCTION_NAME p##FUNCTION_NAME = (PFN_##FUNCTION_NAME) glfwGetInstanceProcAddress(info->instance, #FUNCTION_NAME)
+#define VK_LOAD(FUNCTION_NAME) PFN_##FUNCTION_NAME p##FUNCTION_NAME = (PFN_##FUNCTION_NAME) vkGetInstanceProcAddr(info->instance, #FUNCTION_NAME)
 
 void build_all_acceleration_structures(VkInfo* info, Scene* scene)
 {
@@ -18,6 +23,8 @@ void build_all_acceleration_structures(VkInfo* info, Scene* scene)
 	memset(scene->acceleration_structures, 0, sizeof(AccelerationStructure) * scene->scene_data.numSceneNodes);
 	scene->TLASs = malloc(sizeof(VkAccelerationStructureKHR) * scene->scene_data.numSceneNodes);
 	scene->numTLAS = 0;
+	info->profiler.build_ms = 0;
+	info->profiler.builds = 0;
 	GET_ROOT(scene);
 	build_node_acceleration_structure(info, scene, root);
 }
@@ -97,8 +104,7 @@ void build_tlas_instance_list(VkInfo* info, Scene* scene, SceneNode* list)
 		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &stagingBuffer, &stagingMemory);
 
-	check(vkMapMemory(info->device, stagingMemory, 0, sizeof(VkAccelerationStructureInstanceKHR) * instance_count, 0,
-		(void**)&staging_data), "");
+	staging_data = mapBuffer(info, stagingBuffer);
 
 	uint32_t index = 0;
 	for (uint32_t c = 0; c < node->NumChildren; c++)
@@ -209,6 +215,7 @@ void build_tlas_instance_list(VkInfo* info, Scene* scene, SceneNode* list)
 	build_info.scratchData.deviceAddress = vkGetBufferDeviceAddress(info->device, &scratch_adress_info);
 	build_info.dstAccelerationStructure = structure;
 	const VkAccelerationStructureBuildRangeInfoKHR* build_range = &build_ranges[0];
+	profile_build_begin(info, cmd);
 	pvkCmdBuildAccelerationStructuresKHR(cmd, 1, &build_info, &build_range);
 	// Enforce synchronization
 	VkMemoryBarrier after_build_barrier = {
@@ -221,12 +228,12 @@ void build_tlas_instance_list(VkInfo* info, Scene* scene, SceneNode* list)
 		1, &after_build_barrier, 0, NULL, 0, NULL);
 	// Submit the command buffer
 
+	profile_build_end(info, cmd);
 	endSingleTimeCommands(info, cmd);
+	profile_build_collect(info);
 
-	vkDestroyBuffer(info->device, stagingBuffer, NULL);
-	vkDestroyBuffer(info->device, scratchBuffer, NULL);
-	vkFreeMemory(info->device, stagingMemory, NULL);
-	vkFreeMemory(info->device, scratchMemory, NULL);
+	destroyBuffer(info, stagingBuffer);
+	destroyBuffer(info, scratchBuffer);
 
 	AccelerationStructure acceleration_structure = {
 		.structure = structure,
@@ -264,8 +271,7 @@ void build_tlas(VkInfo* info, Scene* scene, SceneNode* node)
 				 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 				 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &stagingBuffer, &stagingMemory);
 
-	check(vkMapMemory(info->device, stagingMemory, 0, sizeof(VkAccelerationStructureInstanceKHR) * instance_count, 0,
-					  (void**) & staging_data), "");
+	staging_data = mapBuffer(info, stagingBuffer);
 
 	// now build the instance geometry
 
@@ -371,6 +377,7 @@ void build_tlas(VkInfo* info, Scene* scene, SceneNode* node)
 	build_info.scratchData.deviceAddress = vkGetBufferDeviceAddress(info->device, &scratch_adress_info);
 	build_info.dstAccelerationStructure = structure;
 	const VkAccelerationStructureBuildRangeInfoKHR* build_range = &build_ranges[0];
+	profile_build_begin(info, cmd);
 	pvkCmdBuildAccelerationStructuresKHR(cmd, 1, &build_info, &build_range);
 	// Enforce synchronization
 	VkMemoryBarrier after_build_barrier = {
@@ -383,12 +390,12 @@ void build_tlas(VkInfo* info, Scene* scene, SceneNode* node)
 		1, &after_build_barrier, 0, NULL, 0, NULL);
 	// Submit the command buffer
 
+	profile_build_end(info, cmd);
 	endSingleTimeCommands(info, cmd);
+	profile_build_collect(info);
 
-	vkDestroyBuffer(info->device, stagingBuffer, NULL);
-	vkDestroyBuffer(info->device, scratchBuffer, NULL);
-	vkFreeMemory(info->device, stagingMemory, NULL);
-	vkFreeMemory(info->device, scratchMemory, NULL);
+	destroyBuffer(info, stagingBuffer);
+	destroyBuffer(info, scratchBuffer);
 
 	AccelerationStructure acceleration_structure = {
 		.structure = structure,
@@ -433,8 +440,7 @@ void build_blas_instance_list(VkInfo* info, Scene* scene, SceneNode* list)
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &aabbBuffer, &aabbMemory);
-		check(vkMapMemory(info->device, aabbMemory, 0, sizeof(VkAabbPositionsKHR) * node->NumChildren, 0,
-			(void**)&aabbData), "error Mapping memory");
+		aabbData = mapBuffer(info, aabbBuffer);
 
 		for (int32_t i = 0; i < node->NumChildren; i++)
 		{
@@ -536,6 +542,7 @@ void build_blas_instance_list(VkInfo* info, Scene* scene, SceneNode* list)
 	bottom_build_info.scratchData.deviceAddress = vkGetBufferDeviceAddress(info->device, &scratch_adress_info);
 	bottom_build_info.dstAccelerationStructure = structure;
 	const VkAccelerationStructureBuildRangeInfoKHR* build_range = &build_ranges[0];
+	profile_build_begin(info, cmd);
 	pvkCmdBuildAccelerationStructuresKHR(cmd, 1, &bottom_build_info, &build_range);
 	// Enforce synchronization
 	VkMemoryBarrier after_build_barrier = {
@@ -549,12 +556,12 @@ void build_blas_instance_list(VkInfo* info, Scene* scene, SceneNode* list)
 		VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
 		1, &after_build_barrier, 0, NULL, 0, NULL);
 
+	profile_build_end(info, cmd);
 	endSingleTimeCommands(info, cmd);
+	profile_build_collect(info);
 
-	vkDestroyBuffer(info->device, scratchBuffer, NULL);
-	vkDestroyBuffer(info->device, aabbBuffer, NULL);
-	vkFreeMemory(info->device, scratchBufferMemeory, NULL);
-	vkFreeMemory(info->device, aabbMemory, NULL);
+	destroyBuffer(info, scratchBuffer);
+	destroyBuffer(info, aabbBuffer);
 
 
 	AccelerationStructure acceleration_structure = {
@@ -598,8 +605,7 @@ void build_blas(VkInfo* info, Scene* scene, SceneNode* node)
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &aabbBuffer, &aabbMemory);
-		check(vkMapMemory(info->device, aabbMemory, 0, sizeof(VkAabbPositionsKHR) * node->NumChildren, 0,
-			(void**) & aabbData), "error Mapping memory");
+		aabbData = mapBuffer(info, aabbBuffer);
 
 		for (int32_t i = 0; i < node->NumChildren; i++)
 		{
@@ -654,8 +660,7 @@ void build_blas(VkInfo* info, Scene* scene, SceneNode* node)
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &indexStage, &indexStageMemeory);
-		check(vkMapMemory(info->device, indexStageMemeory, 0, sizeof(uint32_t) * node->NumTriangles * 3, 0,
-			&index_data), "error Mapping memory");
+		index_data = mapBuffer(info, indexStage);
 
 		uint32_t maxIndex = 0; // the maximum index used in the indexBuffer for this mesh
 		uint32_t minIndex = UINT32_MAX; // the minimum index used in the indexBuffer for this mesh.
@@ -682,8 +687,7 @@ void build_blas(VkInfo* info, Scene* scene, SceneNode* node)
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexStage, &vertexStageMemeory);
-		check(vkMapMemory(info->device, vertexStageMemeory, 0, numVertices * sizeof(float) * 3, 0,
-			&vertex_data), "failed to map memory");
+		vertex_data = mapBuffer(info, vertexStage);
 		float* vertices = vertex_data;
 		for (uint32_t i = 0; i != numVertices; ++i)
 		{
@@ -702,8 +706,7 @@ void build_blas(VkInfo* info, Scene* scene, SceneNode* node)
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexStage, &vertexStageMemeory);
-		check(vkMapMemory(info->device, vertexStageMemeory, 0, node->NumTriangles * sizeof(float) * 3, 0,
-			&vertex_data), "error Mapping memeory");
+		vertex_data = mapBuffer(info, vertexStage);
 
 		float* vertices = vertex_data;
 		for (uint32_t i = 0; i != node->NumTriangles * 3 * 3; i += 3)
@@ -806,6 +809,7 @@ void build_blas(VkInfo* info, Scene* scene, SceneNode* node)
 		bottom_build_info.scratchData.deviceAddress = vkGetBufferDeviceAddress(info->device, &scratch_adress_info);
 		bottom_build_info.dstAccelerationStructure = structure;
 		const VkAccelerationStructureBuildRangeInfoKHR* build_range = &build_ranges[0];
+		profile_build_begin(info, cmd);
 		pvkCmdBuildAccelerationStructuresKHR(cmd, 1, &bottom_build_info, &build_range);
 		// Enforce synchronization
 		VkMemoryBarrier after_build_barrier = {
@@ -819,16 +823,14 @@ void build_blas(VkInfo* info, Scene* scene, SceneNode* node)
 			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
 			1, &after_build_barrier, 0, NULL, 0, NULL);
 
+		profile_build_end(info, cmd);
 		endSingleTimeCommands(info, cmd);
+		profile_build_collect(info);
 
-		vkDestroyBuffer(info->device, vertexStage, NULL);
-		vkDestroyBuffer(info->device, indexStage, NULL);
-		vkDestroyBuffer(info->device, scratchBuffer, NULL);
-		vkDestroyBuffer(info->device, aabbBuffer, NULL);
-		vkFreeMemory(info->device, vertexStageMemeory, NULL);
-		vkFreeMemory(info->device, indexStageMemeory, NULL);
-		vkFreeMemory(info->device, scratchBufferMemeory, NULL);
-		vkFreeMemory(info->device, aabbMemory, NULL);
+		destroyBuffer(info, vertexStage);
+		destroyBuffer(info, indexStage);
+		destroyBuffer(info, scratchBuffer);
+		destroyBuffer(info, aabbBuffer);
 
 
 		AccelerationStructure acceleration_structure = {
@@ -846,20 +848,23 @@ void create_ray_descriptors(VkInfo* info, Scene* scene, uint32_t tlassBinding, u
 		.binding = tlassBinding,
 		.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
 		.descriptorCount = scene->numTLAS,
-		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+		.stageFlags = RAY_SHADER_STAGES
 	};
 	VkDescriptorSetLayoutBinding trace_binding = {
 		.binding = traceBinding,
 		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 		.descriptorCount = 1,
-		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+		.stageFlags = RAY_SHADER_STAGES
 	};
 
-	VkDescriptorSetLayoutBinding bindings[] = { tlas_binding, trace_binding };
+	VkDescriptorSetLayoutBinding node_cost_binding = trace_binding;
+	node_cost_binding.binding = NODE_COST_BINDING;
+
+	VkDescriptorSetLayoutBinding bindings[] = { tlas_binding, trace_binding, node_cost_binding };
 
 	VkDescriptorSetLayoutCreateInfo layout_create_info = { 0 };
 	layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layout_create_info.bindingCount = 2;
+	layout_create_info.bindingCount = 3;
 	layout_create_info.pBindings = bindings;
 
 	check(vkCreateDescriptorSetLayout(info->device, &layout_create_info, NULL, &info->ray_descriptor.set_layout), "");
@@ -867,27 +872,6 @@ void create_ray_descriptors(VkInfo* info, Scene* scene, uint32_t tlassBinding, u
 	info->ray_descriptor.traceBinding = traceBinding;
 }
 
-void create_trace_buffer(VkInfo* info, Scene* scene) {
-	createBuffer(info,
-		scene->camera.settings.traceMax * sizeof(QueryTrace),
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		&info->ray_descriptor.traceBuffer,
-		&info->ray_descriptor.traceMemory);
-
-	QueryTrace* init = malloc(sizeof(QueryTrace) * scene->camera.settings.traceMax);
-	memset(init, 0, sizeof(QueryTrace) * scene->camera.settings.traceMax);
-	QueryTrace* data;
-	check(vkMapMemory(info->device, info->ray_descriptor.traceMemory,
-		0, sizeof(SceneData), 0, &data), "");
-	memcpy(data, init, sizeof(QueryTrace) * scene->camera.settings.traceMax);
-	vkUnmapMemory(info->device, info->ray_descriptor.traceMemory);
-
-	free(init);
-}
-
-
 void init_ray_descriptors(VkInfo* info, Scene* scene)
 {
 	VkDescriptorSetAllocateInfo allocInfo = { 0 };
@@ -917,7 +901,7 @@ void init_ray_descriptors(VkInfo* info, Scene* scene)
 	VkDescriptorBufferInfo bufferInfo = { 0 };
 	bufferInfo.buffer = info->ray_descriptor.traceBuffer;
 	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(QueryTrace) * scene->camera.settings.traceMax;
+	bufferInfo.range = VK_WHOLE_SIZE;
 
 	VkWriteDescriptorSet descriptorWrite = { 0 };
 	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -928,10 +912,15 @@ void init_ray_descriptors(VkInfo* info, Scene* scene)
 	descriptorWrite.descriptorCount = 1;
 	descriptorWrite.pBufferInfo = &bufferInfo;
 
-	VkWriteDescriptorSet writes[] = { write, descriptorWrite };
+	VkDescriptorBufferInfo nodeCostInfo = { .buffer = info->node_profile.buffer, .range = VK_WHOLE_SIZE };
+	VkWriteDescriptorSet nodeCostWrite = descriptorWrite;
+	nodeCostWrite.dstBinding = NODE_COST_BINDING;
+	nodeCostWrite.pBufferInfo = &nodeCostInfo;
 
+	VkWriteDescriptorSet writes[] = { write, descriptorWrite, nodeCostWrite };
 
-	vkUpdateDescriptorSets(info->device, 2, writes, 0, NULL);
+
+	vkUpdateDescriptorSets(info->device, 3, writes, 0, NULL);
 
 
 }
@@ -943,8 +932,7 @@ void destroyAccelerationStructures(VkInfo* info, Scene* scene) {
 		AccelerationStructure node = scene->acceleration_structures[i];
 		if (node.structure != NULL) {
 			pvkDestroyAccelerationStructureKHR(info->device, node.structure, NULL);
-			vkDestroyBuffer(info->device, node.buffer, NULL);
-			vkFreeMemory(info->device, node.memory, NULL);
+			destroyBuffer(info, node.buffer);
 		}
 	}
 	scene->numTLAS = 0;
@@ -953,32 +941,8 @@ void destroyAccelerationStructures(VkInfo* info, Scene* scene) {
 	scene->TLASs = NULL;
 	scene->acceleration_structures = NULL;
 
-	vkFreeMemory(info->device, info->ray_descriptor.traceMemory, NULL);
-	vkDestroyBuffer(info->device, info->ray_descriptor.traceBuffer, NULL);
+	destroy_trace_buffer(info);
+	destroy_node_profile(info);
 
 	vkDestroyDescriptorSetLayout(info->device, info->ray_descriptor.set_layout, NULL);
-}
-
-void compile_query_trace(VkInfo* info, Scene* scene)
-{
-	if (scene->camera.settings.recordQueryTrace == 0) return;
-
-	QueryTrace* traces;
-	vkMapMemory(info->device, info->ray_descriptor.traceMemory, 0, sizeof(QueryTrace) * scene->camera.settings.traceMax, 0, (void**)&traces);
-	printf("Traces:\n");
-	for (uint32_t i = 0; i < scene->camera.settings.traceMax; i++)
-	{
-		QueryTrace t = traces[i];
-		SceneNode node = scene->scene_nodes[t.nodeNumber];
-		if(t.triangleIntersections == 123)
-		{
-			int a = 0;
-			printf("Level:%d\n", t.nodeLevel);
-		}
-		printf("L:%d -> T:%f, I:%d/%d\n", t.nodeLevel, t.t, t.triangleIntersections, t.instanceIntersections);
-		if (t.isValid == 0)
-			break;
-	}
-	vkUnmapMemory(info->device, info->ray_descriptor.traceMemory);
-	scene->camera.settings.recordQueryTrace = 0;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+﻿#include "RenderScale.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "VulkanStructs.h"
+
+#define RENDER_SCALE_SMOOTHING 0.2f
+
+void measure_render_scale(VkInfo* vk, uint32_t image_index)
+{
+	RenderScale* rs = &vk->render_scale;
+	if (!vk->profiler.frame_pool || image_index >= RENDER_SCALE_MAX_IMAGES) return;
+	if (vk->temporal.reused[image_index]) return; // only blitted, nothing was traced
+	uint32_t pixels = rs->recorded[image_index].width * rs->recorded[image_index].height;
+	if (pixels == 0) return;
+
+	// the ray pass grows about linearly with the traced pixels, so frames at different scales can be compared
+	float ns = vk->profiler.pass_ms[PROFILE_PASS_RAY] * 1000000.0f / (float)pixels;
+	if (rs->ns_per_pixel > 0)
+		rs->ns_per_pixel += (ns - rs->ns_per_pixel) * RENDER_SCALE_SMOOTHING;
+	else
+		rs->ns_per_pixel = ns;
+}
+
+void update_render_scale(VkInfo* vk, const Scene* scene, uint32_t image_index)
+{
+	RenderScale* rs = &vk->render_scale;
+	const Camera* c = &scene->camera;
+	float pose[5] = { c->pos[0], c->pos[1], c->pos[2], c->rotation_x, c->rotation_y };
+	if (memcmp(pose, rs->camera, sizeof(pose)) != 0)
+		rs->still_frames = 0;
+	else if (rs->still_frames < RENDER_SCALE_SETTLE_FRAMES)
+		rs->still_frames++;
+	memcpy(rs->camera, pose, sizeof(pose));
+
+	if (rs->enabled && rs->ns_per_pixel > 0 && rs->target_ms > 0)
+	{
+		// the scale that would have hit the budget, it applies to both sides
+		float full = (float)vk->swapchain.extent.width * (float)vk->swapchain.extent.height;
+		float wanted = sqrtf(rs->target_ms * 1000000.0f / (rs->ns_per_pixel * full));
+		if (wanted > 1.0f) wanted = 1.0f;
+		if (wanted < rs->min_scale) wanted = rs->min_scale;
+		// a bit more than half a step off before it moves, otherwise it flips between two steps every few frames
+		if (fabsf(wanted - rs->scale) > RENDER_SCALE_STEP * 0.75f)
+			rs->scale = roundf(wanted / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+		if (rs->scale > 1.0f) rs->scale = 1.0f;
+		if (rs->scale < rs->min_scale) rs->scale = rs->min_scale;
+	}
+
+	if (!vk->command_buffers || image_index >= RENDER_SCALE_MAX_IMAGES) return;
+	VkExtent2D extent = render_scale_extent(vk);
+	if (extent.width != rs->recorded[image_index].width || extent.height != rs->recorded[image_index].height)
+		record_command_buffer(vk, image_index); // only this image, the others change when they come around
+}
+
+VkExtent2D render_scale_extent(VkInfo* vk)
+{
+	RenderScale* rs = &vk->render_scale;
+	VkExtent2D extent = vk->swapchain.extent;
+	VkBool32 compute = vk->compute_pipeline &&
+		(vk->dispatch_mode == RAY_DISPATCH_COMPUTE || vk->dispatch_mode == RAY_DISPATCH_DEFERRED);
+	if (!rs->enabled || !compute || rs->still_frames >= RENDER_SCALE_SETTLE_FRAMES || rs->scale >= 1.0f)
+		return extent;
+
+	extent.width = (uint32_t)(extent.width * rs->scale + 0.5f);
+	extent.height = (uint32_t)(extent.height * rs->scale + 0.5f);
+	if (extent.width < 1) extent.width = 1;
+	if (extent.height < 1) extent.height = 1;
+	return extent;
+}
+
+VkExtent2D traced_extent(VkInfo* vk, uint32_t image_index)
+{
+	if (image_index >= RENDER_SCALE_MAX_IMAGES || vk->render_scale.recorded[image_index].width == 0)
+		return vk->swapchain.extent;
+	return vk->render_scale.recorded[image_index];
+}
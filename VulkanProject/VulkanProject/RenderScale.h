@@ -0,0 +1,13 @@
+﻿#pragma once
+#include "Globals.h"
+
+// dynamic resolution of the compute and deferred paths. they trace into the top left corner of the compute target
+// and the blit stretches it over the swapchain. the scale follows the gpu time of the ray pass of earlier frames,
+// once the camera stops the frame is traced at full resolution again
+void measure_render_scale(VkInfo* vk, uint32_t image_index); // after the profiler has read the image's timestamps
+// picks the scale of the next frame and records the image's command buffer again if its extent changes,
+// the fence of the image has to be passed
+void update_render_scale(VkInfo* vk, const Scene* scene, uint32_t image_index);
+
+VkExtent2D render_scale_extent(VkInfo* vk); // for the next recording
+VkExtent2D traced_extent(VkInfo* vk, uint32_t image_index); // what the command buffer of the image was recorded with
@@ -8,6 +8,8 @@
 #include <math.h>
 
 #include "Globals.h"
+#include "LightTree.h"
+#include "Platform.h"
 void init_scene(Scene* scene)
 {
 	scene->camera.pos[0] = 0;
@@ -25,11 +27,37 @@ void init_scene(Scene* scene)
 	scene->camera.settings.reflection = 1;
 	scene->camera.settings.transmission = 1;
 	scene->camera.settings.maxDepth = 5;
-	scene->camera.settings.traceMax = 100;
+	scene->camera.settings.traceMax = 1 << 18;
+	scene->camera.settings.traceWidth = 1;
+	scene->camera.settings.traceHeight = 1;
+	scene->camera.settings.traceStride = 1;
+	scene->camera.settings.rateNormal = 0.95f;
+	scene->camera.settings.rateDepth = 0.05f;
+	scene->camera.settings.minContribution = 0.01f;
+	scene->camera.settings.lightSamples = 4;
 	scene->camera.settings.pixelX = WINDOW_WIDTH/2;
 	scene->camera.settings.pixelY = WINDOW_HEIGHT/2;
 }
 
+// same as inv in math.frag: the inverse of the 3x3 part and the translation moved back through it
+static void invert_transform(const Mat4x3* transform, Mat4x3* inverse)
+{
+	const float (*m)[4] = transform->mat;
+	float cofactor[3][3] = {
+		{ m[1][1] * m[2][2] - m[1][2] * m[2][1], m[0][2] * m[2][1] - m[0][1] * m[2][2], m[0][1] * m[1][2] - m[0][2] * m[1][1] },
+		{ m[1][2] * m[2][0] - m[1][0] * m[2][2], m[0][0] * m[2][2] - m[0][2] * m[2][0], m[0][2] * m[1][0] - m[0][0] * m[1][2] },
+		{ m[1][0] * m[2][1] - m[1][1] * m[2][0], m[0][1] * m[2][0] - m[0][0] * m[2][1], m[0][0] * m[1][1] - m[0][1] * m[1][0] }
+	};
+	float det = m[0][0] * cofactor[0][0] + m[0][1] * cofactor[1][0] + m[0][2] * cofactor[2][0];
+	float inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+	for (int r = 0; r < 3; r++)
+	{
+		for (int c = 0; c < 3; c++)
+			inverse->mat[r][c] = cofactor[r][c] * inv_det;
+		inverse->mat[r][3] = -(inverse->mat[r][0] * m[0][3] + inverse->mat[r][1] * m[1][3] + inverse->mat[r][2] * m[2][3]);
+	}
+}
+
 void load_scene(Scene* scene, char* path)
 {
 	//int vert = system("buildScene.bat");
@@ -71,6 +99,10 @@ void load_scene(Scene* scene, char* path)
 	fread(&scene->scene_data.numTransforms, sizeof(uint32_t), 1, file);
 	scene->node_transforms = malloc(sizeof(Mat4x3) * scene->scene_data.numTransforms);
 	fread(scene->node_transforms, sizeof(Mat4x3), scene->scene_data.numTransforms, file);
+	// the traversal only ever needs the inverses, so they are computed once here instead of on every load
+	scene->inverse_transforms = malloc(sizeof(Mat4x3) * scene->scene_data.numTransforms);
+	for (uint32_t i = 0; i < scene->scene_data.numTransforms; i++)
+		invert_transform(&scene->node_transforms[i], &scene->inverse_transforms[i]);
 
 	//free(buffer);
 	// SceneNode children
@@ -92,6 +124,7 @@ void load_scene(Scene* scene, char* path)
 	};
 	//scene->lights[0] = light1;
 	scene->lights[0] = light1;
+	build_light_tree(scene);
 	load_textures(&scene->texture_data, file);
 	fclose(file);
 
@@ -156,8 +189,10 @@ void destroy_scene(Scene* scene)
 	free(scene->vertices);
 	free(scene->scene_nodes);
 	free(scene->node_transforms);
+	free(scene->inverse_transforms);
 	free(scene->texture_data.materials);
 	free(scene->lights);
+	free(scene->light_nodes);
 	for (uint32_t i = 0; i < scene->texture_data.num_textures; i++)
 	{
 		free(scene->texture_data.textures[i].pixel_data);
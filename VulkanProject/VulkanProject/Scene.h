@@ -81,6 +81,16 @@ typedef struct light // 64 bytes
 					// if there is any object along the fragPos + minDst*direction line
 } Light;
 
+typedef struct lightNode // 48 bytes, see LightTree.c
+{
+	float aabb_min[3]; // of the light positions
+	int32_t child; // inner node: the first of its two children, leaf: -1 - index of the light
+	float aabb_max[3];
+	float max_dst; // the farthest any light below reaches
+	float power[3]; // falloff terms of the lights below that are on, weighted with the luminance of their intensity
+	float pad;
+} LightNode;
+
 typedef struct sceneData
 {
 	uint32_t numVertices;
@@ -90,8 +100,15 @@ typedef struct sceneData
 	uint32_t numNodeIndices;
 	uint32_t numLights;
 	uint32_t rootSceneNode;
+	uint32_t numLightNodes;
+	uint32_t numEnabledLights; // lights that are on, written by refit_light_tree
 } SceneData;
 
+// rates of the rays spawned by the primary hit, a pixel at a reduced rate borrows them from its neighbour
+#define RAY_RATE_FULL 0
+#define RAY_RATE_CHECKER 1 // every other pixel
+#define RAY_RATE_ADAPTIVE 2 // every other pixel where both hit about the same surface
+
 typedef struct renderSettings {
 	float fov; // Field of view [0,90)
 	VkBool32 textures;
@@ -130,7 +147,28 @@ typedef struct renderSettings {
 	VkBool32 recordQueryTrace;
 	uint32_t pixelX;
 	uint32_t pixelY;
-	uint32_t traceMax;
+	uint32_t traceMax; // records in the ring, older records are overwritten
+	uint32_t traceWidth; // region starting at pixelX/pixelY that is recorded
+	uint32_t traceHeight;
+	uint32_t traceStride; // only every traceStride-th pixel of the region in both directions
+
+	// RAY RATES
+	uint32_t secondaryRate; // RAY_RATE_* of the reflection and transmission rays
+	uint32_t shadowRate; // RAY_RATE_* of the shadow rays
+	float rateNormal; // adaptive rate: min cosine between the normals of the two pixels
+	float rateDepth; // adaptive rate: max difference of the hit distances relative to the distance
+
+	// PRUNING
+	float minContribution; // reflection and transmission rays below this share of the pixel are not traced
+	VkBool32 russianRoulette; // pruned rays survive with contribution / minContribution and carry minContribution
+
+	// LOD POLICY
+	int32_t shadowLodBias; // levels added to the lod of the shaded surface for its shadow rays
+	int32_t secondaryLodBias; // levels added to the cone based selection of reflection and transmission rays
+
+	// LIGHT SAMPLING
+	uint32_t lightSamples; // lights picked from the light tree per shading point, 0 or at least numEnabledLights traces every light
+	uint32_t pad[3];
 } RenderSettings;
 
 typedef struct camera
@@ -146,6 +184,10 @@ typedef struct frameData {
 	uint32_t width;
 	uint32_t height;
 	RenderSettings settings;
+	VkBool32 collectStats; // fills the FrameStats of the image, only while the profiler captures
+	VkBool32 collectNodeCosts; // adds to the node profile, only while a benchmark measures
+	float previous_view_to_world[4][4]; // camera of the history buffer, at offset 272 as std140 wants a mat4 on 16 bytes
+	VkBool32 reuseHistory; // the deferred mode may reproject the previous primary hits
 } FrameData;
 
 typedef struct material
@@ -167,6 +209,7 @@ typedef struct texture
 	uint32_t image_size;
 	uint32_t image_width;
 	uint32_t image_height;
+	uint32_t mip_levels; // set when the image is created, 1 if the format can't be blitted
 	uint32_t* pixel_data;
 	VkImage texture_image;
 	VkImageView texture_image_view;
@@ -195,11 +238,13 @@ typedef struct scene
 
 	SceneNode* scene_nodes;
 	Mat4x3* node_transforms;
+	Mat4x3* inverse_transforms; // of node_transforms, inverted once in load_scene
 	uint32_t* node_indices;
 
 	AccelerationStructure* acceleration_structures; // 1-1 with sceneNodes
 
 	Light* lights;
+	LightNode* light_nodes;
 
 	uint32_t numTLAS;
 	VkAccelerationStructureKHR* TLASs;
@@ -0,0 +1,85 @@
+﻿#include "SceneBuffers.h"
+
+#include <string.h>
+
+#include "Bindings.h"
+#include "Util.h"
+#include "VulkanUtil.h"
+
+// the traversal reads vertices, indices and nodes through buffer device addresses instead of one descriptor per array.
+// that way a single array can be larger than maxStorageBufferRange (and 4GB), it is spread over up to
+// MAX_SCENE_CHUNKS buffers. the chunk size is a power of two in elements so the shader only shifts and masks
+
+static uint32_t chunk_shift(size_t stride)
+{
+	uint32_t shift = 0;
+	while (((size_t)2 << shift) * stride <= SCENE_CHUNK_SIZE)
+		shift++;
+	return shift;
+}
+
+static void upload_chunked(VkInfo* vk, ChunkedBuffer* chunked, ChunkAddress* addresses, const void* data, size_t count, size_t stride)
+{
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	VkMemoryPropertyFlags memory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	if (!vk->unified_memory) {
+		usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		memory = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	}
+
+	chunked->chunk_shift = chunk_shift(stride);
+	size_t per_chunk = (size_t)1 << chunked->chunk_shift;
+	chunked->chunk_count = (uint32_t)((count + per_chunk - 1) / per_chunk);
+	if (chunked->chunk_count > MAX_SCENE_CHUNKS) error("scene is too large for MAX_SCENE_CHUNKS");
+
+	for (uint32_t i = 0; i < chunked->chunk_count; i++)
+	{
+		size_t first = i * per_chunk;
+		size_t elements = count - first < per_chunk ? count - first : per_chunk;
+		VkDeviceSize size = elements * stride;
+
+		Buffer* chunk = &chunked->chunks[i];
+		createBuffer(vk, size, usage, memory, &chunk->vk_buffer, &chunk->vk_buffer_memory);
+		chunk->buffer_size = size;
+		chunk->usage = usage;
+		chunk->properties = memory;
+		uploadBuffer(vk, chunk, (const char*)data + first * stride, size);
+
+		addresses[i].address = getBufferDeviceAddress(vk, chunk->vk_buffer);
+	}
+}
+
+void upload_scene_geometry(VkInfo* vk, Scene* scene)
+{
+	destroy_scene_geometry(vk);
+	SceneGeometry* geometry = &vk->scene_geometry;
+
+	ScenePointers pointers = { 0 };
+	upload_chunked(vk, &geometry->vertices, pointers.vertex_chunks, scene->vertices,
+		scene->scene_data.numVertices, sizeof(Vertex));
+	upload_chunked(vk, &geometry->triangles, pointers.triangle_chunks, scene->indices,
+		scene->scene_data.numTriangles, sizeof(uint32_t) * 3);
+	upload_chunked(vk, &geometry->nodes, pointers.node_chunks, scene->scene_nodes,
+		scene->scene_data.numSceneNodes, sizeof(SceneNode));
+	pointers.vertex_chunk_shift = geometry->vertices.chunk_shift;
+	pointers.triangle_chunk_shift = geometry->triangles.chunk_shift;
+	pointers.node_chunk_shift = geometry->nodes.chunk_shift;
+
+	uploadBuffer(vk, &GET_SCENE_POINTER_BUFFER(vk), &pointers, sizeof(ScenePointers));
+}
+
+static void destroy_chunked(VkInfo* vk, ChunkedBuffer* chunked)
+{
+	for (uint32_t i = 0; i < chunked->chunk_count; i++)
+	{
+		destroyBuffer(vk, chunked->chunks[i].vk_buffer);
+	}
+	memset(chunked, 0, sizeof(ChunkedBuffer));
+}
+
+void destroy_scene_geometry(VkInfo* vk)
+{
+	destroy_chunked(vk, &vk->scene_geometry.vertices);
+	destroy_chunked(vk, &vk->scene_geometry.triangles);
+	destroy_chunked(vk, &vk->scene_geometry.nodes);
+}
@@ -0,0 +1,23 @@
+﻿#pragma once
+#include "Globals.h"
+#include "Scene.h"
+
+// mirrors the ScenePointers uniform in structs.frag (std140, so every address takes 16 bytes)
+typedef struct chunkAddress {
+	VkDeviceAddress address;
+	uint64_t pad;
+} ChunkAddress;
+
+typedef struct scenePointers {
+	uint32_t vertex_chunk_shift;
+	uint32_t triangle_chunk_shift;
+	uint32_t node_chunk_shift;
+	uint32_t pad;
+	ChunkAddress vertex_chunks[MAX_SCENE_CHUNKS];
+	ChunkAddress triangle_chunks[MAX_SCENE_CHUNKS];
+	ChunkAddress node_chunks[MAX_SCENE_CHUNKS];
+} ScenePointers;
+
+// splits vertices, indices and nodes into chunks, uploads them and writes their addresses to the scene pointer uniform
+void upload_scene_geometry(VkInfo* vk, Scene* scene);
+void destroy_scene_geometry(VkInfo* vk);
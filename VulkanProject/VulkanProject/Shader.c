@@ -2,35 +2,168 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #define _USE_MATH_DEFINES // for C
 
 #include "Descriptors.h"
 #include "Globals.h"
+#include "Platform.h"
 #include "Util.h"
 #include "Scene.h"
 #include "Textures.h"
+#include "NodeProfile.h"
+#include "QueryTrace.h"
 #include "Raytrace.h"
+#include "Presentation.h"
 #include "Bindings.h"
+#include "VulkanUtil.h"
+#include "SceneBuffers.h"
 
-void compile_shaders(uint32_t opaqueCheck)
+// the spir-v normally comes from shaders/compile.bat before the build (or the same glslangValidator calls on linux), this is only the fallback and the reload button
+#define GLSLANG_FLAGS " -g --target-env vulkan1.2"
+static const char* vertex_command = GLSLANG_VALIDATOR " shaders/shader.vert -o shader.vert.spv" GLSLANG_FLAGS;
+static const char* vertex_binary = "shader.vert.spv";
+
+// the ray shaders are built once per combination of the subgroup features below, a device that lacks one
+// must not even create a module that declares its capability. bit i of a flavour leaves out feature i
+typedef struct rayShaderSource
+{
+	const char* source;
+	const char* binary; // without the flavour suffix and .spv
+} RayShaderSource;
+static const RayShaderSource ray_shaders[] = {
+	{ "shaders/shader.frag", "shader.frag" },
+	{ "shaders/raytrace.comp", "shader.comp" },
+	{ "shaders/wavefront.comp", "wavefront.comp" },
+	{ "shaders/visibility.comp", "visibility.comp" },
+};
+typedef struct shaderFeature
+{
+	const char* define;
+	const char* suffix;
+} ShaderFeature;
+static const ShaderFeature shader_features[] = {
+	{ "NO_SUBGROUP_ARITHMETIC", ".noarith" },
+	{ "NO_SUBGROUP_QUAD", ".noquad" },
+};
+#define RAY_SHADER_COUNT (sizeof(ray_shaders) / sizeof(ray_shaders[0]))
+#define SHADER_FEATURE_COUNT (sizeof(shader_features) / sizeof(shader_features[0]))
+#define SHADER_FLAVOURS (1u << SHADER_FEATURE_COUNT)
+
+static void flavour_binary(const char* binary, uint32_t flavour, char* path, size_t size)
+{
+	strcpy_s(path, size, binary);
+	for (uint32_t i = 0; i < SHADER_FEATURE_COUNT; i++)
+		if (flavour & (1u << i))
+			strcat_s(path, size, shader_features[i].suffix);
+	strcat_s(path, size, ".spv");
+}
+
+void ray_shader_binary(VkInfo* vk, const char* binary, char* path, size_t size)
+{
+	uint32_t flavour = 0;
+	if (!vk->subgroup_arithmetic) flavour |= 1u << 0;
+	if (!vk->subgroup_quad) flavour |= 1u << 1;
+	flavour_binary(binary, flavour, path, size);
+}
+
+void compile_shaders()
 {
 	printf("compiling shaders\n");
-	int vert = system("glslangValidator.exe shaders/shader.vert -o shader.vert.spv -g --target-env vulkan1.2");
-	int frag;
-	if (opaqueCheck) {
-		frag = system("glslangValidator.exe shaders/shader.frag -o shader.frag.spv -g --target-env vulkan1.2 -DOPAQUE_CHECK");
-	}
-	else {
-		frag = system("glslangValidator.exe shaders/shader.frag -o shader.frag.spv -g --target-env vulkan1.2");
+	int failed = system(vertex_command);
+	for (uint32_t i = 0; i < RAY_SHADER_COUNT; i++)
+	{
+		for (uint32_t flavour = 0; flavour < SHADER_FLAVOURS; flavour++)
+		{
+			char command[512];
+			sprintf_s(command, sizeof(command), GLSLANG_VALIDATOR " %s" GLSLANG_FLAGS, ray_shaders[i].source);
+			for (uint32_t f = 0; f < SHADER_FEATURE_COUNT; f++)
+			{
+				if (!(flavour & (1u << f))) continue;
+				strcat_s(command, sizeof(command), " -D");
+				strcat_s(command, sizeof(command), shader_features[f].define);
+			}
+			char binary[128];
+			flavour_binary(ray_shaders[i].binary, flavour, binary, sizeof(binary));
+			strcat_s(command, sizeof(command), " -o ");
+			strcat_s(command, sizeof(command), binary);
+			failed |= system(command);
+		}
 	}
-	
-	if (vert || frag)
+
+	if (failed)
 		error("Failed to compile shaders");
 }
+
+static uint32_t binary_exists(const char* path)
+{
+	FILE* file;
+	fopen_s(&file, path, "rb");
+	if (!file) return 0;
+	fclose(file);
+	return 1;
+}
+
+uint32_t shaders_compiled()
+{
+	if (!binary_exists(vertex_binary)) return 0;
+	for (uint32_t i = 0; i < RAY_SHADER_COUNT; i++)
+	{
+		for (uint32_t flavour = 0; flavour < SHADER_FLAVOURS; flavour++)
+		{
+			char binary[128];
+			flavour_binary(ray_shaders[i].binary, flavour, binary, sizeof(binary));
+			if (!binary_exists(binary)) return 0;
+		}
+	}
+	return 1;
+}
+
+// fnv-1a, continued over every file
+static uint64_t hash_binary(uint64_t hash, const char* path)
+{
+	FILE* file;
+	fopen_s(&file, path, "rb");
+	if (!file) return hash;
+	int c;
+	while ((c = fgetc(file)) != EOF)
+		hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+	fclose(file);
+	return hash;
+}
+
+uint64_t hash_shader_binaries()
+{
+	// over all binaries, the pipeline cache on disk is only reused for the same shaders
+	uint64_t hash = hash_binary(14695981039346656037ull, vertex_binary);
+	for (uint32_t i = 0; i < RAY_SHADER_COUNT; i++)
+	{
+		for (uint32_t flavour = 0; flavour < SHADER_FLAVOURS; flavour++)
+		{
+			char binary[128];
+			flavour_binary(ray_shaders[i].binary, flavour, binary, sizeof(binary));
+			hash = hash_binary(hash, binary);
+		}
+	}
+	return hash;
+}
+
+uint32_t append_variant_constants(const ShaderVariant* variant, uint32_t* data, VkSpecializationMapEntry* entries, uint32_t count)
+{
+	// the members of ShaderVariant are all 32 bit and in constant id order
+	memcpy(data + count, variant, sizeof(ShaderVariant));
+	for (uint32_t i = 0; i < SHADER_VARIANT_CONSTANTS; i++)
+	{
+		entries[count + i].constantID = SHADER_VARIANT_FIRST_ID + i;
+		entries[count + i].offset = (count + i) * sizeof(uint32_t);
+		entries[count + i].size = sizeof(uint32_t);
+	}
+	return count + SHADER_VARIANT_CONSTANTS;
+}
 void get_vertex_shader(VkInfo* vk_info, Shader* shader)
 {
 	FILE* file;
-	fopen_s(&file, "shader.vert.spv", "rb");
+	fopen_s(&file, vertex_binary, "rb");
 
 	if (!file)
 		error("Failed to open vertexshader");
@@ -53,8 +186,10 @@ void get_vertex_shader(VkInfo* vk_info, Shader* shader)
 }
 void get_fragment_shader(VkInfo* vk_info, Shader* shader)
 {
+	char path[128];
+	ray_shader_binary(vk_info, "shader.frag", path, sizeof(path));
 	FILE* file;
-	fopen_s(&file, "shader.frag.spv", "rb");
+	fopen_s(&file, path, "rb");
 
 	if (!file)
 		error("Failed to open fragment shader");
@@ -77,6 +212,32 @@ void get_fragment_shader(VkInfo* vk_info, Shader* shader)
 	check(vkCreateShaderModule(vk_info->device, &create_info, NULL, &shader->module), "");
 }
 
+void load_shader(VkInfo* vk_info, Shader* shader, const char* path)
+{
+	FILE* file;
+	fopen_s(&file, path, "rb");
+
+	if (!file)
+		error("Failed to open shader");
+
+	if (fseek(file, 0, SEEK_END) || (shader->size = ftell(file)) < 0) {
+		fclose(file);
+		error("Shader file size could not be determined");
+	}
+
+	shader->code = malloc(shader->size);
+	fseek(file, 0, SEEK_SET);
+	shader->size = fread(shader->code, sizeof(char), shader->size, file);
+	fclose(file);
+
+	VkShaderModuleCreateInfo create_info = { 0 };
+	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	create_info.codeSize = shader->size;
+	create_info.pCode = shader->code;
+
+	check(vkCreateShaderModule(vk_info->device, &create_info, NULL, &shader->module), "");
+}
+
 void create_descriptor_containers(VkInfo* info, Scene* scene)
 {
 	if (info->global_buffers.completed == 1 && info->global_buffers.completed)
@@ -85,65 +246,64 @@ void create_descriptor_containers(VkInfo* info, Scene* scene)
 	info->numSets = info->ray_tracing ? 4 : 3;
 	
 	// set 0 - global buffers
+	// vertices, indices and nodes are chunked and only their addresses are bound, see SceneBuffers.c
+	// the rest of the scene is read on every traversal step, so it lives in device local memory and is staged in set_global_buffers
+	// on unified memory that would only add a copy, there it stays host visible like before
+	VkBufferUsageFlags scene_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	VkMemoryPropertyFlags scene_memory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	if (!info->unified_memory) {
+		scene_usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		scene_memory = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	}
 	BufferInfo* globalInfos = malloc(sizeof(BufferInfo) * GLOBAL_BUFFER_COUNT);
 	BufferInfo sceneInfo = create_buffer_info(SCENE_DATA_BINDING, 
-		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, RAY_SHADER_STAGES,
 		sizeof(SceneData), 
 		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	BufferInfo vertexBuffer = create_buffer_info(VERTEX_BUFFER_BINDING, 
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
-		sizeof(Vertex) * scene->scene_data.numVertices, 
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	BufferInfo indexBuffer = create_buffer_info(INDEX_BUFFER_BINDING, 
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
-		sizeof(uint32_t) * scene->scene_data.numTriangles * 3, 
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	BufferInfo pointerInfo = create_buffer_info(SCENE_POINTER_BINDING,
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, RAY_SHADER_STAGES,
+		sizeof(ScenePointers),
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 	BufferInfo materialBuffer = create_buffer_info(MATERIAL_BUFFER_BINDING, 
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
 		sizeof(Material) * scene->texture_data.num_materials, 
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		scene_usage, scene_memory);
 
 	BufferInfo lightBuffer = create_buffer_info(LIGHT_BUFFER_BINDING,
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
 		sizeof(Light) * scene->scene_data.numLights,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		scene_usage, scene_memory);
 
-	BufferInfo nodeBuffer = create_buffer_info(NODE_BUFFER_BINDING,
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
-		sizeof(SceneNode) * scene->scene_data.numSceneNodes,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	BufferInfo lightTreeBuffer = create_buffer_info(LIGHT_TREE_BINDING,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
+		sizeof(LightNode) * scene->scene_data.numLightNodes,
+		scene_usage, scene_memory);
 
 	BufferInfo transformBuffer = create_buffer_info(TRANSFORM_BUFFER_BINDING,
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
+		sizeof(Mat4x3) * scene->scene_data.numTransforms,
+		scene_usage, scene_memory);
+
+	BufferInfo inverseTransformBuffer = create_buffer_info(INVERSE_TRANSFORM_BINDING,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
 		sizeof(Mat4x3) * scene->scene_data.numTransforms,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		scene_usage, scene_memory);
 
 	BufferInfo nodeIndices = create_buffer_info(NODE_CHILDREN_BINDING,
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
 		sizeof(uint32_t) * scene->scene_data.numNodeIndices,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		scene_usage, scene_memory);
 
 	globalInfos[0] = sceneInfo;
-	globalInfos[1] = vertexBuffer;
-	globalInfos[2] = indexBuffer;
-	globalInfos[3] = materialBuffer;
-	globalInfos[4] = lightBuffer;
-	globalInfos[5] = nodeBuffer;
-	globalInfos[6] = transformBuffer;
-	globalInfos[7] = nodeIndices;
+	globalInfos[1] = pointerInfo;
+	globalInfos[2] = materialBuffer;
+	globalInfos[3] = lightBuffer;
+	globalInfos[4] = transformBuffer;
+	globalInfos[5] = nodeIndices;
+	globalInfos[6] = lightTreeBuffer;
+	globalInfos[7] = inverseTransformBuffer;
 	
 	info->global_buffers = create_descriptor_set(info, 0, globalInfos, GLOBAL_BUFFER_COUNT, 1);
 
@@ -152,11 +312,15 @@ void create_descriptor_containers(VkInfo* info, Scene* scene)
 
 	// set 2 - frame buffers
 
-	BufferInfo* frameInfos = malloc(sizeof(BufferInfo) * 1);
-	BufferInfo frameInfo = create_buffer_info(FRAME_DATA_BINDING, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT,
+	BufferInfo* frameInfos = malloc(sizeof(BufferInfo) * 2);
+	BufferInfo frameInfo = create_buffer_info(FRAME_DATA_BINDING, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, RAY_SHADER_STAGES,
 		sizeof(FrameData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	// read and cleared by the profiler once the image is done
+	BufferInfo statsInfo = create_buffer_info(FRAME_STATS_BINDING, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, RAY_SHADER_STAGES,
+		sizeof(FrameStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 	frameInfos[0] = frameInfo;
-	info->per_frame_buffers = create_descriptor_set(info, 2, frameInfos, 1, info->swapchain.image_count);
+	frameInfos[1] = statsInfo;
+	info->per_frame_buffers = create_descriptor_set(info, 2, frameInfos, 2, info->swapchain.image_count);
 
 	// set 3 - ray TLAS
 	if (info->ray_tracing) {
@@ -175,6 +339,7 @@ void init_descriptor_containers(VkInfo* info, Scene* scene)
 	if(info->descriptor_pool)
 	{
 		vkResetDescriptorPool(info->device, info->descriptor_pool, 0);
+		info->compute_target.descriptor_set = VK_NULL_HANDLE; // freed with the pool
 	} else
 	{
 		create_descriptor_pool(info);
@@ -182,17 +347,40 @@ void init_descriptor_containers(VkInfo* info, Scene* scene)
 	create_descriptor_sets(info, &info->global_buffers);
 	init_texture_descriptor(info, scene);
 	create_descriptor_sets(info, &info->per_frame_buffers);
+	init_frame_ring(info);
 
 	if (info->ray_tracing) {
 		create_trace_buffer(info, scene);
+		create_node_profile(info, scene);
 		init_ray_descriptors(info, scene);
 	}
 }
 
+// a swapchain with fewer images keeps the sets, the ones past the image count stay unused.
+// the old sets are not freed, the pool has no free flag and is only reset with the scene
+void grow_per_frame_buffers(VkInfo* info)
+{
+	DescriptorSetContainer* frames = &info->per_frame_buffers;
+	if (!frames->completed || frames->sets_count >= info->swapchain.image_count)
+		return;
+	// destroy_buffer frees the infos with the container
+	BufferInfo* frame_infos = malloc(sizeof(BufferInfo) * frames->buffer_count);
+	memcpy(frame_infos, frames->buffer_infos, sizeof(BufferInfo) * frames->buffer_count);
+	uint32_t buffer_count = frames->buffer_count;
+	destroy_frame_ring(info);
+	destroy_buffer(info, frames);
+	*frames = create_descriptor_set(info, 2, frame_infos, buffer_count, info->swapchain.image_count);
+	create_buffers(info, frames);
+	create_descriptor_sets(info, frames);
+	init_frame_ring(info);
+}
+
 void destroy_shaders(VkInfo* vk, Scene* scene)
 {
+	destroy_frame_ring(vk);
 	destroy_buffer(vk, &vk->per_frame_buffers);
 	destroy_buffer(vk, &vk->global_buffers);
+	destroy_scene_geometry(vk);
 
 	// destroy texture container, destroying the textures them self is responsibility of the scene
 	vkDestroyDescriptorSetLayout(vk->device, vk->texture_container.layout, NULL);
@@ -201,14 +389,12 @@ void destroy_shaders(VkInfo* vk, Scene* scene)
 	{
 		Texture* t = &scene->texture_data.textures[i];
 		vkDestroyImageView(vk->device, t->texture_image_view, NULL);
-		vkFreeMemory(vk->device, t->texture_image_memory, NULL);
-		vkDestroyImage(vk->device, t->texture_image, NULL);
+		destroyImage(vk, t->texture_image);
 	}
 	vkDestroySampler(vk->device, scene->sampler, NULL);
 
 	vkDestroyImageView(vk->device, vk->skyboxView, NULL);
-	vkFreeMemory(vk->device, vk->skyboxMemory, NULL);
-	vkDestroyImage(vk->device, vk->skyboxImage, NULL);
+	destroyImage(vk, vk->skyboxImage);
 	vkDestroySampler(vk->device, vk->skyboxSampler, NULL);
 
 	if (vk->ray_tracing) {
@@ -1,9 +1,18 @@
 ﻿#pragma once
 #include "Globals.h"
-void compile_shaders(uint32_t opaqueCheck);
+void compile_shaders();
+uint32_t shaders_compiled();
+uint64_t hash_shader_binaries();
+// path of the ray shader binary (e.g. "shader.comp") built for the subgroup features of the device
+void ray_shader_binary(VkInfo* vk, const char* binary, char* path, size_t size);
+// writes the variant behind count constants that are already in data and entries, returns the new count
+uint32_t append_variant_constants(const ShaderVariant* variant, uint32_t* data, VkSpecializationMapEntry* entries, uint32_t count);
 void get_vertex_shader(VkInfo* vk_info, Shader* shader);
 void get_fragment_shader(VkInfo* vk_info, Shader* shader);
+void load_shader(VkInfo* vk_info, Shader* shader, const char* path);
 void create_descriptor_containers(VkInfo* info, Scene* scene);
 void init_descriptor_containers(VkInfo* info, Scene* scene);
+// more frame data and stats sets if the swapchain came back with more images
+void grow_per_frame_buffers(VkInfo* info);
 void destroy_shaders(VkInfo* vk, Scene* scene);
 
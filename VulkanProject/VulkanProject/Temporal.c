@@ -0,0 +1,95 @@
+﻿#include "Temporal.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Compute.h"
+#include "Profiler.h"
+#include "RenderScale.h"
+#include "Util.h"
+
+// the same check as record_ray_pass, the fragment path draws straight into the swapchain
+static VkBool32 traces_into_target(VkInfo* vk)
+{
+	if (vk->recorded_dispatch_mode == RAY_DISPATCH_WAVEFRONT)
+		return vk->wavefront.pipeline_layout != NULL;
+	if (vk->recorded_dispatch_mode == RAY_DISPATCH_COMPUTE || vk->recorded_dispatch_mode == RAY_DISPATCH_DEFERRED)
+		return vk->compute_pipeline != NULL;
+	return VK_FALSE;
+}
+
+void create_present_buffers(VkInfo* vk)
+{
+	TemporalCache* tc = &vk->temporal;
+	tc->valid = VK_FALSE;
+	if (!vk->compute_target.image) return;
+
+	VkCommandBufferAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = vk->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = vk->swapchain.image_count
+	};
+	tc->present_buffers = malloc(sizeof(VkCommandBuffer) * vk->swapchain.image_count);
+	check(vkAllocateCommandBuffers(vk->device, &alloc_info, tc->present_buffers),
+		"failed to allocate present buffers");
+
+	VkCommandBufferBeginInfo begin_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	for (uint32_t i = 0; i < vk->swapchain.image_count; i++)
+	{
+		VkCommandBuffer cb = tc->present_buffers[i];
+		check(vkBeginCommandBuffer(cb, &begin_info), "failed to begin command buffer");
+		// still timed as the ray pass, that is where the saved time shows up
+		profile_pass_begin(vk, cb, i, PROFILE_PASS_RAY);
+		record_compute_target_present(vk, cb, i);
+		profile_pass_end(vk, cb, i, PROFILE_PASS_RAY);
+		check(vkEndCommandBuffer(cb), "failed to end command buffer");
+	}
+}
+
+void destroy_present_buffers(VkInfo* vk)
+{
+	TemporalCache* tc = &vk->temporal;
+	if (tc->present_buffers)
+		vkFreeCommandBuffers(vk->device, vk->command_pool, vk->swapchain.image_count, tc->present_buffers);
+	free(tc->present_buffers);
+	tc->present_buffers = NULL;
+	tc->valid = VK_FALSE;
+}
+
+VkBool32 update_temporal_cache(VkInfo* vk, FrameData* frame, uint32_t image_index)
+{
+	TemporalCache* tc = &vk->temporal;
+	VkBool32 into_target = traces_into_target(vk);
+	// counters and captures want every frame traced, and so does a benchmark
+	VkBool32 forced = frame->collectStats || frame->collectNodeCosts || frame->settings.recordQueryTrace ||
+		vk->ray_descriptor.traceCapture.state == TRACE_RECORDING || vk->benchmark.state >= BENCHMARK_WARMUP;
+	VkExtent2D traced = traced_extent(vk, image_index);
+	VkBool32 full = traced.width == vk->swapchain.extent.width && traced.height == vk->swapchain.extent.height;
+	VkBool32 cached = tc->enabled && tc->valid && into_target && !forced;
+
+	// everything up to the reprojection part is what the image depends on
+	if (cached && full && tc->present_buffers &&
+		memcmp(frame, &tc->traced, offsetof(FrameData, previous_view_to_world)) == 0)
+	{
+		if (image_index < RENDER_SCALE_MAX_IMAGES) tc->reused[image_index] = VK_TRUE;
+		tc->reused_frames++;
+		return VK_TRUE;
+	}
+
+	// only the camera may have changed, the history has to come from rays of the same size and field of view
+	if (cached && tc->reproject && vk->recorded_dispatch_mode == RAY_DISPATCH_DEFERRED &&
+		frame->width == tc->traced.width && frame->height == tc->traced.height &&
+		memcmp(&frame->settings, &tc->traced.settings, sizeof(RenderSettings)) == 0)
+	{
+		memcpy(frame->previous_view_to_world, tc->traced.view_to_world, sizeof(frame->previous_view_to_world));
+		frame->reuseHistory = VK_TRUE;
+	}
+
+	tc->traced = *frame;
+	tc->valid = into_target;
+	if (image_index < RENDER_SCALE_MAX_IMAGES) tc->reused[image_index] = VK_FALSE;
+	tc->reused_frames = 0;
+	return VK_FALSE;
+}
@@ -0,0 +1,12 @@
+﻿#pragma once
+#include "Globals.h"
+
+// reuse of the last traced frame. a frame whose data matches it only blits the compute target again, so an
+// inspected view costs nothing but the blit. while the camera moves the deferred mode reprojects the primary hits
+// of the last frame and only traces the pixels that were disoccluded, see visibility.comp
+void create_present_buffers(VkInfo* vk); // with the command buffers
+void destroy_present_buffers(VkInfo* vk);
+
+// decides if the frame can present the cached result and fills in the reprojection part of the frame data.
+// the frame is remembered if it gets traced
+VkBool32 update_temporal_cache(VkInfo* vk, FrameData* frame, uint32_t image_index);
@@ -3,7 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "Allocator.h"
 #include "Bindings.h"
+#include "Platform.h"
 #include "Util.h"
 #include "VulkanUtil.h"
 
@@ -14,7 +16,7 @@ void create_texture_descriptors(VkInfo* vk, Scene* scene) // see https://vulkan-
 	.descriptorCount = 1,
 	.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
 	.pImmutableSamplers = NULL,
-	.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+	.stageFlags = RAY_SHADER_STAGES
 	};
 	
 	VkDescriptorSetLayoutBinding texture_binding = {
@@ -22,7 +24,7 @@ void create_texture_descriptors(VkInfo* vk, Scene* scene) // see https://vulkan-
 	.descriptorCount = scene->texture_data.num_textures,
 	.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
 	.pImmutableSamplers = NULL,
-	.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+	.stageFlags = RAY_SHADER_STAGES
 	};
 
 	VkDescriptorSetLayoutBinding skybox_binding = {
@@ -30,7 +32,7 @@ void create_texture_descriptors(VkInfo* vk, Scene* scene) // see https://vulkan-
 		.descriptorCount = 1,
 		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 		.pImmutableSamplers = NULL,
-		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+		.stageFlags = RAY_SHADER_STAGES
 	};
 
 	VkDescriptorSetLayoutBinding bindings[] = { sampler_binding, texture_binding, skybox_binding};
@@ -54,7 +56,7 @@ void create_image(VkInfo* vk, Texture* texture, VkFormat format, VkImageTiling t
 	imageInfo.extent.width = texture->image_width;
 	imageInfo.extent.height = texture->image_height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = texture->mip_levels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
@@ -65,18 +67,7 @@ void create_image(VkInfo* vk, Texture* texture, VkFormat format, VkImageTiling t
 
 	check(vkCreateImage(vk->device, &imageInfo, NULL, &texture->texture_image), "");
 
-	VkMemoryRequirements mem_req;
-	vkGetImageMemoryRequirements(vk->device, texture->texture_image, &mem_req);
-
-	VkMemoryAllocateInfo allocInfo = {
-		.allocationSize = mem_req.size,
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.memoryTypeIndex = findMemoryType(vk, mem_req.memoryTypeBits, properties)
-	};
-
-	check(vkAllocateMemory(vk->device, &allocInfo, NULL, &texture->texture_image_memory),"failed to allocate");
-
-	check(vkBindImageMemory(vk->device, texture->texture_image, texture->texture_image_memory, 0), "failed to bind image memory");
+	allocate_image_memory(vk, texture->texture_image, properties, &texture->texture_image_memory);
 
 }
 
@@ -92,7 +83,7 @@ void transitionImageLayout(VkInfo* vk, VkImage image, VkFormat format, VkImageLa
 	barrier.image = image;
 	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
 	barrier.subresourceRange.baseArrayLayer = 0;
 	barrier.subresourceRange.layerCount = layerCount;
 
@@ -153,6 +144,92 @@ void copyBufferToImage(VkInfo* vk, VkBuffer buffer, VkImage image, uint32_t widt
 	endSingleTimeCommands(vk, commandBuffer);
 }
 
+// full mip chain down to 1x1, the rays pick their level from the ray cone (getHitPayload)
+static uint32_t texture_mip_levels(VkInfo* vk, Texture* texture)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(vk->physical_device, VK_FORMAT_R8G8B8A8_SRGB, &properties);
+	// the chain is made with linear blits, the format has to support both ends of them
+	const VkFormatFeatureFlags mip_features = VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+		| VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+	if ((properties.optimalTilingFeatures & mip_features) != mip_features)
+		return 1;
+	uint32_t size = texture->image_width > texture->image_height ? texture->image_width : texture->image_height;
+	uint32_t levels = 1;
+	while (size > 1) {
+		size /= 2;
+		levels++;
+	}
+	return levels;
+}
+
+// blits every level from the one before, level 0 has to be in TRANSFER_DST_OPTIMAL
+// leaves all levels in SHADER_READ_ONLY_OPTIMAL, see https://vulkan-tutorial.com/Generating_Mipmaps
+void generate_mipmaps(VkInfo* vk, Texture* texture)
+{
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vk);
+
+	VkImageMemoryBarrier barrier = { 0 };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = texture->texture_image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	int32_t width = (int32_t)texture->image_width;
+	int32_t height = (int32_t)texture->image_height;
+	for (uint32_t level = 1; level < texture->mip_levels; level++) {
+		// the level before was just written, it becomes the source of this one
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, NULL, 0, NULL, 1, &barrier);
+
+		VkImageBlit blit = { 0 };
+		blit.srcOffsets[1].x = width;
+		blit.srcOffsets[1].y = height;
+		blit.srcOffsets[1].z = 1;
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.layerCount = 1;
+		blit.dstOffsets[1].x = width > 1 ? width / 2 : 1;
+		blit.dstOffsets[1].y = height > 1 ? height / 2 : 1;
+		blit.dstOffsets[1].z = 1;
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = level;
+		blit.dstSubresource.layerCount = 1;
+		vkCmdBlitImage(commandBuffer, texture->texture_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			texture->texture_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, NULL, 0, NULL, 1, &barrier);
+
+		if (width > 1) width /= 2;
+		if (height > 1) height /= 2;
+	}
+
+	// the last level was only written
+	barrier.subresourceRange.baseMipLevel = texture->mip_levels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, NULL, 0, NULL, 1, &barrier);
+
+	endSingleTimeCommands(vk, commandBuffer);
+}
+
 void create_texture_image(VkInfo* vk, Texture* texture) // see https://vulkan-tutorial.com/
 {
 	VkBuffer stagingBuffer;
@@ -160,22 +237,18 @@ void create_texture_image(VkInfo* vk, Texture* texture) // see https://vulkan-tu
 	createBuffer(vk, texture->image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		&stagingBuffer, &stagingBufferMemory);
 
-	void* data;
-	check(vkMapMemory(vk->device, stagingBufferMemory, 0, texture->image_size, 0, &data), "");
-	memcpy(data, texture->pixel_data, texture->image_size);
-	vkUnmapMemory(vk->device, stagingBufferMemory);
+	memcpy(mapBuffer(vk, stagingBuffer), texture->pixel_data, texture->image_size);
 
+	texture->mip_levels = texture_mip_levels(vk, texture);
 	create_image(vk, texture, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	transitionImageLayout(vk, texture->texture_image, VK_FORMAT_R8G8B8A8_SRGB,
 		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,1);
 	copyBufferToImage(vk, stagingBuffer, texture->texture_image, texture->image_width, texture->image_height, 1);
-	transitionImageLayout(vk, texture->texture_image, VK_FORMAT_R8G8B8A8_SRGB,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,1);
+	generate_mipmaps(vk, texture);
 
-	vkDestroyBuffer(vk->device, stagingBuffer, NULL);
-	vkFreeMemory(vk->device, stagingBufferMemory, NULL);
+	destroyBuffer(vk, stagingBuffer);
 }
 
 void create_texture_image_view(VkInfo* vk, Texture* texture) // see https://vulkan-tutorial.com/
@@ -187,7 +260,7 @@ void create_texture_image_view(VkInfo* vk, Texture* texture) // see https://vulk
 	viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
 	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.levelCount = texture->mip_levels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -213,6 +286,7 @@ void create_texture_sampler(VkInfo* vk, Scene* scene) // see https://vulkan-tuto
 	samplerInfo.compareEnable = VK_FALSE;
 	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
 	check(vkCreateSampler(vk->device, &samplerInfo, NULL, &scene->sampler), "failed to create sampler");
 }
@@ -268,14 +342,12 @@ void create_skybox(VkInfo* vk, Scene* scene)
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		&stagingBuffer, &stagingBufferDeviceMemory);
 
-	uint32_t* data;
-	vkMapMemory(vk->device, stagingBufferDeviceMemory, 0, imageSize, 0, &data);
+	uint32_t* data = mapBuffer(vk, stagingBuffer);
 
 	for (uint32_t i = 0; i < 6; ++i)
 	{
 		memcpy(&data[width * height * i], &textureData[width * height * i], layerSize);
 	}
-	vkUnmapMemory(vk->device, stagingBufferDeviceMemory);
 	free(textureData);
 	VkImageCreateInfo imageInfo = { 0 };
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -295,18 +367,7 @@ void create_skybox(VkInfo* vk, Scene* scene)
 
 	check(vkCreateImage(vk->device, &imageInfo, NULL, &vk->skyboxImage), "");
 
-	VkMemoryRequirements mem_req;
-	vkGetImageMemoryRequirements(vk->device, vk->skyboxImage, &mem_req);
-
-	VkMemoryAllocateInfo allocInfo = {
-		.allocationSize = mem_req.size,
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.memoryTypeIndex = findMemoryType(vk, mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-	};
-
-	check(vkAllocateMemory(vk->device, &allocInfo, NULL, &vk->skyboxMemory), "failed to allocate");
-
-	check(vkBindImageMemory(vk->device, vk->skyboxImage, vk->skyboxMemory, 0), "failed to bind image memory");
+	allocate_image_memory(vk, vk->skyboxImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vk->skyboxMemory);
 
 
 	transitionImageLayout(vk, vk->skyboxImage, VK_FORMAT_R8G8B8A8_SRGB,
@@ -315,8 +376,7 @@ void create_skybox(VkInfo* vk, Scene* scene)
 	transitionImageLayout(vk, vk->skyboxImage, VK_FORMAT_R8G8B8A8_SRGB,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 6);
 
-	vkDestroyBuffer(vk->device, stagingBuffer, NULL);
-	vkFreeMemory(vk->device, stagingBufferDeviceMemory, NULL);
+	destroyBuffer(vk, stagingBuffer);
 
 
 	VkImageViewCreateInfo viewInfo = { 0 };
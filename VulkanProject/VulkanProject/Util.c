@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <vulkan/vulkan_core.h>
 
 int SUCCESS = 1;
@@ -15,6 +16,13 @@ void setExceptionCallback(ExceptionCallback callback)
 	exception_callback = callback;
 }
 
+double get_time(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
 void check(VkResult result, char* errorMsg)
 {
 	if (result == VK_SUCCESS) return;
@@ -9,4 +9,5 @@ extern ExceptionCallback exception_callback;
 void check(VkResult result, char* errorMsg);
 void check_b(VkBool32 boolean, char* errorMsg);
 void error(char* err);
-void setExceptionCallback(ExceptionCallback callback);
\ No newline at end of file
+void setExceptionCallback(ExceptionCallback callback);
+double get_time(void); // seconds, does not need glfw
\ No newline at end of file
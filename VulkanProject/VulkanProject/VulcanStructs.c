@@ -2,11 +2,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "Allocator.h"
+#include "Compute.h"
 #include "Globals.h"
+#include "Pipelines.h"
+#include "Profiler.h"
 #include "Raster.h"
+#include "RenderScale.h"
 #include "Shader.h"
+#include "Temporal.h"
 #include "Util.h"
 #include "VulkanStructs.h"
+#include "Wavefront.h"
 
 void create_instance(VkInfo* vk_info) // see https://github.com/MomentsInGraphics/vulkan_renderer
 {
@@ -22,8 +29,11 @@ void create_instance(VkInfo* vk_info) // see https://github.com/MomentsInGraphic
 	const int layer_count = 1;
 	const char* layer_names[] = {"VK_LAYER_KHRONOS_validation"};
 
-	uint32_t surface_extension_count;
-	const char** surface_extension_names = glfwGetRequiredInstanceExtensions(&surface_extension_count);
+	// headless needs no surface extensions, and no glfw
+	uint32_t surface_extension_count = 0;
+	const char** surface_extension_names = NULL;
+	if (!vk_info->headless)
+		surface_extension_names = glfwGetRequiredInstanceExtensions(&surface_extension_count);
 	vk_info->instance_extension_count = surface_extension_count;
 	vk_info->instance_extension_names = malloc(sizeof(char*) * vk_info->instance_extension_count);
 	for (uint32_t i = 0; i != surface_extension_count; ++i)
@@ -73,7 +83,14 @@ void create_instance(VkInfo* vk_info) // see https://github.com/MomentsInGraphic
 		vkGetPhysicalDeviceProperties(vk_info->physical_devices[i], &device_properties);
 		printf("%u - %s\n", i, device_properties.deviceName);
 	}
-	vk_info->physical_device = vk_info->physical_devices[0]; // TODO selection
+	if (vk_info->device_index >= vk_info->physical_device_count)
+		error("the selected physical device does not exist");
+	vk_info->physical_device = vk_info->physical_devices[vk_info->device_index];
+	VkPhysicalDeviceProperties selected_properties;
+	vkGetPhysicalDeviceProperties(vk_info->physical_device, &selected_properties);
+	// cpu and gpu share the memory, a staging copy would only cost time
+	vk_info->unified_memory = selected_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU
+		|| selected_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
 	//
 	// Enumerate available memory types
 	vkGetPhysicalDeviceMemoryProperties(vk_info->physical_device, &vk_info->physical_device_memory_properties);
@@ -101,9 +118,48 @@ void create_instance(VkInfo* vk_info) // see https://github.com/MomentsInGraphic
 	if (vkEnumerateDeviceExtensionProperties(vk_info->physical_device, NULL, &extension_count, extensions))
 		extension_count = 0;
 	for (uint32_t i = 0; i != extension_count; ++i)
+	{
 		if (strcmp(extensions[i].extensionName, VK_KHR_RAY_QUERY_EXTENSION_NAME) == 0)
 			vk_info->ray_tracing = VK_TRUE;
+		if (strcmp(extensions[i].extensionName, VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME) == 0)
+			vk_info->full_subgroups = VK_TRUE;
+	}
 	free(extensions);	
+	// the ray rates pair pixels with quad operations, in compute that only works in full subgroups
+	VkPhysicalDeviceSubgroupSizeControlFeaturesEXT size_control = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT
+	};
+	VkPhysicalDeviceFeatures2 features2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &size_control
+	};
+	if (vk_info->full_subgroups)
+	{
+		vkGetPhysicalDeviceFeatures2(vk_info->physical_device, &features2);
+		vk_info->full_subgroups = size_control.computeFullSubgroups;
+	}
+	vk_info->subgroup = (VkPhysicalDeviceSubgroupProperties){
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES
+	};
+	VkPhysicalDeviceProperties2 properties2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &vk_info->subgroup
+	};
+	vkGetPhysicalDeviceProperties2(vk_info->physical_device, &properties2);
+	vk_info->subgroup.pNext = NULL;
+	// the frame stats, node costs and wavefront efficiency are summed over the subgroup in the fragment and compute
+	// shaders, without the operations there the binaries built without them are loaded and every invocation does its own atomics
+	const VkSubgroupFeatureFlags reductions = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+	const VkShaderStageFlags reduction_stages = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	vk_info->subgroup_arithmetic = (vk_info->subgroup.supportedOperations & reductions) == reductions
+		&& (vk_info->subgroup.supportedStages & reduction_stages) == reduction_stages;
+	if (!vk_info->subgroup_arithmetic)
+		printf("No subgroup arithmetic in the fragment and compute stage, the stats use plain atomics.\n");
+	// the reduced ray rates pair pixels with quad swaps
+	vk_info->subgroup_quad = (vk_info->subgroup.supportedOperations & VK_SUBGROUP_FEATURE_QUAD_BIT)
+		&& (vk_info->subgroup.supportedStages & reduction_stages) == reduction_stages;
+	if (!vk_info->subgroup_quad)
+		printf("No subgroup quad operations in the fragment and compute stage, rays are traced at full rate.\n");
 }
 
 void create_device(VkInfo* vk_info) // see https://github.com/MomentsInGraphics/vulkan_renderer
@@ -123,15 +179,21 @@ void create_device(VkInfo* vk_info) // see https://github.com/MomentsInGraphics/
 		VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
 		VK_KHR_RAY_QUERY_EXTENSION_NAME,
 	};
-	vk_info->device_extension_count = ext_base_num;
+	// headless never presents, so it does not ask for the swapchain extension
+	const uint32_t ext_first = vk_info->headless ? 1 : 0;
+	vk_info->device_extension_count = ext_base_num - ext_first;
 	if (vk_info->ray_tracing)
 		vk_info->device_extension_count += ext_ray_num;
+	if (vk_info->full_subgroups)
+		vk_info->device_extension_count++;
 	vk_info->device_extension_names = malloc(sizeof(char*) * vk_info->device_extension_count);
-	for (uint32_t i = 0; i != ext_base_num; ++i)
-		vk_info->device_extension_names[i] = base_device_extension_names[i];
+	for (uint32_t i = ext_first; i != ext_base_num; ++i)
+		vk_info->device_extension_names[i - ext_first] = base_device_extension_names[i];
 	if (vk_info->ray_tracing)
 		for (uint32_t i = 0; i != ext_ray_num; ++i)
-			vk_info->device_extension_names[ext_base_num + i] = ray_tracing_device_extension_names[i];
+			vk_info->device_extension_names[ext_base_num - ext_first + i] = ray_tracing_device_extension_names[i];
+	if (vk_info->full_subgroups)
+		vk_info->device_extension_names[vk_info->device_extension_count - 1] = VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME;
 	float queue_priorities[1] = {0.0f};
 	VkDeviceQueueCreateInfo queue_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
@@ -162,9 +224,14 @@ void create_device(VkInfo* vk_info) // see https://github.com/MomentsInGraphics/
 		.bufferDeviceAddress = VK_TRUE,
 		.runtimeDescriptorArray = VK_TRUE
 	};
+	VkPhysicalDeviceSubgroupSizeControlFeaturesEXT size_control_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT,
+		.pNext = &enabled_new_features,
+		.computeFullSubgroups = VK_TRUE,
+	};
 	VkDeviceCreateInfo device_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = &enabled_new_features,
+		.pNext = vk_info->full_subgroups ? (void*)&size_control_features : (void*)&enabled_new_features,
 		.queueCreateInfoCount = 1,
 		.pQueueCreateInfos = &queue_info,
 		.enabledExtensionCount = vk_info->device_extension_count,
@@ -187,7 +254,7 @@ void create_device(VkInfo* vk_info) // see https://github.com/MomentsInGraphics/
 	VkCommandPoolCreateInfo command_pool_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
 		.queueFamilyIndex = vk_info->queue_family_index,
-		.flags = 0
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT // the render scale records single images again
 	};
 	check(vkCreateCommandPool(vk_info->device, &command_pool_info, NULL, &vk_info->command_pool), "Failed to create command pool for queue");
 	// Grab the selected queue
@@ -214,11 +281,50 @@ void create_validation_layer(VkInfo* vk_info)
 	//TODO validation if I feel like it
 }
 
+// headless, images in the format of a typical swapchain take its place. they are copied out after the frame
+static void create_offscreen_images(VkInfo* vk_info, uint32_t width, uint32_t height)
+{
+	Swapchain* swapchain = &vk_info->swapchain;
+	swapchain->format = VK_FORMAT_B8G8R8A8_UNORM;
+	swapchain->extent.width = width;
+	swapchain->extent.height = height;
+	swapchain->image_count = MAX_FRAMES_IN_FLIGHT; // one fence per image
+	swapchain->images = malloc(sizeof(VkImage) * swapchain->image_count);
+	for (uint32_t i = 0; i < swapchain->image_count; i++)
+	{
+		VkImageCreateInfo image_info = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = swapchain->format,
+			.extent = { width, height, 1 },
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+		};
+		check(vkCreateImage(vk_info->device, &image_info, NULL, &swapchain->images[i]), "failed to create offscreen image");
+		VkDeviceMemory memory;
+		allocate_image_memory(vk_info, swapchain->images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memory);
+	}
+}
+
 void create_swapchain(VkInfo* vk_info, GLFWwindow** window, uint32_t width, uint32_t height) // see https://vulkan-tutorial.com/
 {
 	Swapchain* swapchain = &vk_info->swapchain;
+	// a resize keeps the surface
+	VkSurfaceKHR surface = swapchain->surface;
 	memset(swapchain, 0, sizeof(Swapchain));
-	check(glfwCreateWindowSurface(vk_info->instance, *window, NULL, &swapchain->surface),"Failed to create surface");
+	swapchain->surface = surface;
+	if (vk_info->headless)
+	{
+		create_offscreen_images(vk_info, width, height);
+		return;
+	}
+	if (!swapchain->surface)
+		check(glfwCreateWindowSurface(vk_info->instance, *window, NULL, &swapchain->surface),"Failed to create surface");
 
 	VkBool32 presentation_supported;
 	check(vkGetPhysicalDeviceSurfaceSupportKHR(vk_info->physical_device, vk_info->queue_family_index, 
@@ -270,7 +376,7 @@ void create_swapchain(VkInfo* vk_info, GLFWwindow** window, uint32_t width, uint
 		.presentMode = present_mode,
 		.clipped = VK_TRUE,
 		.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, // transfer dst for the compute blit
 		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
 	};
 	check(vkCreateSwapchainKHR(vk_info->device, &create_info, NULL, &swapchain->vk_swapchain), "Failed to create swapchain");
@@ -279,13 +385,16 @@ void create_swapchain(VkInfo* vk_info, GLFWwindow** window, uint32_t width, uint
 void create_image_views(VkInfo* info) // see https://vulkan-tutorial.com/
 {
 	Swapchain* swapchain = &info->swapchain;
-	swapchain->image_count = 0;
-	check(vkGetSwapchainImagesKHR(info->device, swapchain->vk_swapchain, &swapchain->image_count, NULL),
-		"Failed to get swapchain images");
+	if (!info->headless) // the offscreen images exist already
+	{
+		swapchain->image_count = 0;
+		check(vkGetSwapchainImagesKHR(info->device, swapchain->vk_swapchain, &swapchain->image_count, NULL),
+			"Failed to get swapchain images");
+		swapchain->images = malloc(sizeof(VkImage) * swapchain->image_count);
+		check(vkGetSwapchainImagesKHR(info->device, swapchain->vk_swapchain, &swapchain->image_count, swapchain->images),
+			"Failed to get swapchain images");
+	}
 	info->buffer_count = swapchain->image_count;
-	swapchain->images = malloc(sizeof(VkImage) * swapchain->image_count);
-	check(vkGetSwapchainImagesKHR(info->device, swapchain->vk_swapchain, &swapchain->image_count, swapchain->images),
-		"Failed to get swapchain images");
 	swapchain->image_views = malloc(sizeof(VkImageView) * swapchain->image_count);
 	for (uint32_t i = 0; i < swapchain->image_count; i++)
 	{
@@ -311,11 +420,47 @@ void create_image_views(VkInfo* info) // see https://vulkan-tutorial.com/
 
 void create_pipeline(VkInfo* info) // see https://vulkan-tutorial.com/
 {
-	Swapchain* swapchain = &info->swapchain;
-	compile_shaders(info->opacity_check);
+	if (info->recompile || !shaders_compiled())
+	{
+		compile_shaders();
+		destroy_pipeline_cache(info); // keyed by the old binaries
+	}
+	info->recompile = 0;
+	if (!info->pipeline_cache)
+		init_pipeline_cache(info);
 	get_vertex_shader(info, &info->vertex_shader);
 	get_fragment_shader(info, &info->fragment_shader);
 
+	VkDescriptorSetLayout layouts[] = {
+		info->global_buffers.set_layout,
+		info->texture_container.layout ,
+		info->per_frame_buffers.set_layout,
+		info->ray_descriptor.set_layout
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {0};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = info->numSets;
+	pipeline_layout_info.pSetLayouts = layouts;
+
+	check(vkCreatePipelineLayout(info->device, &pipeline_layout_info, NULL,&info->pipeline_layout), 
+		"Failed to create pipeline layout");
+
+	create_graphics_pipeline(info, &info->variant, &info->pipeline);
+}
+
+// the fixed function state is the same for every variant, viewport and scissor are set when recording
+void create_graphics_pipeline(VkInfo* info, const ShaderVariant* variant, VkPipeline* pipeline)
+{
+	uint32_t spec_data[SHADER_VARIANT_CONSTANTS];
+	VkSpecializationMapEntry spec_entries[SHADER_VARIANT_CONSTANTS];
+	VkSpecializationInfo spec_info = {
+		.mapEntryCount = append_variant_constants(variant, spec_data, spec_entries, 0),
+		.pMapEntries = spec_entries,
+		.dataSize = sizeof(spec_data),
+		.pData = spec_data
+	};
+
 	VkPipelineShaderStageCreateInfo vert_create_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 		.stage = VK_SHADER_STAGE_VERTEX_BIT,
@@ -327,7 +472,8 @@ void create_pipeline(VkInfo* info) // see https://vulkan-tutorial.com/
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
 		.module = info->fragment_shader.module,
-		.pName = "main"
+		.pName = "main",
+		.pSpecializationInfo = &spec_info
 	};
 
 	VkPipelineShaderStageCreateInfo shader_stages[] = {vert_create_info, frag_create_info};
@@ -365,27 +511,18 @@ void create_pipeline(VkInfo* info) // see https://vulkan-tutorial.com/
 		.primitiveRestartEnable = VK_FALSE,
 	};
 
-	VkViewport viewport = {
-		viewport.x = 0.0f,
-		viewport.y = 0.0f,
-		viewport.width = (float)swapchain->extent.width,
-		viewport.height = (float)swapchain->extent.height,
-		viewport.minDepth = 0.0f,
-		viewport.maxDepth = 1.0f
-	};
-
-	VkOffset2D offset = {.x = 0, .y = 0};
-	VkRect2D scissor = {
-		scissor.offset = offset,
-		scissor.extent = swapchain->extent,
-	};
-
+	// the counts are fixed, the rectangles are dynamic so a resize does not need a new pipeline
 	VkPipelineViewportStateCreateInfo viewport_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
 		.viewportCount = 1,
-		.pViewports = &viewport,
 		.scissorCount = 1,
-		.pScissors = &scissor
+	};
+
+	VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamic_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = 2,
+		.pDynamicStates = dynamic_states
 	};
 
 	VkPipelineRasterizationStateCreateInfo rasterizer = {
@@ -437,21 +574,6 @@ void create_pipeline(VkInfo* info) // see https://vulkan-tutorial.com/
 	};
 
 
-	VkDescriptorSetLayout layouts[] = {
-		info->global_buffers.set_layout,
-		info->texture_container.layout ,
-		info->per_frame_buffers.set_layout,
-		info->ray_descriptor.set_layout
-	};
-
-	VkPipelineLayoutCreateInfo pipeline_layout_info = {0};
-	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_layout_info.setLayoutCount = info->numSets;
-	pipeline_layout_info.pSetLayouts = layouts;
-
-	check(vkCreatePipelineLayout(info->device, &pipeline_layout_info, NULL,&info->pipeline_layout), 
-		"Failed to create pipeline layout");
-
 	VkGraphicsPipelineCreateInfo pipeline_info = {
 		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
 		.stageCount = 2,
@@ -463,14 +585,14 @@ void create_pipeline(VkInfo* info) // see https://vulkan-tutorial.com/
 		.pMultisampleState = &multisampling,
 		.pDepthStencilState = NULL, // Optional
 		.pColorBlendState = &color_blending,
-		.pDynamicState = NULL, // Optional
+		.pDynamicState = &dynamic_state,
 		.layout = info->pipeline_layout,
 		.renderPass = info->renderPass,
 		.subpass = 0,
 		.basePipelineHandle = VK_NULL_HANDLE, // Optional
 	};
-	check(vkCreateGraphicsPipelines(info->device, VK_NULL_HANDLE, 
-		1, &pipeline_info, NULL,&info->pipeline),"Failed to create pipeline");
+	check(vkCreateGraphicsPipelines(info->device, info->pipeline_cache, 
+		1, &pipeline_info, NULL, pipeline),"Failed to create pipeline");
 
 	free(attributeDescriptions);
 }
@@ -485,7 +607,7 @@ void create_render_pass(VkInfo* info) // see https://vulkan-tutorial.com/
 		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
 		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL_KHR,
+		.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, // same as after the compute blit
 	};
 	VkAttachmentReference color_attachment_ref = {
 		.attachment = 0,
@@ -554,56 +676,117 @@ void create_command_buffers(VkInfo* info) // see https://vulkan-tutorial.com/ fo
 	check(vkAllocateCommandBuffers(info->device, &allocInfo, info->command_buffers),
 		"failed to allocate command buffers");
 
-	for (size_t i = 0; i < swapchain->image_count; i++) {
-		VkCommandBufferBeginInfo beginInfo = {
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.flags = 0, // Optional
-		.pInheritanceInfo = NULL, // Optional
-		};
+	for (uint32_t i = 0; i < swapchain->image_count; i++) {
+		record_command_buffer(info, i);
+	}
+	info->recorded_dispatch_mode = info->dispatch_mode;
+	create_present_buffers(info);
+}
 
-		check(vkBeginCommandBuffer(info->command_buffers[i], &beginInfo),
-			"failed to begin command buffer");
-		VkOffset2D offset = { .x = 0, .y = 0 };
-		VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
+// switching between fragment and compute only needs new command buffers, everything else is already there
+void rerecord_command_buffers(VkInfo* info)
+{
+	vkDeviceWaitIdle(info->device);
+	destroy_present_buffers(info);
+	vkFreeCommandBuffers(info->device, info->command_pool, info->buffer_count, info->command_buffers);
+	free(info->command_buffers);
+	info->command_buffers = 0;
+	create_command_buffers(info);
+}
 
-		VkRenderPassBeginInfo render_pass_info = {
-		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-		.renderPass = info->renderPass,
-		.framebuffer = swapchain->frame_buffers[i],
-		.renderArea.offset = offset,
-		.renderArea.extent = swapchain->extent,
-		.clearValueCount = 1,
-		.pClearValues = &clearColor
-		};
+// everything of the frame before the imgui pass, in the current dispatch mode
+static void record_ray_pass(VkInfo* info, uint32_t i)
+{
+	Swapchain* swapchain = &info->swapchain;
+	if (info->dispatch_mode == RAY_DISPATCH_WAVEFRONT && info->wavefront.pipeline_layout)
+	{
+		record_wavefront(info, info->command_buffers[i], i);
+		return;
+	}
+	if (info->dispatch_mode == RAY_DISPATCH_DEFERRED && info->compute_pipeline)
+	{
+		record_deferred_dispatch(info, info->command_buffers[i], i);
+		return;
+	}
+	if (info->dispatch_mode == RAY_DISPATCH_COMPUTE && info->compute_pipeline)
+	{
+		// traces into the storage image and blits it over, the imgui pass picks up from there
+		record_compute_dispatch(info, info->command_buffers[i], i);
+		return;
+	}
 
-		vkCmdBeginRenderPass(info->command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+	VkOffset2D offset = { .x = 0, .y = 0 };
+	VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
 
-		vkCmdBindPipeline(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline);
-		if(info->rasterize == VK_TRUE)
-		{
-			VkBuffer vertexBuffers[] = { info->vertexBuffer };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(info->command_buffers[i], 0, 1, vertexBuffers, offsets);
-		}
-		vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
-			0, 1, &info->global_buffers.descriptor_sets[0], 0, NULL);
-		vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
-			1, 1, &info->texture_container.descriptor_set, 0, NULL);
-		vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
-			2, 1, &info->per_frame_buffers.descriptor_sets[i], 0, NULL);
-		if (info->ray_tracing) {
-			vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
-				3, 1, &info->ray_descriptor.descriptor_set, 0, NULL);
-		}
-		vkCmdDraw(info->command_buffers[i], 3, 1, 0, 0);
-		vkCmdEndRenderPass(info->command_buffers[i]);
+	VkRenderPassBeginInfo render_pass_info = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+	.renderPass = info->renderPass,
+	.framebuffer = swapchain->frame_buffers[i],
+	.renderArea.offset = offset,
+	.renderArea.extent = swapchain->extent,
+	.clearValueCount = 1,
+	.pClearValues = &clearColor
+	};
+
+	vkCmdBeginRenderPass(info->command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
 
-		check(vkEndCommandBuffer(info->command_buffers[i]), "failed to end command buffer");
+	vkCmdBindPipeline(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline);
+	VkViewport viewport = {
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (float)swapchain->extent.width,
+		.height = (float)swapchain->extent.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f
+	};
+	VkRect2D scissor = { .offset = offset, .extent = swapchain->extent };
+	vkCmdSetViewport(info->command_buffers[i], 0, 1, &viewport);
+	vkCmdSetScissor(info->command_buffers[i], 0, 1, &scissor);
+	if(info->rasterize == VK_TRUE)
+	{
+		VkBuffer vertexBuffers[] = { info->vertexBuffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(info->command_buffers[i], 0, 1, vertexBuffers, offsets);
 	}
+	vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
+		0, 1, &info->global_buffers.descriptor_sets[0], 0, NULL);
+	vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
+		1, 1, &info->texture_container.descriptor_set, 0, NULL);
+	vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
+		2, 1, &info->per_frame_buffers.descriptor_sets[i], 0, NULL);
+	if (info->ray_tracing) {
+		vkCmdBindDescriptorSets(info->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
+			3, 1, &info->ray_descriptor.descriptor_set, 0, NULL);
+	}
+	vkCmdDraw(info->command_buffers[i], 3, 1, 0, 0);
+	vkCmdEndRenderPass(info->command_buffers[i]);
+}
+
+void record_command_buffer(VkInfo* info, uint32_t i)
+{
+	VkCommandBufferBeginInfo beginInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.flags = 0, // Optional
+	.pInheritanceInfo = NULL, // Optional
+	};
+
+	if (i < RENDER_SCALE_MAX_IMAGES)
+		info->render_scale.recorded[i] = render_scale_extent(info);
+	check(vkBeginCommandBuffer(info->command_buffers[i], &beginInfo),
+		"failed to begin command buffer");
+
+	profile_pass_begin(info, info->command_buffers[i], i, PROFILE_PASS_RAY);
+	record_ray_pass(info, i);
+	profile_pass_end(info, info->command_buffers[i], i, PROFILE_PASS_RAY);
+
+	check(vkEndCommandBuffer(info->command_buffers[i]), "failed to end command buffer");
 }
 
 void create_semaphores(VkInfo* info) // see https://vulkan-tutorial.com/
 {
+	// the image fences follow the swapchain, which can come back with a different number of images
+	free(info->imagesInFlight);
+	info->imagesInFlight = calloc(info->swapchain.image_count, sizeof(VkFence));
 	if (info->renderFinishedSemaphore)
 		return;
 
@@ -620,8 +803,6 @@ void create_semaphores(VkInfo* info) // see https://vulkan-tutorial.com/
 	info->renderFinishedSemaphore = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
 	info->imageAvailableSemaphore = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
 	info->inFlightFences = malloc(sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT);
-	info->imagesInFlight = malloc(sizeof(VkFence) * info->swapchain.image_count);
-	memset(info->imagesInFlight, 0, sizeof(VkFence) * info->swapchain.image_count);
 
 	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 		check(vkCreateSemaphore(info->device, &semaphore_info, NULL, &info->imageAvailableSemaphore[i]),
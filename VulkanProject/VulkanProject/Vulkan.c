@@ -5,11 +5,18 @@
 #include <GLFW/glfw3.h>
 
 #include "Util.h"
+#include "Allocator.h"
+#include "Compute.h"
 #include "Globals.h"
 #include "ImguiSetup.h"
+#include "Pipelines.h"
+#include "Profiler.h"
 #include "Raster.h"
 #include "Shader.h"
+#include "Temporal.h"
+#include "VulkanUtil.h"
 #include "VulkanStructs.h"
+#include "Wavefront.h"
 void init_vulkan(VkInfo* info, GLFWwindow** window, Scene* scene)
 {
 	if(info->rasterize == VK_TRUE)
@@ -23,6 +30,8 @@ void init_vulkan(VkInfo* info, GLFWwindow** window, Scene* scene)
 
 #endif
 	create_device(info);
+	init_allocator(info);
+	init_profiler(info);
 }
 void create_or_resize_swapchain(VkInfo* vk, GLFWwindow** window, uint32_t width, uint32_t height, Scene* scene)
 {
@@ -34,10 +43,19 @@ void create_or_resize_swapchain(VkInfo* vk, GLFWwindow** window, uint32_t width,
 	create_image_views(vk);
 	create_render_pass(vk);
 	create_descriptor_containers(vk, scene); // out
+	grow_per_frame_buffers(vk);
 	create_pipeline(vk);
 	create_frame_buffers(vk);
 	create_vertex_buffer(vk); // out
 	init_descriptor_containers(vk, scene); // out
+	if (vk->ray_tracing) {
+		create_compute_target(vk);
+		create_compute_pipeline(vk);
+		// the queues are big, only pay for them when the mode is used
+		if (vk->dispatch_mode == RAY_DISPATCH_WAVEFRONT)
+			create_wavefront(vk);
+	}
+	vk->built_variant = vk->variant;
 	create_command_buffers(vk);
 	create_semaphores(vk);
 }
@@ -58,11 +76,17 @@ void destroy_vulkan(VkInfo* vk, Scene* scene, SceneSelection* scene_selection)
 
 
 	destroy_shaders(vk, scene);
-	destroy_imgui(vk, scene_selection);
+	if (!vk->headless)
+		destroy_imgui(vk, scene_selection);
 	destroy_swapchain(vk);
+	destroy_pipeline_cache(vk);
+	destroy_profiler(vk);
 
+	if (vk->compute_target.set_layout)
+		vkDestroyDescriptorSetLayout(vk->device, vk->compute_target.set_layout, NULL);
 	vkDestroyDescriptorPool(vk->device, vk->descriptor_pool, NULL);
 	if (vk->command_pool) vkDestroyCommandPool(vk->device, vk->command_pool, NULL);
+	destroy_allocator(vk);
 	free(vk->device_extension_names);
 	free(vk->instance_extension_names);
 	free(vk->queue_family_properties);
@@ -73,8 +97,8 @@ void destroy_vulkan(VkInfo* vk, Scene* scene, SceneSelection* scene_selection)
 	memset(vk, 0, sizeof(VkInfo));
 }
 
-// everything that needs to be (re)created when the swapchain is (re)created
-void destroy_swapchain(VkInfo* vk)
+// only what depends on the size of the swapchain, see resize_swapchain
+static void destroy_swapchain_images(VkInfo* vk)
 {
 	Swapchain* sw = &vk->swapchain;
 
@@ -96,11 +120,32 @@ void destroy_swapchain(VkInfo* vk)
 		free(sw->image_views);
 	}
 
+	if (vk->headless && sw->images)
+		for (uint32_t i = 0; i < sw->image_count; i++)
+			destroyImage(vk, sw->images[i]);
 	free(sw->images);
 	free(sw->surface_formats);
 	if(sw->vk_swapchain) vkDestroySwapchainKHR(vk->device, sw->vk_swapchain, NULL);
-	if (sw->surface) vkDestroySurfaceKHR(vk->instance, sw->surface, NULL);
+	VkSurfaceKHR surface = sw->surface;
 	memset(&vk->swapchain, 0, sizeof(Swapchain));
+	sw->surface = surface;
+
+	destroy_present_buffers(vk);
+	if (vk->command_buffers)
+		vkFreeCommandBuffers(vk->device, vk->command_pool, vk->buffer_count, vk->command_buffers);
+	free(vk->command_buffers);
+	vk->command_buffers = 0;
+
+	destroy_compute_target(vk);
+}
+
+// everything that needs to be (re)created when the swapchain is (re)created
+void destroy_swapchain(VkInfo* vk)
+{
+	cancel_variant_build(vk);
+	destroy_swapchain_images(vk);
+	if (vk->swapchain.surface) vkDestroySurfaceKHR(vk->instance, vk->swapchain.surface, NULL);
+	vk->swapchain.surface = NULL;
 
 
 	// everything in VK_info thats associated with the swapchain
@@ -108,17 +153,15 @@ void destroy_swapchain(VkInfo* vk)
 
 	if (vk->vertexBuffer != NULL)
 	{
-		vkDestroyBuffer(vk->device, vk->vertexBuffer, NULL);
+		destroyBuffer(vk, vk->vertexBuffer);
 		vk->vertexBuffer = NULL;
-	}
-
-	if (vk->vertexBufferMemory != NULL)
-	{
-		vkFreeMemory(vk->device, vk->vertexBufferMemory, NULL);
 		vk->vertexBufferMemory = NULL;
 	}
 
 
+	destroy_wavefront(vk);
+	destroy_compute_pipeline(vk);
+
 	if (vk->pipeline)
 		vkDestroyPipeline(vk->device, vk->pipeline, NULL);
 	vk->pipeline = NULL;
@@ -143,9 +186,36 @@ void destroy_swapchain(VkInfo* vk)
 	free(vk->fragment_shader.code);
 	vk->fragment_shader.code = 0;
 
+}
 
+// a resize only replaces what depends on the size, scene buffers, descriptors, acceleration structures
+// and pipelines stay. the surface and the present mode are the same, the number of images usually is
+void resize_swapchain(VkInfo* vk, GLFWwindow** window, uint32_t width, uint32_t height, Scene* scene)
+{
+	// after a full teardown there is nothing to keep
+	if (!vk->pipeline_layout)
+	{
+		create_or_resize_swapchain(vk, window, width, height, scene);
+		return;
+	}
+	uint32_t image_count = vk->buffer_count;
+	destroy_swapchain_images(vk);
+	if (width == 0 || height == 0) return;
 
-
-	free(vk->command_buffers);
-	vk->command_buffers = 0;
-}
\ No newline at end of file
+	create_swapchain(vk, window, width, height);
+	create_image_views(vk);
+	// the image fences, frame data sets, frame ring and stats slots are per image
+	if (vk->swapchain.image_count != image_count)
+	{
+		create_or_resize_swapchain(vk, window, width, height, scene);
+		return;
+	}
+	create_frame_buffers(vk);
+	if (vk->ray_tracing) {
+		create_compute_target(vk);
+		if (vk->wavefront.pipeline_layout)
+			resize_wavefront(vk);
+	}
+	memset(vk->imagesInFlight, 0, sizeof(VkFence) * vk->buffer_count);
+	create_command_buffers(vk);
+}
@@ -5,9 +5,12 @@ void create_validation_layer(VkInfo* vk_info);
 void create_swapchain(VkInfo* vk_info, GLFWwindow** window, uint32_t width, uint32_t height);
 void create_image_views(VkInfo* info);
 void create_pipeline(VkInfo* info);
+void create_graphics_pipeline(VkInfo* info, const ShaderVariant* variant, VkPipeline* pipeline);
 void create_render_pass(VkInfo* info);
 void create_frame_buffers(VkInfo* info);
 void create_command_buffers(VkInfo* info);
+void record_command_buffer(VkInfo* info, uint32_t i);
+void rerecord_command_buffers(VkInfo* info);
 void create_semaphores(VkInfo* info);
 
 	
@@ -1,7 +1,9 @@
 ﻿
 #include <stdint.h>
+#include <string.h>
 #include <vulkan/vulkan_core.h>
 
+#include "Allocator.h"
 #include "Globals.h"
 #include "Util.h"
 #include "VulkanUtil.h"
@@ -26,35 +28,28 @@ void createBuffer(VkInfo* vk, VkDeviceSize size, VkBufferUsageFlags usage, VkMem
 	check(vkCreateBuffer(vk->device, &bufferInfo, NULL, buffer),
 		"Failed to create buffer");
 
-	VkMemoryAllocateFlags allocate_flags = 0;
-	if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
-		allocate_flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-
-	VkMemoryRequirements memRequirements;
-	vkGetBufferMemoryRequirements(vk->device, *buffer, &memRequirements);
-
-	VkMemoryAllocateFlagsInfo allocation_flags = {
-	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-	.flags = allocate_flags,
-	.deviceMask = 1,
-	};
-
-	VkMemoryAllocateInfo allocation_info = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.pNext = (allocate_flags != 0) ? &allocation_flags : NULL,
-		.allocationSize = memRequirements.size
-	};
-
-
-	uint32_t memtype = findMemoryType(vk, memRequirements.memoryTypeBits, properties);
-	if (memtype == (uint32_t)-1) error("Failed to find correct memory type");
-	allocation_info.memoryTypeIndex = memtype;
+	allocate_buffer_memory(vk, *buffer, usage, properties, bufferMemory);
+}
 
+// destroys the buffer and gives its memory back to the allocator
+void destroyBuffer(VkInfo* vk, VkBuffer buffer)
+{
+	if (!buffer) return;
+	vkDestroyBuffer(vk->device, buffer, NULL);
+	release_memory(vk, (uint64_t)buffer);
+}
 
-	check(vkAllocateMemory(vk->device, &allocation_info, NULL, bufferMemory),
-		"Failed to allocate buffer memory");
+void destroyImage(VkInfo* vk, VkImage image)
+{
+	if (!image) return;
+	vkDestroyImage(vk->device, image, NULL);
+	release_memory(vk, (uint64_t)image);
+}
 
-	check(vkBindBufferMemory(vk->device, *buffer, *bufferMemory, 0), "");
+// host visible memory stays mapped, this is just the pointer to the buffer in it
+void* mapBuffer(VkInfo* vk, VkBuffer buffer)
+{
+	return map_memory(vk, (uint64_t)buffer);
 }
 
 VkDeviceAddress getBufferDeviceAddress(VkInfo* info, VkBuffer buf)
@@ -108,4 +103,35 @@ void copyBuffer(VkInfo* vk, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize
 	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
 	endSingleTimeCommands(vk, commandBuffer);
+}
+
+// writes data to the buffer at offset, device local buffers get it through a staging buffer
+void uploadBufferRange(VkInfo* vk, Buffer* buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+	if (size == 0) return;
+	if (buffer->properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		memcpy((char*)mapBuffer(vk, buffer->vk_buffer) + offset, data, size);
+		return;
+	}
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(vk, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer, &stagingBufferMemory);
+
+	memcpy(mapBuffer(vk, stagingBuffer), data, size);
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vk);
+	VkBufferCopy copyRegion = { .srcOffset = 0, .dstOffset = offset, .size = size };
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer->vk_buffer, 1, &copyRegion);
+	endSingleTimeCommands(vk, commandBuffer);
+
+	destroyBuffer(vk, stagingBuffer);
+}
+
+void uploadBuffer(VkInfo* vk, Buffer* buffer, const void* data, VkDeviceSize size)
+{
+	uploadBufferRange(vk, buffer, 0, data, size);
 }
\ No newline at end of file
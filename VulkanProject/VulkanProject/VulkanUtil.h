@@ -4,7 +4,12 @@
 #include "Globals.h"
 uint32_t findMemoryType(VkInfo* vk, uint32_t type_filter, VkMemoryPropertyFlags properties);
 void createBuffer(VkInfo* vk, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* bufferMemory);
+void destroyBuffer(VkInfo* vk, VkBuffer buffer);
+void destroyImage(VkInfo* vk, VkImage image);
+void* mapBuffer(VkInfo* vk, VkBuffer buffer);
 VkDeviceAddress getBufferDeviceAddress(VkInfo* info, VkBuffer buf);
 VkCommandBuffer beginSingleTimeCommands(VkInfo* vk);
 void endSingleTimeCommands(VkInfo* vk, VkCommandBuffer commandBuffer);
-void copyBuffer(VkInfo* vk, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
\ No newline at end of file
+void copyBuffer(VkInfo* vk, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+void uploadBuffer(VkInfo* vk, Buffer* buffer, const void* data, VkDeviceSize size);
+void uploadBufferRange(VkInfo* vk, Buffer* buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
\ No newline at end of file
@@ -0,0 +1,404 @@
+﻿#include "Wavefront.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Bindings.h"
+#include "Compute.h"
+#include "Shader.h"
+#include "Util.h"
+#include "VulkanUtil.h"
+
+// the wavefront mode splits the megakernel into passes that are connected by queues in GPU memory:
+// generate -> (args -> trace -> shade -> args -> shadow) per bounce -> resolve
+// rays are compacted by atomics when they are appended, and binned by type so the trace pass sees
+// straight rays (primary, transmission) and reflection rays in separate contiguous ranges.
+// all rays start at the root TLAS so there is no point in binning by starting TLAS
+
+typedef struct wavefrontPush {
+	uint32_t bounce;
+	uint32_t side; // which half of the ping-pong ray queue is read
+	uint32_t image_index; // stats slot
+	uint32_t stage; // ARGS pass: 0 trace arguments, 1 shadow arguments
+} WavefrontPush;
+
+static void create_wavefront_buffer(VkInfo* vk, Buffer* buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+	createBuffer(vk, size, usage, properties, &buffer->vk_buffer, &buffer->vk_buffer_memory);
+	buffer->buffer_size = size;
+	buffer->usage = usage;
+	buffer->properties = properties;
+}
+
+static void destroy_wavefront_buffer(VkInfo* vk, Buffer* buffer)
+{
+	destroyBuffer(vk, buffer->vk_buffer);
+	memset(buffer, 0, sizeof(Buffer));
+}
+
+// set 5, in the order of the buffers in create_wavefront_queues
+#define WAVEFRONT_BUFFER_COUNT 6
+static const uint32_t binding_numbers[WAVEFRONT_BUFFER_COUNT] = { WAVEFRONT_RAY_BINDING, WAVEFRONT_HIT_BINDING,
+	WAVEFRONT_SHADOW_BINDING, WAVEFRONT_COUNTER_BINDING, WAVEFRONT_ACCUM_BINDING, WAVEFRONT_STATS_BINDING };
+
+// the queues hold a ray per pixel, everything here is replaced when the window is resized
+static void create_wavefront_queues(VkInfo* vk)
+{
+	Wavefront* wf = &vk->wavefront;
+	ComputeTarget* target = &vk->compute_target;
+	wf->capacity = target->extent.width * target->extent.height;
+
+	// buffers, one queue bin holds a ray per pixel, overflow is dropped and counted
+	VkDeviceSize capacity = wf->capacity;
+	VkBufferUsageFlags storage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	create_wavefront_buffer(vk, &wf->rays, 2 * WAVEFRONT_RAY_BINS * capacity * sizeof(WavefrontRay),
+		storage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	create_wavefront_buffer(vk, &wf->hits, WAVEFRONT_RAY_BINS * capacity * sizeof(WavefrontHit),
+		storage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	create_wavefront_buffer(vk, &wf->shadow_rays, capacity * sizeof(WavefrontShadowRay),
+		storage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	create_wavefront_buffer(vk, &wf->counters, sizeof(WavefrontCounters),
+		storage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	create_wavefront_buffer(vk, &wf->accumulation, 3 * capacity * sizeof(uint32_t),
+		storage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	create_wavefront_buffer(vk, &wf->stats, vk->swapchain.image_count * sizeof(WavefrontStats),
+		storage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	Buffer* buffers[] = { &wf->rays, &wf->hits, &wf->shadow_rays, &wf->counters, &wf->accumulation, &wf->stats };
+	const uint32_t buffer_count = WAVEFRONT_BUFFER_COUNT;
+
+	VkDescriptorBufferInfo buffer_infos[WAVEFRONT_BUFFER_COUNT];
+	VkWriteDescriptorSet writes[WAVEFRONT_BUFFER_COUNT];
+	for (uint32_t i = 0; i < buffer_count; i++)
+	{
+		buffer_infos[i].buffer = buffers[i]->vk_buffer;
+		buffer_infos[i].offset = 0;
+		buffer_infos[i].range = buffers[i]->buffer_size;
+
+		VkWriteDescriptorSet write = { 0 };
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = wf->descriptor_set;
+		write.dstBinding = binding_numbers[i];
+		write.dstArrayElement = 0;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.descriptorCount = 1;
+		write.pBufferInfo = &buffer_infos[i];
+		writes[i] = write;
+	}
+	vkUpdateDescriptorSets(vk->device, buffer_count, writes, 0, NULL);
+}
+
+static void destroy_wavefront_queues(VkInfo* vk)
+{
+	Wavefront* wf = &vk->wavefront;
+	destroy_wavefront_buffer(vk, &wf->rays);
+	destroy_wavefront_buffer(vk, &wf->hits);
+	destroy_wavefront_buffer(vk, &wf->shadow_rays);
+	destroy_wavefront_buffer(vk, &wf->counters);
+	destroy_wavefront_buffer(vk, &wf->accumulation);
+	destroy_wavefront_buffer(vk, &wf->stats);
+}
+
+void create_wavefront(VkInfo* vk)
+{
+	Wavefront* wf = &vk->wavefront;
+	ComputeTarget* target = &vk->compute_target;
+	// set 5 - the wavefront buffers, written by create_wavefront_queues
+	const uint32_t buffer_count = WAVEFRONT_BUFFER_COUNT;
+
+	VkDescriptorSetLayoutBinding bindings[WAVEFRONT_BUFFER_COUNT];
+	for (uint32_t i = 0; i < buffer_count; i++)
+	{
+		bindings[i].binding = binding_numbers[i];
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[i].pImmutableSamplers = NULL;
+	}
+	VkDescriptorSetLayoutCreateInfo layout_create_info = { 0 };
+	layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_create_info.bindingCount = buffer_count;
+	layout_create_info.pBindings = bindings;
+	check(vkCreateDescriptorSetLayout(vk->device, &layout_create_info, NULL, &wf->set_layout), "");
+
+	VkDescriptorPoolSize pool_size = { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = buffer_count };
+	VkDescriptorPoolCreateInfo pool_info = { 0 };
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &pool_size;
+	pool_info.maxSets = 1;
+	check(vkCreateDescriptorPool(vk->device, &pool_info, NULL, &wf->descriptor_pool), "");
+
+	VkDescriptorSetAllocateInfo alloc_info = { 0 };
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = wf->descriptor_pool;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = &wf->set_layout;
+	check(vkAllocateDescriptorSets(vk->device, &alloc_info, &wf->descriptor_set), "");
+
+	create_wavefront_queues(vk);
+
+	// one pipeline per pass, all from the same module
+	char path[128];
+	ray_shader_binary(vk, "wavefront.comp", path, sizeof(path));
+	load_shader(vk, &wf->shader, path);
+
+	VkDescriptorSetLayout layouts[] = {
+		vk->global_buffers.set_layout,
+		vk->texture_container.layout,
+		vk->per_frame_buffers.set_layout,
+		vk->ray_descriptor.set_layout,
+		target->set_layout,
+		wf->set_layout
+	};
+	VkPushConstantRange push_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(WavefrontPush)
+	};
+	VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 6;
+	pipeline_layout_info.pSetLayouts = layouts;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &push_range;
+	check(vkCreatePipelineLayout(vk->device, &pipeline_layout_info, NULL, &wf->pipeline_layout),
+		"failed to create wavefront pipeline layout");
+
+	create_wavefront_pipelines(vk, &vk->variant, wf->pipelines);
+
+	// timestamps: start, after generate, three per bounce (trace, shade, shadow), after resolve
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	wf->timestamp_period = properties.limits.timestampPeriod;
+	wf->queries_per_image = 3 + 3 * WAVEFRONT_MAX_BOUNCES;
+
+	VkQueryPoolCreateInfo query_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = wf->queries_per_image * vk->swapchain.image_count
+	};
+	check(vkCreateQueryPool(vk->device, &query_info, NULL, &wf->query_pool), "failed to create query pool");
+
+	// queries have to be reset once before they can be read, even if they were never written
+	VkCommandBuffer cb = beginSingleTimeCommands(vk);
+	vkCmdResetQueryPool(cb, wf->query_pool, 0, query_info.queryCount);
+	endSingleTimeCommands(vk, cb);
+}
+
+void create_wavefront_pipelines(VkInfo* vk, const ShaderVariant* variant, VkPipeline* pipelines)
+{
+	Wavefront* wf = &vk->wavefront;
+	// constant 0 is the pass, the shader variant follows
+	uint32_t spec_data[1 + SHADER_VARIANT_CONSTANTS];
+	VkSpecializationMapEntry spec_entries[1 + SHADER_VARIANT_CONSTANTS] = {
+		{.constantID = 0, .offset = 0, .size = sizeof(uint32_t) }
+	};
+	VkSpecializationInfo spec_info = {
+		.mapEntryCount = append_variant_constants(variant, spec_data, spec_entries, 1),
+		.pMapEntries = spec_entries,
+		.dataSize = sizeof(spec_data),
+		.pData = spec_data
+	};
+	for (uint32_t pass = 0; pass < WAVEFRONT_PASS_COUNT; pass++)
+	{
+		spec_data[0] = pass;
+		VkComputePipelineCreateInfo pipeline_info = {
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.stage = {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = wf->shader.module,
+				.pName = "main",
+				.pSpecializationInfo = &spec_info
+			},
+			.layout = wf->pipeline_layout
+		};
+		check(vkCreateComputePipelines(vk->device, vk->pipeline_cache, 1, &pipeline_info, NULL, &pipelines[pass]),
+			"failed to create wavefront pipeline");
+	}
+}
+
+void destroy_wavefront_pipelines(VkInfo* vk)
+{
+	Wavefront* wf = &vk->wavefront;
+	for (uint32_t pass = 0; pass < WAVEFRONT_PASS_COUNT; pass++)
+	{
+		if (wf->pipelines[pass]) vkDestroyPipeline(vk->device, wf->pipelines[pass], NULL);
+		wf->pipelines[pass] = NULL;
+	}
+}
+
+static void compute_barrier(VkCommandBuffer cb, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = dst_access
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static void bind_pass(VkInfo* vk, VkCommandBuffer cb, uint32_t pass, WavefrontPush* push)
+{
+	Wavefront* wf = &vk->wavefront;
+	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, wf->pipelines[pass]);
+	vkCmdPushConstants(cb, wf->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(WavefrontPush), push);
+}
+
+void record_wavefront(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index)
+{
+	Wavefront* wf = &vk->wavefront;
+	uint32_t first_query = image_index * wf->queries_per_image;
+	uint32_t query = first_query;
+	uint32_t pixel_groups = (wf->capacity + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+	VkDeviceSize trace_args = offsetof(WavefrontCounters, trace_args);
+	VkDeviceSize shadow_args = offsetof(WavefrontCounters, shadow_args);
+	VkPipelineStageFlags next_dispatch = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+	VkAccessFlags next_dispatch_access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdResetQueryPool(cb, wf->query_pool, first_query, wf->queries_per_image);
+
+	// the queues are shared between frames in flight, wait until the last frame is done with them
+	VkMemoryBarrier reuse = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &reuse, 0, NULL, 0, NULL);
+	vkCmdFillBuffer(cb, wf->counters.vk_buffer, 0, VK_WHOLE_SIZE, 0);
+	vkCmdFillBuffer(cb, wf->accumulation.vk_buffer, 0, VK_WHOLE_SIZE, 0);
+	vkCmdFillBuffer(cb, wf->stats.vk_buffer, image_index * sizeof(WavefrontStats), sizeof(WavefrontStats), 0);
+	VkMemoryBarrier cleared = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &cleared, 0, NULL, 0, NULL);
+
+	record_compute_target_begin(vk, cb);
+
+	VkDescriptorSet sets[] = {
+		vk->global_buffers.descriptor_sets[0],
+		vk->texture_container.descriptor_set,
+		vk->per_frame_buffers.descriptor_sets[image_index],
+		vk->ray_descriptor.descriptor_set,
+		vk->compute_target.descriptor_set,
+		wf->descriptor_set
+	};
+	vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, wf->pipeline_layout,
+		0, 6, sets, 0, NULL);
+
+	WavefrontPush push = { .bounce = 0, .side = 0, .image_index = image_index, .stage = 0 };
+
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, wf->query_pool, query++);
+	bind_pass(vk, cb, WAVEFRONT_PASS_GENERATE, &push);
+	vkCmdDispatch(cb, pixel_groups, 1, 1);
+	compute_barrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, wf->query_pool, query++);
+
+	// empty bounces cost an args dispatch and two empty indirect dispatches each
+	for (uint32_t bounce = 0; bounce < WAVEFRONT_MAX_BOUNCES; bounce++)
+	{
+		push.bounce = bounce;
+		push.side = bounce % 2;
+
+		push.stage = 0;
+		bind_pass(vk, cb, WAVEFRONT_PASS_ARGS, &push);
+		vkCmdDispatch(cb, 1, 1, 1);
+		compute_barrier(cb, next_dispatch, next_dispatch_access);
+
+		bind_pass(vk, cb, WAVEFRONT_PASS_TRACE, &push);
+		vkCmdDispatchIndirect(cb, wf->counters.vk_buffer, trace_args);
+		compute_barrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, wf->query_pool, query++);
+
+		bind_pass(vk, cb, WAVEFRONT_PASS_SHADE, &push);
+		vkCmdDispatchIndirect(cb, wf->counters.vk_buffer, trace_args);
+		compute_barrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, wf->query_pool, query++);
+
+		push.stage = 1;
+		bind_pass(vk, cb, WAVEFRONT_PASS_ARGS, &push);
+		vkCmdDispatch(cb, 1, 1, 1);
+		compute_barrier(cb, next_dispatch, next_dispatch_access);
+
+		bind_pass(vk, cb, WAVEFRONT_PASS_SHADOW, &push);
+		vkCmdDispatchIndirect(cb, wf->counters.vk_buffer, shadow_args);
+		compute_barrier(cb, next_dispatch, next_dispatch_access);
+		vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, wf->query_pool, query++);
+	}
+
+	bind_pass(vk, cb, WAVEFRONT_PASS_RESOLVE, &push);
+	vkCmdDispatch(cb, pixel_groups, 1, 1);
+	vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, wf->query_pool, query++);
+
+	// the stats are read on the host once the fence of this image signaled
+	compute_barrier(cb, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+	record_compute_target_blit(vk, cb, image_index);
+}
+
+void read_wavefront_stats(VkInfo* vk, uint32_t image_index)
+{
+	Wavefront* wf = &vk->wavefront;
+	if (!wf->query_pool) return;
+
+	uint64_t* timestamps = malloc(sizeof(uint64_t) * wf->queries_per_image);
+	VkResult result = vkGetQueryPoolResults(vk->device, wf->query_pool, image_index * wf->queries_per_image,
+		wf->queries_per_image, sizeof(uint64_t) * wf->queries_per_image, timestamps, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT);
+	if (result == VK_SUCCESS)
+	{
+		float ms = wf->timestamp_period / 1000000.0f;
+		memset(wf->pass_ms, 0, sizeof(wf->pass_ms));
+		wf->pass_ms[WAVEFRONT_PASS_GENERATE] = (float)(timestamps[1] - timestamps[0]) * ms;
+		uint64_t previous = timestamps[1];
+		for (uint32_t bounce = 0; bounce < WAVEFRONT_MAX_BOUNCES; bounce++)
+		{
+			uint64_t* t = &timestamps[2 + 3 * bounce];
+			// args dispatches are counted to the pass they prepare
+			wf->pass_ms[WAVEFRONT_PASS_TRACE] += (float)(t[0] - previous) * ms;
+			wf->pass_ms[WAVEFRONT_PASS_SHADE] += (float)(t[1] - t[0]) * ms;
+			wf->pass_ms[WAVEFRONT_PASS_SHADOW] += (float)(t[2] - t[1]) * ms;
+			previous = t[2];
+		}
+		wf->pass_ms[WAVEFRONT_PASS_RESOLVE] = (float)(timestamps[wf->queries_per_image - 1] - previous) * ms;
+	}
+	free(timestamps);
+
+	WavefrontStats* stats = (WavefrontStats*)((char*)mapBuffer(vk, wf->stats.vk_buffer) + image_index * sizeof(WavefrontStats));
+	for (uint32_t i = 0; i < WAVEFRONT_STAT_PASSES; i++)
+	{
+		WavefrontPassStats* pass = &stats->passes[i];
+		wf->rays_per_pass[i] = pass->rays;
+		wf->efficiency[i] = pass->lockstep > 0 ? (float)pass->work / (float)pass->lockstep : 1.0f;
+	}
+	wf->dropped = stats->dropped;
+	wf->pruned = stats->pruned;
+}
+
+void resize_wavefront(VkInfo* vk)
+{
+	destroy_wavefront_queues(vk);
+	create_wavefront_queues(vk);
+}
+
+void destroy_wavefront(VkInfo* vk)
+{
+	Wavefront* wf = &vk->wavefront;
+	destroy_wavefront_pipelines(vk);
+	if (wf->pipeline_layout) vkDestroyPipelineLayout(vk->device, wf->pipeline_layout, NULL);
+	if (wf->shader.module) vkDestroyShaderModule(vk->device, wf->shader.module, NULL);
+	free(wf->shader.code);
+	if (wf->query_pool) vkDestroyQueryPool(vk->device, wf->query_pool, NULL);
+	if (wf->descriptor_pool) vkDestroyDescriptorPool(vk->device, wf->descriptor_pool, NULL);
+	if (wf->set_layout) vkDestroyDescriptorSetLayout(vk->device, wf->set_layout, NULL);
+
+	destroy_wavefront_queues(vk);
+
+	memset(wf, 0, sizeof(Wavefront));
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+#include "Globals.h"
+
+// mirrors the buffers in wavefront.comp
+typedef struct wavefrontRay {
+	float origin[3];
+	float contribution;
+	float direction[3];
+	uint32_t pixel;
+} WavefrontRay;
+
+typedef struct wavefrontHit {
+	float tuv[3];
+	int32_t triangle; // -1 for a miss
+	float normal[3]; // world space
+	int32_t lod;
+} WavefrontHit;
+
+typedef struct wavefrontShadowRay {
+	float origin[3];
+	float t_max;
+	float direction[3];
+	uint32_t pixel;
+	float radiance[3]; // added to the pixel if the light is visible
+	int32_t lod;
+} WavefrontShadowRay;
+
+#define WAVEFRONT_RAY_BINS 2 // straight (primary and transmission) and reflection rays
+#define WAVEFRONT_GROUP_SIZE 64
+
+typedef struct wavefrontCounters {
+	uint32_t ray_count[2 * WAVEFRONT_RAY_BINS]; // [side * bins + bin]
+	uint32_t shadow_count;
+	VkDispatchIndirectCommand trace_args;
+	VkDispatchIndirectCommand shadow_args;
+	uint32_t pad;
+} WavefrontCounters;
+
+typedef struct wavefrontPassStats {
+	uint32_t rays; // lanes that had a ray
+	uint32_t work; // summed per lane work (traversal iterations, lights, ...)
+	uint32_t lockstep; // subgroup max work * subgroup size, what the hardware actually paid for
+	uint32_t subgroups;
+} WavefrontPassStats;
+
+typedef struct wavefrontStats {
+	WavefrontPassStats passes[WAVEFRONT_STAT_PASSES];
+	uint32_t dropped; // rays that did not fit into a queue
+	uint32_t pruned; // reflection and transmission rays below the contribution threshold
+	uint32_t pad[2];
+} WavefrontStats;
+
+void create_wavefront(VkInfo* vk);
+// the per pass pipelines of a variant, WAVEFRONT_PASS_COUNT of them
+void create_wavefront_pipelines(VkInfo* vk, const ShaderVariant* variant, VkPipeline* pipelines);
+void destroy_wavefront_pipelines(VkInfo* vk);
+void record_wavefront(VkInfo* vk, VkCommandBuffer cb, uint32_t image_index);
+void read_wavefront_stats(VkInfo* vk, uint32_t image_index);
+// new queues for the size of the compute target, the set and pipelines stay
+void resize_wavefront(VkInfo* vk);
+void destroy_wavefront(VkInfo* vk);
@@ -4,26 +4,71 @@ struct QueryTrace {
 	float t;
 	vec3 end;
 	uint nodeNumber;
-	uint isValid; // valid if 1, otherwise invalid
+	uint isValid; // 1 for a query, 2 for a lod selection, otherwise invalid
 	int nodeLevel; // the nodeNumber for this
-	uint triangleIntersections;
+	uint triangleIntersections; // triangle candidates of the query
 	uint instanceIntersections;
+	uint pixel; // x | y << 16
+	uint sequence; // order of the records of one pixel
 };
 
-layout(binding = TRACE_BINDING, set = 3) buffer QueryTraceBuffer { QueryTrace[] queryTraces; };
+// ring of the records of all traced pixels, traceHead counts every record since the host reset it
+layout(binding = TRACE_BINDING, set = 3) buffer QueryTraceBuffer {
+	uint traceHead;
+	QueryTrace[] queryTraces;
+};
+
+// traversal cost per scene node over a benchmark, same as NodeCost in Globals.h
+struct NodeCost {
+	uint queries;
+	uint candidates;
+	uint hits;
+};
+layout(binding = NODE_COST_BINDING, set = 3) buffer NodeCostBuffer { NodeCost nodeCosts[]; };
+
+// called after every query, only every NODE_PROFILE_STRIDE-th pixel counts
+void recordNodeCost(uint node, uint candidates, bool hit) {
+	if (!collectNodeCosts || any(notEqual(pixelCoord % NODE_PROFILE_STRIDE, ivec2(0)))) return;
+	uint hits = hit ? 1 : 0;
+#ifndef NO_SUBGROUP_ARITHMETIC
+	// near the root the whole subgroup queries the same node, those lanes go out as one atomic
+	if (subgroupMin(node) == subgroupMax(node)) {
+		uint queries = subgroupAdd(1u);
+		candidates = subgroupAdd(candidates);
+		hits = subgroupAdd(hits);
+		if (subgroupElect()) {
+			atomicAdd(nodeCosts[node].queries, queries);
+			atomicAdd(nodeCosts[node].candidates, candidates);
+			atomicAdd(nodeCosts[node].hits, hits);
+		}
+		return;
+	}
+#endif
+	atomicAdd(nodeCosts[node].queries, 1);
+	atomicAdd(nodeCosts[node].candidates, candidates);
+	if (hit) atomicAdd(nodeCosts[node].hits, 1);
+}
 
 bool recordTrace = false;
 uint nextRecord = 0;
+uint tracedPixel = 0;
 void startTraceRecord() {
-	ivec2 xy = ivec2(gl_FragCoord.xy);
-	if (recordQueryTrace && xy.x == pixelX && xy.y == pixelY) {
+	ivec2 xy = pixelCoord - ivec2(pixelX, pixelY);
+	if (recordQueryTrace && all(greaterThanEqual(xy, ivec2(0))) && xy.x < traceWidth && xy.y < traceHeight
+		&& xy.x % traceStride == 0 && xy.y % traceStride == 0) {
 		recordTrace = true;
 		nextRecord = 0;
-		queryTraces[0].isValid = 1;
+		tracedPixel = uint(pixelCoord.x) | (uint(pixelCoord.y) << 16);
 	}
 }
+void addTrace(QueryTrace add) {
+	add.pixel = tracedPixel;
+	add.sequence = nextRecord;
+	nextRecord++;
+	queryTraces[atomicAdd(traceHead, 1) % traceMax] = add;
+}
 void recordQuery(uint nodeNumber, int nodeLevel, float t, vec3 start, vec3 end, uint triangleIntersections, uint instanceIntersections) { // records the 
-	if (!recordTrace || nextRecord >= traceMax - 2) return;
+	if (!recordTrace) return;
 	QueryTrace add;
 	add.start = start;
 	add.end = end;
@@ -33,33 +78,29 @@ void recordQuery(uint nodeNumber, int nodeLevel, float t, vec3 start, vec3 end,
 	add.triangleIntersections = triangleIntersections;
 	add.instanceIntersections = instanceIntersections;
 	add.t = t;
-
-	// add
-	queryTraces[nextRecord] = add;
-	nextRecord++;
+	addTrace(add);
 }
 void recordLODSelect(int node, mat4 world_to_object, float tNear, float rObject, float rWorld, float rPixel, float eigMax, int lod) {
-	if (!recordTrace || nextRecord >= traceMax - 2) return;
+	if (!recordTrace) return;
 	QueryTrace add;
 	add.matrix = world_to_object;
 	add.start = vec3(rObject, rWorld, rPixel);
 	add.end = vec3(eigMax, 0, 0);
 	add.nodeLevel = lod;
 	add.nodeNumber = node;
-	add.isValid = 1;
-	add.triangleIntersections = 123;
-	add.instanceIntersections = 321;
+	add.isValid = 2;
+	add.triangleIntersections = 0;
+	add.instanceIntersections = 0;
 	add.t = tNear;
-	// add
-	queryTraces[nextRecord] = add;
-	nextRecord++;
+	addTrace(add);
 }
 void checkQueryTrace(vec3 origin, vec3 direction) {
-	if (!debug || !displayQueryTrace) return;
+	if (!DEBUG_VIEW || !displayQueryTrace) return;
 	int index = -1;
-	for (int i = 0; i < traceMax; i++) {
+	uint count = min(traceHead, traceMax);
+	for (uint i = 0; i < count; i++) {
 		QueryTrace trace = queryTraces[i];
-		if (trace.isValid != 1) break; // is valid?
+		if (trace.isValid != 1) continue; // only queries are drawn
 		if (displayByLevel) {
 			if (trace.nodeLevel / 2 != selectedLevel)
 				continue;
@@ -77,17 +118,13 @@ void checkQueryTrace(vec3 origin, vec3 direction) {
 		vec3 P = trace.start + ts[0] * E1;
 		float dst = length(P - origin);
 		if (dst < 0.005 || dst > 50) continue; // to close to the display or to far away
-		index = i;
+		index = int(i);
 	}
 	if (index != -1) {
-		SceneNode node = nodes[queryTraces[index].nodeNumber];
+		SceneNode node = loadNode(queryTraces[index].nodeNumber);
 		SetDebugHsv(displayQueryTrace, node.TlasNumber, colorSensitivity, false);
 	}
 }
 void endRecord() {
-	if (!recordTrace) return;
-	// adds an invalid record at the end of the list
-	QueryTrace end;
-	end.isValid = 0;
-	queryTraces[nextRecord] = end;
+	recordTrace = false;
 }
\ No newline at end of file
@@ -0,0 +1,18 @@
+@echo off
+rem precompiles the spir-v next to the project, run from the project directory (the pre build event does this)
+rem the variants (opacity check, debug views, stack size, depth cap) are specialization constants and need no extra builds
+rem the ray shaders are built again without subgroup arithmetic and/or quad operations, see ray_shader_binary in Shader.c
+set GLSLANG=glslangValidator.exe -g --target-env vulkan1.2
+%GLSLANG% shaders/shader.vert -o shader.vert.spv || exit /b 1
+call :ray shader.frag shader.frag || exit /b 1
+call :ray raytrace.comp shader.comp || exit /b 1
+call :ray wavefront.comp wavefront.comp || exit /b 1
+call :ray visibility.comp visibility.comp || exit /b 1
+exit /b 0
+
+:ray
+%GLSLANG% shaders/%1 -o %2.spv || exit /b 1
+%GLSLANG% shaders/%1 -DNO_SUBGROUP_ARITHMETIC -o %2.noarith.spv || exit /b 1
+%GLSLANG% shaders/%1 -DNO_SUBGROUP_QUAD -o %2.noquad.spv || exit /b 1
+%GLSLANG% shaders/%1 -DNO_SUBGROUP_ARITHMETIC -DNO_SUBGROUP_QUAD -o %2.noarith.noquad.spv || exit /b 1
+exit /b 0
@@ -15,7 +15,7 @@ vec3 hsv2rgb(vec3 c)
 }
 
 void SetDebugHsv(bool option, float number, float range, bool clampValue) {
-	if (!option) return;
+	if (!DEBUG_DISPLAYS || !option) return;
 	if (!debugSetEnabled) return;
 	float x = number / range;
 	if (clampValue)
@@ -24,7 +24,7 @@ void SetDebugHsv(bool option, float number, float range, bool clampValue) {
 }
 
 void SetDebugCol(bool option, vec4 color) {
-	if (!option) return;
+	if (!DEBUG_DISPLAYS || !option) return;
 	if (!debugSetEnabled) return;
 	debugColor = color;
 }
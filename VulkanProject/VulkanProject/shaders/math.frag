@@ -37,4 +37,16 @@ mat4 getTransform(vec4 q, vec3 t){
 mat4x3 inv(mat4x3 tr){
 	mat3 rot = inverse(mat3(tr));
 	return mat4x3(rot[0],rot[1],rot[2],-(rot*tr[3]));
-}
\ No newline at end of file
+}
+// octahedral normal encoding, see "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al.)
+vec2 octEncode(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0) e = (1 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+	return e;
+}
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+	if (n.z < 0) n.xy = (1 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+	return normalize(n);
+}
@@ -9,19 +9,52 @@ layout(binding = TLAS_BINDING, set = 3) uniform accelerationStructureEXT[] tlas;
 #ifndef MATH
 #include "math.frag"
 #endif
+// interpolated object space normal of a triangle intersection
+vec3 getHitNormal(int triangle, vec3 tuv) {
+	Vertex v0 = loadVertex(loadIndex(triangle, 0));
+	Vertex v1 = loadVertex(loadIndex(triangle, 1));
+	Vertex v2 = loadVertex(loadIndex(triangle, 2));
+	float w = 1 - tuv.y - tuv.z;
+	return normalize(w * v0.normal + tuv.z * v1.normal + tuv.y * v2.normal);
+}
+// mip level of a texture for a ray cone that is footprint wide on the surface, from the texel to surface area ratio
+// of the triangle (ray tracing gems, texture level of detail strategies for real-time ray tracing).
+// like selectLOD this takes object space as world space and ignores the scale of the instance
+float textureLevel(int textureIndex, Vertex v0, Vertex v1, Vertex v2, float footprint) {
+	if (footprint <= 0) return 0;
+	vec2 size = vec2(textureSize(sampler2D(textures[textureIndex], samp), 0));
+	vec2 uv1 = (v1.tex_coord - v0.tex_coord) * size;
+	vec2 uv2 = (v2.tex_coord - v0.tex_coord) * size;
+	float texelArea = abs(uv1.x * uv2.y - uv2.x * uv1.y);
+	float area = length(cross(v1.position - v0.position, v2.position - v0.position));
+	return 0.5f * log2(max(texelArea, 1e-12f) / max(area, 1e-12f)) + log2(footprint);
+}
+
+// curvature (1 / radius) the interpolated normals of a triangle describe, the largest change of the normal per
+// length along its edges. zero for flat shaded triangles
+float getHitCurvature(int triangle) {
+	Vertex v0 = loadVertex(loadIndex(triangle, 0));
+	Vertex v1 = loadVertex(loadIndex(triangle, 1));
+	Vertex v2 = loadVertex(loadIndex(triangle, 2));
+	float k0 = length(v1.normal - v0.normal) / max(length(v1.position - v0.position), 1e-6f);
+	float k1 = length(v2.normal - v1.normal) / max(length(v2.position - v1.position), 1e-6f);
+	float k2 = length(v0.normal - v2.normal) / max(length(v0.position - v2.position), 1e-6f);
+	return max(k0, max(k1, k2));
+}
+
 // retrieves material data and normal for triangle intersection
-void getHitPayload(int triangle, vec3 tuv, out vec3 N, out Material material) {
-	Vertex v0 = vertices[indices[triangle * 3]];
-	Vertex v1 = vertices[indices[triangle * 3 + 1]];
-	Vertex v2 = vertices[indices[triangle * 3 + 2]];
+// footprint is the width of the ray cone on the surface, 0 samples the full resolution texture
+void getHitPayload(int triangle, vec3 tuv, float footprint, out vec3 N, out Material material) {
+	Vertex v0 = loadVertex(loadIndex(triangle, 0));
+	Vertex v1 = loadVertex(loadIndex(triangle, 1));
+	Vertex v2 = loadVertex(loadIndex(triangle, 2));
 	float w = 1 - tuv.y - tuv.z;
 	float u = tuv.y;
 	float v = tuv.z;
 
 
 	// compute interpolated Normal and Tex - important this is in object space -> need to transform either 
-	N = w * v0.normal + v * v1.normal + u * v2.normal;
-	N = normalize(N);
+	N = getHitNormal(triangle, tuv);
 	vec2 tex = w * v0.tex_coord + v * v1.tex_coord + u * v2.tex_coord;
 
 	// get material and texture properties, if there are not set use default values
@@ -41,11 +74,12 @@ void getHitPayload(int triangle, vec3 tuv, out vec3 N, out Material material) {
 	else {
 		material = materials[v0.material_index];
 		if (material.texture_index >= 0)
-			material.color = texture(sampler2D(textures[material.texture_index], samp), tex);
+			material.color = textureLod(sampler2D(textures[material.texture_index], samp), tex,
+				textureLevel(material.texture_index, v0, v1, v2, footprint));
 	}
 
 	// debug
-	if (!debug) return;
+	if (!DEBUG_VIEW) return;
 
 	SetDebugCol(displayUV, vec4(u, v, 0, 1));
 	SetDebugCol(displayTex, vec4(tex.x, tex.y, 0, 1));
@@ -60,9 +94,32 @@ void getHitPayload(int triangle, vec3 tuv, out vec3 N, out Material material) {
 	else
 		SetDebugCol(displayTextureIdx, vec4(0.2, 0.4, 0.8, 1));
 }
+// ray cone and lod policy of the ray that is traced next. the cone is coneWidth wide at the origin of the ray and
+// widens by coneSpread per unit of t, generatePixelRay starts it with the angle of a pixel and shadeHit hands it on
+// to the rays it spawns. lodBias makes the selection coarser
+float coneWidth = 0;
+float coneSpread = 0;
+int lodBias = 0;
+
+// angle covered by a pixel
+float pixelSpread() {
+	return tan(PI / 180 * fov) / height;
+}
+
+// width of the ray cone at t
+float coneWidthAt(float t) {
+	return coneWidth + coneSpread * max(0, t);
+}
+
+// shadow rays stay on the lod of the surface they leave, shifted by their bias, so a coarse occluder can't shadow
+// the finer surface. without a selector on the way to the surface they select their own with the cone
+int shadowRayLod(int surfaceLod) {
+	return surfaceLod >= 0 ? max(surfaceLod + shadowLodBias, 0) : -1;
+}
+
 // selects the lod-node (TLAS) for an LOD-Selector
 SceneNode selectLOD(SceneNode selector, float tNear, mat3 tr, int parentLOD, out int lod){
-	SceneNode dummy = nodes[childIndices[selector.ChildrenIndex]];
+	SceneNode dummy = loadNode(childIndices[selector.ChildrenIndex]);
 	int N = dummy.NumChildren;
 	if(parentLOD >= 0) {
 		// if the lod is force use this
@@ -73,60 +130,129 @@ SceneNode selectLOD(SceneNode selector, float tNear, mat3 tr, int parentLOD, out
 		float rObject = length(selector.AABB_max-selector.AABB_min)/2;
 
 		float rMax = 5000;
-		float t = max(0,tNear);
-		float rPixel = rObject * height / (tan(PI / 180 * fov) * 2 * t);
-		lod = -int(log2(pow(2,N-1) * rPixel/rMax));
+		// rMax was chosen for twice the width of a pixel
+		float rPixel = rObject / (2 * coneWidthAt(tNear));
+		lod = -int(log2(pow(2,N-1) * rPixel/rMax)) + lodBias;
 		lod = max(lod, 0);
 	}
 	lod = min(lod, N-1);
-	return nodes[childIndices[dummy.ChildrenIndex + lod]];
+	return loadNode(childIndices[dummy.ChildrenIndex + lod]);
 }
 
 
 // ONLY modify these when in the instanceShader or the rayTrace Loop
+// a load only keeps the instance hit it was created from, the instanceShader replaces it with the node it resolved to
+// and the transforms on the way there. the world_to_object is rebuilt from these and the frame of its parent
+// when the load is popped. This keeps the stack small, a mat4x3 per load was most of its size
 struct TraversalPayload {
-	mat4x3 world_to_object;
+	int cIdx; // custom index of the instance hit; after compute: transform of the instance list instance or -1
+	int pIdx; // primitive index of the instance hit; after compute: transform of the blas
+	int sIdx; // shaderOffset (grandchild) of the instance hit; after compute: the next node; node index for the root
+	int tIdx; // after compute: transform of the blas instance list instance or -1
+	int lod; // before compute: LOD of the parent; after compute: LOD
+	int frame; // frame of the parent that executed the query; -1 for the root
 	float tNear; // the t for which this aabb was intersected
-	int cIdx_nIdx; // after compute: node index; before compute: custom index
-	int pIdx_lod; // after compute: LOD       ; before compute: primitve index
-	int sIdx_un; // after compute: unsused   ; bebore compute: shaderOffset (grandchild)
+};
+
+// a frame is the node that currently executes a query, and its world_to_object
+// since the traversal is depth first only one frame per level has to be kept, like a call stack
+struct TraversalFrame {
+	mat4x3 world_to_object;
+	int nodeIdx;
+};
+
+// result of the closest hit
+struct TraversalResult {
+	mat4x3 world_to_object;
+	int nodeIdx;
+	int lod;
+	float t;
 };
 
 // use a stack because:
 // keep the list as short as possible, I.E. use a depth first search
-const int TRAVERSAL_STACK_SIZE = 30;
+const int TRAVERSAL_FRAME_SIZE = 16;
 int stackSize = 0;	
 TraversalPayload traversalStack[TRAVERSAL_STACK_SIZE];
+TraversalFrame traversalFrames[TRAVERSAL_FRAME_SIZE];
 
 int traversalDepth = 0;
 uint numTraversals = 0;
 uint queryCount = 0;
-// gets called for every intersected PI after query has finished
-void instanceShader(SceneNode tlas, int index, vec3 rayOrigin, vec3 rayDirection, int parentLOD){	
-	TraversalPayload nextLoad = traversalStack[index];
-	mat4x3 world_to_object;
 
+// per pixel counters for the frame stats, summed up by recordFrameStats
+uint instanceHits = 0;
+uint triangleCandidates = 0;
+uint overflowDrops = 0;
+uint secondaryRays = 0; // reflection and transmission rays that were traced
+uint prunedRays = 0; // reflection and transmission rays that were not spawned for their low contribution
+uint evictedRays = 0; // rays that found the ray stack full
+int stackHighWater = 0;
+uint lodSelections[STATS_LOD_LEVELS] = uint[](0, 0, 0, 0, 0, 0, 0, 0);
+
+// prepends the inverse of a transform to world_to_object, -1 has no transform. the inverses are a table from load_scene
+mat4x3 prependInverse(mat4x3 world_to_object, int transformIdx) {
+	if (transformIdx < 0) return world_to_object;
+	return mat4x3(mat4(inverseTransforms[transformIdx]) * mat4(world_to_object));
+}
+
+// world_to_object of a resolved load, relative to the node that executed the query
+mat4x3 loadTransform(TraversalPayload load) {
+	mat4x3 world_to_object = prependInverse(mat4x3(1), load.cIdx);
+	world_to_object = prependInverse(world_to_object, load.pIdx);
+	return prependInverse(world_to_object, load.tIdx);
+}
+
+// resolves the instance hit of a load to the next node, the load keeps the transforms instead of the hit afterwards
+SceneNode resolveInstance(SceneNode tlas, inout TraversalPayload load) {
 	// compute the blas
 	SceneNode blas;
+	int instanceTransform = -1;
 	if(tlas.IsInstanceList)	{
-		SceneNode instance = nodes[nextLoad.cIdx_nIdx];
-		blas = nodes[nextLoad.sIdx_un];
-		world_to_object = mat4x3(mat4(inv(transforms[blas.TransformIndex])) * mat4(inv(transforms[instance.TransformIndex])));
+		SceneNode instance = loadNode(load.cIdx);
+		blas = loadNode(load.sIdx);
+		instanceTransform = instance.TransformIndex;
 	} else {
-		blas = nodes[nextLoad.cIdx_nIdx];
-		world_to_object = inv(transforms[blas.TransformIndex]);
+		blas = loadNode(load.cIdx);
 	}
 
 	// compute the next node
 	SceneNode next;
+	int listTransform = -1;
 	if(blas.IsInstanceList){
-		SceneNode dummy = nodes[childIndices[blas.ChildrenIndex]];
-		SceneNode instance = nodes[childIndices[dummy.ChildrenIndex+nextLoad.pIdx_lod]];
-		next = nodes[childIndices[instance.ChildrenIndex]];
-		world_to_object = mat4x3(mat4(inv(transforms[instance.TransformIndex])) * mat4(world_to_object));
+		SceneNode dummy = loadNode(childIndices[blas.ChildrenIndex]);
+		SceneNode instance = loadNode(childIndices[dummy.ChildrenIndex+load.pIdx]);
+		listTransform = instance.TransformIndex;
+		next = loadNode(childIndices[instance.ChildrenIndex]);
 	} else {
-		next = nodes[childIndices[blas.ChildrenIndex + nextLoad.pIdx_lod]];
+		next = loadNode(childIndices[blas.ChildrenIndex + load.pIdx]);
 	}
+	load.cIdx = instanceTransform;
+	load.pIdx = blas.TransformIndex;
+	load.tIdx = listTransform;
+	load.sIdx = next.Index;
+	return next;
+}
+
+// rebuilds world_to_object of a popped load and stores it in the frame, the node was already resolved by the instanceShader
+SceneNode enterFrame(TraversalPayload load, int frameIdx) {
+	SceneNode node = loadNode(load.sIdx);
+	mat4x3 world_to_object = mat4x3(1);
+	if (load.frame >= 0) {
+		TraversalFrame parent = traversalFrames[load.frame];
+		world_to_object = mat4x3(mat4(prependInverse(loadTransform(load), node.TransformIndex)) * mat4(parent.world_to_object));
+	}
+	traversalFrames[frameIdx].world_to_object = world_to_object;
+	traversalFrames[frameIdx].nodeIdx = node.Index;
+	return node;
+}
+
+// gets called for every intersected PI after query has finished
+void instanceShader(int index, vec3 rayOrigin, vec3 rayDirection){	
+	TraversalPayload nextLoad = traversalStack[index];
+	TraversalFrame frame = traversalFrames[nextLoad.frame];
+	SceneNode next = resolveInstance(loadNode(frame.nodeIdx), nextLoad);
+	mat4x3 world_to_object = loadTransform(nextLoad);
 
 	// discard is not possible without either reodering the buffer or some other operation
 	// therefore to discard an instance hit, set tMax to high value
@@ -137,28 +263,27 @@ void instanceShader(SceneNode tlas, int index, vec3 rayOrigin, vec3 rayDirection
 
 	// we can now do LOD or whatever we feel like doing
 	
-	vec3 origin = world_to_object * vec4(nextLoad.world_to_object * vec4(rayOrigin,1),1);
-	vec3 direction = world_to_object * vec4(nextLoad.world_to_object * vec4(rayDirection,0),0);
+	vec3 origin = world_to_object * vec4(frame.world_to_object * vec4(rayOrigin,1),1);
+	vec3 direction = world_to_object * vec4(frame.world_to_object * vec4(rayDirection,0),0);
 
 	// need to compute tNear to sort out instanceHits of AABBs that are behind a previous triangle hit
 	float tNear, tFar;
 	intersectAABB(origin, direction, next.AABB_min, next.AABB_max, tNear, tFar);
-	int lod = parentLOD;
+	int lod = nextLoad.lod;
 	if(next.IsLodSelector) {
-		mat3 tr = mat3(world_to_object * mat4(nextLoad.world_to_object));
-		next = selectLOD(next,tNear, tr, parentLOD, lod);
+		mat3 tr = mat3(world_to_object * mat4(frame.world_to_object));
+		next = selectLOD(next,tNear, tr, nextLoad.lod, lod);
+		if (collectStats) lodSelections[min(lod, STATS_LOD_LEVELS - 1)]++;
 	}
 
-	world_to_object = mat4x3(mat4(inv(transforms[next.TransformIndex])) * mat4(world_to_object));
-	
-	// here the shader adds the next payloads
-	nextLoad.cIdx_nIdx = next.Index;
-	nextLoad.world_to_object = mat4x3(mat4(world_to_object) * mat4(nextLoad.world_to_object));
+	// the world_to_object of the next node is not stored, it is rebuilt in enterFrame
+	// the selected lod is kept so enterFrame does not have to select it again
+	nextLoad.sIdx = next.Index;
 	nextLoad.tNear = tNear;
-	nextLoad.pIdx_lod = lod;
+	nextLoad.lod = lod;
 	traversalStack[index] = nextLoad;
 	
-	if (debug && displayAABBs) {
+	if (DEBUG_VIEW && displayAABBs) {
 		debugAABB(origin, direction, next);
 	}
 }
@@ -168,11 +293,11 @@ void triangleHit(rayQueryEXT ray_query, SceneNode node, float minAlpha) {
 	float t = rayQueryGetIntersectionTEXT(ray_query, false);
 	vec2 uv = rayQueryGetIntersectionBarycentricsEXT(ray_query, false);
 	uint cIdx = rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, false);
-	SceneNode blasChild = nodes[cIdx];
+	SceneNode blasChild = loadNode(cIdx);
 	int triangle = blasChild.IndexBufferIndex / 3 + rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, false);
-	Vertex v0 = vertices[indices[triangle * 3]];
-	Vertex v1 = vertices[indices[triangle * 3 + 1]];
-	Vertex v2 = vertices[indices[triangle * 3 + 2]];
+	Vertex v0 = loadVertex(loadIndex(triangle, 0));
+	Vertex v1 = loadVertex(loadIndex(triangle, 1));
+	Vertex v2 = loadVertex(loadIndex(triangle, 2));
 
 	vec3 tuv;
 	tuv.x = t;
@@ -181,12 +306,12 @@ void triangleHit(rayQueryEXT ray_query, SceneNode node, float minAlpha) {
 
 	vec3 N;
 	Material material;
-	getHitPayload(triangle, tuv, N, material);
+	getHitPayload(triangle, tuv, coneWidthAt(t), N, material);
 	if (material.color[3] > minAlpha)
 		rayQueryConfirmIntersectionEXT(ray_query);
 }
 // the ray trace loop that executes traversal - this is the entry point
-bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, float minAlpha, int lod,out vec3 tuv, out int triangle_index, out TraversalPayload resultPayload) {
+bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, float minAlpha, int lod,out vec3 tuv, out int triangle_index, out TraversalResult result) {
 	numTraversals = 0;
 
 	tuv = vec3(0);
@@ -196,14 +321,14 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 
 	// start at root node
 	TraversalPayload start; 
-	start.world_to_object = mat4x3(1);
-	start.cIdx_nIdx = int(root);
-	start.pIdx_lod = lod;
+	start.sIdx = int(root);
+	start.lod = lod;
+	start.frame = -1;
 	start.tNear = 0;
 
 	// debug display for AABBs
-	if (debug && displayAABBs) {
-		SceneNode root = nodes[root];
+	if (DEBUG_VIEW && displayAABBs) {
+		SceneNode root = loadNode(root);
 		debugAABB(rayOrigin, rayDirection, root);
 	}
 
@@ -217,26 +342,33 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 		stackSize--; // remove last element
 		TraversalPayload load = traversalStack[stackSize];
 		if (load.tNear >= best_t) continue;// there was already a closer hit, we can skip this one
+		int frame = load.frame + 1;
+		if (frame >= TRAVERSAL_FRAME_SIZE) {
+			// nested to deep, can not keep the transform. the subtree is lost like a stack overflow
+			overflowDrops++;
+			continue;
+		}
 
 		int start = stackSize;
-		SceneNode node = nodes[load.cIdx_nIdx]; // retrieve scene Node
+		SceneNode node = enterFrame(load, frame); // retrieve scene Node
 		traversalDepth = max(node.Level, traversalDepth); // not 100% correct but it gives a vague idea
 
 		uint tlasNumber = node.TlasNumber;
-		vec3 query_origin = (load.world_to_object * vec4(rayOrigin,1)).xyz;
-		vec3 query_direction = (load.world_to_object * vec4(rayDirection,0)).xyz;
+		mat4x3 load_world_to_object = traversalFrames[frame].world_to_object;
+		vec3 query_origin = (load_world_to_object * vec4(rayOrigin,1)).xyz;
+		vec3 query_direction = (load_world_to_object * vec4(rayDirection,0)).xyz;
 
 		// debugging AABBs is quite a bit of work
-		if (debug && displayAABBs) {
+		if (DEBUG_VIEW && displayAABBs) {
 			for (int i = 0; i < node.NumChildren; i++) {
-				SceneNode directChild = nodes[childIndices[node.ChildrenIndex + i]];
+				SceneNode directChild = loadNode(childIndices[node.ChildrenIndex + i]);
 				debugAABB(query_origin, query_direction, directChild);
 			}
 			if(node.IsInstanceList){
 				if(displayListAABBs){
-					SceneNode list = nodes[childIndices[node.ChildrenIndex]];
+					SceneNode list = loadNode(childIndices[node.ChildrenIndex]);
 					for (int i = 0; i < min(50,list.NumChildren); i++) {
-						SceneNode child = nodes[childIndices[list.ChildrenIndex + i]];
+						SceneNode child = loadNode(childIndices[list.ChildrenIndex + i]);
 						debugAABB(query_origin, query_direction, child);
 					}
 				}
@@ -258,16 +390,16 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 			uint type = rayQueryGetIntersectionTypeEXT(ray_query, false);
 			switch (type) {
 			case gl_RayQueryCandidateIntersectionTriangleEXT:
-#ifdef OPAQUE_CHECK	
-				// checks if the triangle hit is opaque. Can impact performance significantly
-				triangleHit(ray_query, node, minAlpha);
+				triangleCandidates++;
 				triangleIntersections++;
+				if (OPAQUE_CHECK) {
+					// checks if the triangle hit is opaque. Can impact performance significantly
+					triangleHit(ray_query, node, minAlpha);
+				} else {
+					// always commit if opaque check is disabled
+					rayQueryConfirmIntersectionEXT(ray_query);
+				}
 				break;
-#else
-				// always commit if opaque check is disabled
-				rayQueryConfirmIntersectionEXT(ray_query);
-				break;
-#endif
 			case gl_RayQueryCandidateIntersectionAABBEXT:
 				// we do not want to generate intersections, since AABB hit does not guarantee a hit in the traversal
 				// instead call instanceShader and add the new parameters to the traversalList
@@ -276,25 +408,32 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 				// that replaces the node that executed the query, however we still want to do a DFS. Solution for this is:
 				// We reverse the list. Then the closest hit is at the end of the stack, and all added levels are still 
 				// right of this node
-				if(stackSize>=TRAVERSAL_STACK_SIZE)
+				if(stackSize>=TRAVERSAL_STACK_SIZE) {
+					overflowDrops++;
 					break;
+				}
 
-				traversalStack[stackSize] = load;
-				traversalStack[stackSize].cIdx_nIdx = rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, false);
-				traversalStack[stackSize].pIdx_lod = rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, false);
-				traversalStack[stackSize].sIdx_un = int(rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(ray_query, false));
+				traversalStack[stackSize].cIdx = rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, false);
+				traversalStack[stackSize].pIdx = rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, false);
+				traversalStack[stackSize].sIdx = int(rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(ray_query, false));
+				traversalStack[stackSize].lod = load.lod;
+				traversalStack[stackSize].frame = frame;
 				stackSize++;
+				stackHighWater = max(stackHighWater, stackSize);
 				instanceIntersections++;
+				instanceHits++;
 				break;
 			default: break;
 			}
 		}
+		recordNodeCost(node.Index, triangleIntersections,
+			rayQueryGetIntersectionTypeEXT(ray_query, true) == gl_RayQueryCommittedIntersectionTriangleEXT);
 		int end = stackSize;
 		int added = end - start;
 		
 		// call instance shader for all intersected PIs
 		for(int i = start;i < end;i++) {
-			instanceShader(node, i, rayOrigin, rayDirection, load.pIdx_lod);
+			instanceShader(i, rayOrigin, rayDirection);
 		}
 
 		// reverse added lists to improve t-Value convergence
@@ -310,7 +449,7 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 		uint commitedType = rayQueryGetIntersectionTypeEXT(ray_query, true);
 		if (commitedType == gl_RayQueryCommittedIntersectionTriangleEXT) {
 			// debug diplays edges of triangles
-			if (debug && displayTriangles) {
+			if (DEBUG_VIEW && displayTriangles) {
 				vec2 uv = rayQueryGetIntersectionBarycentricsEXT(ray_query, true);
 				if (uv.x + uv.y > 0.99f || uv.x < 0.01f || uv.y < 0.01f) {
 					triangle_index = 0;
@@ -328,10 +467,10 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 				best_t = t;
 				SceneNode blasChild;
 				if(node.IsInstanceList){
-					blasChild = nodes[rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(ray_query, true)];
+					blasChild = loadNode(rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(ray_query, true));
 				}
 				else {
-					blasChild = nodes[rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, true)];
+					blasChild = loadNode(rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, true));
 				}
 				triangle_index = blasChild.IndexBufferIndex / 3 + rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, true);
 
@@ -341,10 +480,10 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 				tuv.z = uv.x;
 
 				mat4 world_to_object = mat4(rayQueryGetIntersectionWorldToObjectEXT(ray_query, true));
-				resultPayload.cIdx_nIdx = blasChild.Index;
-				resultPayload.world_to_object = mat4x3(world_to_object * mat4(load.world_to_object));
-				resultPayload.tNear = best_t;
-				resultPayload.pIdx_lod = load.pIdx_lod;
+				result.nodeIdx = blasChild.Index;
+				result.world_to_object = mat4x3(world_to_object * mat4(load_world_to_object));
+				result.t = best_t;
+				result.lod = load.lod;
 				triangleTLAS = tlasNumber;
 			}
 		}
@@ -356,170 +495,501 @@ bool ray_trace_loop(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, f
 	return triangle_index >= 0;
 }
 
-const float MAX_T = 100000;
+// occlusion variant of the ray trace loop, used for shadow rays
+// any confirmed hit is enough, so every query terminates on its first hit and the whole traversal stops there
+// no closest-hit bookkeeping is done and the added loads are not reversed, since the order they are visited in does not matter
+bool ray_trace_occluded(vec3 rayOrigin, vec3 rayDirection, float t_max, uint root, float minAlpha, int lod) {
+	float min_t = 1.0e-4f;
 
-// shades an intersection point
-vec4 shadeFragment(vec3 P, vec3 V, vec3 N, Material material, int triangle, int lod) {
-	// calculate lighting for each light source
-	vec3 sum = vec3(0);
-	for (int i = 0; i < numLights; i++) {
-		Light light = lights[i];
+	TraversalPayload start;
+	start.sIdx = int(root);
+	start.lod = lod;
+	start.frame = -1;
+	start.tNear = 0;
+
+	traversalStack[0] = start;
+	stackSize = 1;
 
-		if ((light.type & LIGHT_ON) == 0) { // is the light on?
+	while (stackSize > 0) {
+		stackSize--;
+		TraversalPayload load = traversalStack[stackSize];
+		if (load.tNear >= t_max) continue;
+		int frame = load.frame + 1;
+		if (frame >= TRAVERSAL_FRAME_SIZE) {
+			overflowDrops++;
 			continue;
 		}
 
-		vec3 L = light.position - P;
-		float l_dst = length(L);
-			
-		float specular = 0;
-		float diffuse = material.k_d;
-		vec3 R = normalize(reflect(V, N));
-		vec3 POff = P + 0.005f * N;
-		if (renderShadows) {
-			TraversalPayload load;
-			vec3 tuvShadow;
-			int index;
-			if ((light.type & LIGHT_TYPE_POINT) != 0) { // point light, check if it is visible and then compute KS via L vector
-				if (l_dst > light.maxDst) { // is the light near enough to even matter
-					continue;
-				}
+		int start = stackSize;
+		SceneNode node = enterFrame(load, frame);
 
-				vec3 LN = normalize(L);
-				if (ray_trace_loop(POff, LN, l_dst, rootSceneNode,0.9f,lod , tuvShadow, index, load)) { // is light source visible? shoot ray to lPos
-					continue;
+		vec3 query_origin = (traversalFrames[frame].world_to_object * vec4(rayOrigin,1)).xyz;
+		vec3 query_direction = (traversalFrames[frame].world_to_object * vec4(rayDirection,0)).xyz;
+
+		rayQueryEXT ray_query;
+		rayQueryInitializeEXT(ray_query, tlas[node.TlasNumber], gl_RayQueryFlagsTerminateOnFirstHitEXT, 0xFF,
+			query_origin, min_t,
+			query_direction, t_max);
+
+		queryCount++;
+		uint triangleIntersections = 0;
+		uint instanceIntersections = 0;
+		while (rayQueryProceedEXT(ray_query)) {
+			uint type = rayQueryGetIntersectionTypeEXT(ray_query, false);
+			switch (type) {
+			case gl_RayQueryCandidateIntersectionTriangleEXT:
+				triangleCandidates++;
+				triangleIntersections++;
+				if (OPAQUE_CHECK) {
+					triangleHit(ray_query, node, minAlpha);
+				} else {
+					rayQueryConfirmIntersectionEXT(ray_query);
 				}
-				specular = material.k_s * pow(max(0, dot(R, LN)), material.n);
-				// https://developer.valvesoftware.com/wiki/Constant-Linear-Quadratic_Falloff
-				float d = l_dst;
-				float l_mult = light.quadratic.x + light.quadratic.y / d + light.quadratic.z / (d * d);
-				if (!renderDiffuse) diffuse = 0;
-				if (!renderSpecular) specular = 0;
-				sum += (specular + diffuse) * l_mult * light.intensity * material.color.xyz;
-			}
-			else if ((light.type & LIGHT_TYPE_SUN) != 0) { // directional light, check if it is visible 
-				vec3 LN = normalize(light.direction);
-				if (ray_trace_loop(POff, -LN, MAX_T, rootSceneNode,0.9f,lod , tuvShadow, index, load)) { // shoot shadow ray into the light source
-					continue;
+				break;
+			case gl_RayQueryCandidateIntersectionAABBEXT:
+				if(stackSize>=TRAVERSAL_STACK_SIZE) {
+					overflowDrops++;
+					break;
 				}
-				specular = material.k_s * pow(max(0, dot(R, -LN)), material.n);
-				if (!renderDiffuse) diffuse = 0;
-				if (!renderSpecular) specular = 0;
-				sum += (specular + diffuse) * light.intensity * material.color.xyz;
+
+				traversalStack[stackSize].cIdx = rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, false);
+				traversalStack[stackSize].pIdx = rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, false);
+				traversalStack[stackSize].sIdx = int(rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(ray_query, false));
+				traversalStack[stackSize].lod = load.lod;
+				traversalStack[stackSize].frame = frame;
+				stackSize++;
+				stackHighWater = max(stackHighWater, stackSize);
+				instanceIntersections++;
+				instanceHits++;
+				break;
+			default: break;
+			}
+		}
+
+		recordQuery(node.Index, node.Level, load.tNear, rayOrigin, rayOrigin + t_max * rayDirection, triangleIntersections, instanceIntersections);
+		bool hit = rayQueryGetIntersectionTypeEXT(ray_query, true) == gl_RayQueryCommittedIntersectionTriangleEXT;
+		recordNodeCost(node.Index, triangleIntersections, hit);
+
+		// the first confirmed hit ends the whole traversal, the remaining loads are discarded
+		if (hit) {
+			stackSize = 0;
+			return true;
+		}
+
+		for(int i = start;i < stackSize;i++) {
+			instanceShader(i, rayOrigin, rayDirection);
+		}
+	}
+	return false;
+}
+
+const float MAX_T = 100000;
+
+// unshadowed contribution of a light source at P, false if the light can not contribute at all
+// LN and l_dst describe the shadow ray that decides if the contribution is visible
+bool lightContribution(Light light, vec3 P, vec3 V, vec3 N, Material material, out vec3 LN, out float l_dst, out vec3 radiance) {
+	LN = vec3(0);
+	l_dst = 0;
+	radiance = vec3(0);
+	if ((light.type & LIGHT_ON) == 0) { // is the light on?
+		return false;
+	}
+
+	float specular = 0;
+	float diffuse = renderDiffuse ? material.k_d : 0;
+	vec3 R = normalize(reflect(V, N));
+	if ((light.type & LIGHT_TYPE_POINT) != 0) { // point light, compute KS via L vector
+		vec3 L = light.position - P;
+		l_dst = length(L);
+		if (l_dst > light.maxDst) { // is the light near enough to even matter
+			return false;
+		}
+		LN = normalize(L);
+		if (renderSpecular) specular = material.k_s * pow(max(0, dot(R, LN)), material.n);
+		// https://developer.valvesoftware.com/wiki/Constant-Linear-Quadratic_Falloff
+		float d = l_dst;
+		float l_mult = light.quadratic.x + light.quadratic.y / d + light.quadratic.z / (d * d);
+		radiance = (specular + diffuse) * l_mult * light.intensity * material.color.xyz;
+		return true;
+	}
+	if ((light.type & LIGHT_TYPE_SUN) != 0) { // directional light, the shadow ray goes against its direction
+		LN = -normalize(light.direction);
+		l_dst = MAX_T;
+		if (renderSpecular) specular = material.k_s * pow(max(0, dot(R, LN)), material.n);
+		radiance = (specular + diffuse) * light.intensity * material.color.xyz;
+		return true;
+	}
+	return false;
+}
+
+// integer hash (pcg), the roulette and the light sampling draw from it so a still camera keeps the same image
+float rayRandom(uint pixel, uint ray) {
+	uint state = (pixel ^ (ray * 0x9E3779B9u)) * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return float((word >> 22u) ^ word) * (1.0f / 4294967296.0f);
+}
+
+// importance of the lights below a node for P, their falloff at the distance of the node.
+// close to or inside the box the distance to its center says little, so it is held at the radius of the box
+float lightImportance(LightNode node, vec3 P) {
+	vec3 toBox = max(max(node.aabbMin - P, P - node.aabbMax), vec3(0));
+	if (length(toBox) > node.maxDst) return 0;
+	float d = max(distance(P, 0.5f * (node.aabbMin + node.aabbMax)), max(0.5f * distance(node.aabbMin, node.aabbMax), 0.1f));
+	return node.power.x + node.power.y / d + node.power.z / (d * d);
+}
+
+// walks the light tree from the root, every inner node picks a child in proportion to its importance for P.
+// u is rescaled on every level. returns the light and the probability it was picked with, -1 if no light reaches P
+int sampleLight(vec3 P, float u, out float pdf) {
+	pdf = 1;
+	LightNode node = lightNodes[0];
+	if (lightImportance(node, P) <= 0) return -1;
+	while (node.child >= 0) {
+		LightNode left = lightNodes[node.child];
+		LightNode right = lightNodes[node.child + 1];
+		float importanceLeft = lightImportance(left, P);
+		float importanceRight = lightImportance(right, P);
+		if (importanceLeft + importanceRight <= 0) return -1;
+		float p = importanceLeft / (importanceLeft + importanceRight);
+		if (u < p) {
+			node = left;
+			pdf *= p;
+			u = u / p;
+		} else {
+			node = right;
+			pdf *= 1 - p;
+			u = (u - p) / (1 - p);
+		}
+		u = min(u, 0.99999994f);
+	}
+	return -1 - node.child;
+}
+
+// shadow rays per shading point, with fewer samples than lights that are on they are picked from the tree
+bool samplesLights() {
+	return lightSamples > 0 && lightSamples < numEnabledLights && numLightNodes > 0;
+}
+uint lightDraws = 0; // light picks of this invocation, numbers the draws for rayRandom
+
+// the pixel takes the shadows of its neighbour, shadeFragment leaves the lights unshadowed
+bool skipShadowRays = false;
+// direct light of the last shadeFragment without the shadows, and how much of it the shadow rays let through
+vec3 directUnshadowed = vec3(0);
+float directVisibility = 1;
+
+// shades an intersection point
+// width is the width of the ray cone at P, the shadow rays keep it on their way to the light
+vec4 shadeFragment(vec3 P, vec3 V, vec3 N, Material material, int triangle, int lod, float width) {
+	// calculate lighting for each light source
+	vec3 sum = vec3(0);
+	vec3 unshadowed = vec3(0);
+	vec3 POff = P + 0.005f * N;
+	int shadowLod = shadowRayLod(lod);
+	coneWidth = width;
+	coneSpread = 0;
+	lodBias = shadowLodBias;
+	if (renderShadows) {
+		// the picked lights are weighted with their probability, so they add up to all lights on average
+		bool sampled = samplesLights();
+		int samples = sampled ? int(lightSamples) : int(numLights);
+		uint pixel = uint(pixelCoord.x) | (uint(pixelCoord.y) << 16);
+		for (int i = 0; i < samples; i++) {
+			int index = i;
+			float weight = 1;
+			if (sampled) {
+				float pdf;
+				index = sampleLight(P, rayRandom(pixel, 0x10000u + lightDraws++), pdf);
+				if (index < 0) continue;
+				weight = 1 / (pdf * float(lightSamples));
+			}
+			vec3 LN;
+			float l_dst;
+			vec3 radiance;
+			if (!lightContribution(lights[index], P, V, N, material, LN, l_dst, radiance)) {
+				continue;
 			}
+			radiance *= weight;
+			unshadowed += radiance;
+			if (!skipShadowRays && ray_trace_occluded(POff, LN, l_dst, rootSceneNode, 0.9f, shadowLod)) { // is light source visible? shoot ray towards it
+				continue;
+			}
+			sum += radiance;
 		}
 	}
+	directUnshadowed = unshadowed;
+	float total = unshadowed.x + unshadowed.y + unshadowed.z;
+	directVisibility = total > 0 ? (sum.x + sum.y + sum.z) / total : 1;
 	if (!renderAmbient) material.k_a = 0;
 	sum += material.k_a * material.color.xyz;
 	return vec4(sum.xyz, material.color[3]);
 }
-// the ray trace function, traces a ray and recursion up to a maximum total traversal count
-// uses its own little stack
-vec4 rayTrace(vec3 rayOrigin, vec3 rayDirection, out float t) {
-	int triangle = -1;
-	TraversalPayload load;
-	vec3 tuv;
-	Material material;
+// secondary rays of a pixel, rayTrace works through them until the stack is empty
+// every traced ray below the depth cap pops one and pushes two, so cap + 1 rays can be pending (cap is at most 10)
+#define RAY_STACK_SIZE 11
+struct RayStack {
+	float contribution[RAY_STACK_SIZE];
+	vec3 origin[RAY_STACK_SIZE];
+	vec3 direction[RAY_STACK_SIZE];
+	vec2 cone[RAY_STACK_SIZE]; // width at the origin and spread of the ray cone
+	int num;
+};
 
-	vec4 color = vec4(0, 0, 0, 0);
-	int depth = 0;
+void pushRay(inout RayStack stack, float contribution, vec3 origin, vec3 direction, vec2 cone) {
+	int slot = stack.num;
+	if (slot >= RAY_STACK_SIZE) {
+		// a full stack gives up its weakest ray instead of the new one, counted in the stats
+		slot = 0;
+		for (int i = 1; i < RAY_STACK_SIZE; i++)
+			if (stack.contribution[i] < stack.contribution[slot]) slot = i;
+		evictedRays++;
+		if (stack.contribution[slot] >= contribution) return;
+	} else {
+		stack.num++;
+	}
+	stack.contribution[slot] = contribution;
+	stack.origin[slot] = origin;
+	stack.direction[slot] = direction;
+	stack.cone[slot] = cone;
+}
 
-	if (debug && displayTriangles) {
-		int triangle = -1;
-		TraversalPayload load;
-		vec3 tuv;
-		if (ray_trace_loop(rayOrigin, rayDirection, MAX_T, rootSceneNode,0,-1, tuv, triangle, load))
-			return vec4(1, 1, 1, 1);
-		else
-			return vec4(0, 0, 0, 1);
+// false if a reflection or transmission ray adds too little to its pixel to be traced. with the roulette a weak ray
+// survives with the probability contribution / minContribution and carries minContribution, which keeps the mean
+bool survivesPruning(inout float contribution, uint pixel, uint ray) {
+	if (contribution >= minContribution) return true;
+	if (russianRoulette && rayRandom(pixel, ray) * minContribution < contribution) {
+		contribution = minContribution;
+		return true;
 	}
+	prunedRays++;
+	return false;
+}
 
-	float Contribution[6];
-	vec3 Origin[6];
-	vec3 Direction[6];
+// the direct light of the primary hit as it ends up in the pixel without shadows, and its visibility
+vec3 primaryDirect = vec3(0);
+float primaryVisibility = 1;
 
-	int count = 0;
-	int num = 1;
-	Contribution[0] = 1;
-	Origin[0] = rayOrigin;
-	Direction[0] = rayDirection;
-	while (num>0) {
-		count++;
-		num--;
+// shades a surface hit with the fraction frac of the pixel and pushes its transmission and reflection rays
+// count is the number of the ray that hit, the first ray of a pixel is 1
+// cone is the width of the ray cone at P and its spread
+vec4 shadeHit(vec3 P, vec3 V, vec3 N_world, int triangle, vec3 tuv, int lod, vec2 cone, float frac, int count, inout RayStack stack) {
+	SetDebugHsv(displayLOD, lod, 7, true);
 
-		vec3 P = Origin[num];
-		vec3 V = Direction[num];
-		float frac = Contribution[num];
-		bool hit = ray_trace_loop(P, V, MAX_T, rootSceneNode,0, -1, tuv, triangle, load);
+	// the cone is stretched on surfaces it meets at a grazing angle
+	float footprint = cone.x / max(abs(dot(N_world, V)), 0.05f);
+	vec3 N_obj;
+	Material material;
+	getHitPayload(triangle, tuv, footprint, N_obj, material);
+	if (displayAABBs)
+		debugSetEnabled = false;
+
+	vec4 fracColor = shadeFragment(P, V, N_world, material, triangle, lod, cone.x);
+	if (count == 1) {
+		primaryDirect = frac * fracColor[3] * directUnshadowed;
+		primaryVisibility = directVisibility;
+	}
 
-		if(hit) {
-			SetDebugHsv(displayLOD, load.pIdx_lod, 7, true);
-
-			vec3 P = P + tuv.x * V;
-			vec3 N_obj;
-			getHitPayload(triangle, tuv, N_obj, material);
-			vec3 N_world = normalize(transpose(mat3(load.world_to_object)) * N_obj);
-			if (displayAABBs)
-				debugSetEnabled = false;
-			if (count == 1)
-				t = tuv.x;
+	if(DEBUG_VIEW && displayLOD){
+		fracColor = 0.7f * fracColor + 0.3f * debugColor;
+		debugColor = vec4(0,0,0,0);
+	}
 
-			vec4 fracColor = shadeFragment(P, V, N_world, material, triangle, load.pIdx_lod);
+	DebugOffIfSet();
 
-			if(debug && displayLOD){
-				fracColor = 0.7f * fracColor + 0.3f * debugColor;
-				debugColor = vec4(0,0,0,0);
-			}
+	float tr = material.k_t + (1-fracColor[3]);
+	float rf = material.k_r;
 
-			DebugOffIfSet();
-			color += frac * fracColor[3] * fracColor;
+	if(count > min(rayMaxDepth, MAX_RAY_DEPTH)){
+		tr = 0;
+		rf = 0;
+	}
+	uint pixel = uint(pixelCoord.x) | (uint(pixelCoord.y) << 16);
+	float trFrac = tr * frac;
+	if(tr > 0 && renderTransmission && survivesPruning(trFrac, pixel, uint(2 * count))){
+		pushRay(stack, trFrac, P + V * 0.01f, V, cone);
+	}
 
-			float tr = material.k_t + (1-fracColor[3]);
-			float rf = material.k_r;
+	float rfFrac = rf * frac;
+	if(rf > 0 && renderReflection && survivesPruning(rfFrac, pixel, uint(2 * count + 1))){
+		vec3 dirRef = reflect(V,N_world);
+		// a curved mirror turns the normal by curvature * width across the cone, the reflection by twice that
+		float spread = cone.y + 2 * getHitCurvature(triangle) * cone.x;
+		pushRay(stack, rfFrac, P + dirRef * 0.01f, dirRef, vec2(cone.x, spread));
+	}
+	return frac * fracColor[3] * fracColor;
+}
 
-			if(count>rayMaxDepth){
-				tr = 0;
-				rf = 0;
-			}
-			if(tr > 0 && renderTransmission && num<6){
-				Contribution[num] = tr * frac;
-				Origin[num] = P + V * 0.01f;
-				Direction[num] = V;
-				num++;
-			}
+// color of a ray that left the scene
+vec4 shadeMiss(vec3 V, float frac) {
+	vec4 color = vec4(0);
+	// some magic with suns, does some dot product pows to create a bright spot on the sky
+	for (int i = 0; i < numLights; i++) {
+		Light light = lights[i];
+		if ((light.type & LIGHT_TYPE_SUN) != 0) {
+			vec3 LD = normalize(light.direction);
+			vec3 VN = normalize(V);
+			float fac = pow(max(0,dot(LD,-VN)),500) * 3;
+			color += frac * fac * vec4(light.intensity,1);
+		}
+	}
+	// skybox
+	color += frac * texture(skybox,V);
+	return color;
+}
 
-			if(rf > 0 && renderReflection && num<6){
-				Contribution[num] = rf * frac;
-				vec3 dirRef = reflect(V,N_world);
-				Origin[num] = P + dirRef * 0.01f;
-				Direction[num] = dirRef;
-				num++;
-			}
+// traces the rays on the stack, count is the number of rays of this pixel that were already traced
+// t is set to the intersection of the first ray
+vec4 traceRayStack(inout RayStack stack, int count, inout float t) {
+	int triangle = -1;
+	TraversalResult load;
+	vec3 tuv;
+	vec4 color = vec4(0, 0, 0, 0);
+
+	while (stack.num>0) {
+		count++;
+		stack.num--;
+		secondaryRays++;
+
+		vec3 P = stack.origin[stack.num];
+		vec3 V = stack.direction[stack.num];
+		float frac = stack.contribution[stack.num];
+		vec2 cone = stack.cone[stack.num];
+		coneWidth = cone.x;
+		coneSpread = cone.y;
+		lodBias = secondaryLodBias;
+		bool hit = ray_trace_loop(P, V, MAX_T, rootSceneNode,0, -1, tuv, triangle, load);
+
+		if(hit) {
+			if (count == 1)
+				t = tuv.x;
+			vec3 N_world = normalize(transpose(mat3(load.world_to_object)) * getHitNormal(triangle, tuv));
+			color += shadeHit(P + tuv.x * V, V, N_world, triangle, tuv, load.lod, vec2(coneWidthAt(tuv.x), cone.y), frac, count, stack);
 		} else {
 			if(count==1) {
 				//SetDebugCol(true, vec4(0,0,0,0));
 				t = MAX_T;
 			}
-			// some magic with suns, does some dot product pows to create a bright spot on the sky
-			for (int i = 0; i < numLights; i++) {
-				Light light = lights[i];
-				if ((light.type & LIGHT_TYPE_SUN) != 0) {
-					vec3 LD = normalize(light.direction);
-					vec3 VN = normalize(V);
-					float fac = pow(max(0,dot(LD,-VN)),500) * 3;
-					color += frac * fac * vec4(light.intensity,1);
-				}
-			}
-			// skybox
-			color += frac * texture(skybox,V);
+			color += shadeMiss(V, frac);
 		}
 	}
 	return color;
 }
 
+// rate of the shadow and secondary rays of the primary hit, a pixel that does not trace them borrows them from
+// the other pixel of its quad pair. that is its horizontal neighbour in a fragment quad, and in a compute tile as
+// long as the tile runs in full subgroups and is an even number of pixels wide.
+// set_frame_buffers falls back to the full rate where the device has no quad operations, those load the
+// binaries built with NO_SUBGROUP_QUAD where the swap below is never reached
+#define RAY_RATE_FULL 0
+#define RAY_RATE_CHECKER 1 // every other pixel borrows
+#define RAY_RATE_ADAPTIVE 2 // only where both pixels hit about the same surface
+
+#ifdef NO_SUBGROUP_QUAD
+#define swapPair(value) (value)
+#else
+#define swapPair(value) subgroupQuadSwapHorizontal(value)
+#endif
+
+// uniform over the dispatch, the quad operations are skipped if the pixels do not pair
+bool pairsRays(uint rate) {
+#ifdef NO_SUBGROUP_QUAD
+	return false;
+#else
+#ifdef TILED_DISPATCH
+	if (!FULL_SUBGROUPS || gl_WorkGroupSize.x % 2 != 0) return false;
+#endif
+	return rate != RAY_RATE_FULL;
+#endif
+}
+
+// has to be reached by both pixels of the pair
+bool borrowsRays(uint rate, bool hit, vec3 N, float t) {
+	if (!pairsRays(rate)) return false;
+	vec4 neighbour = swapPair(vec4(N, hit ? t : -1));
+	// the checkerboard keeps a tracing pixel next to every borrowing one, the pair may end at an odd frame width
+	if (((pixelCoord.x + pixelCoord.y) & 1) == 0 || (pixelCoord.x ^ 1) >= int(width)) return false;
+	if (!hit || neighbour.w < 0) return false;
+	if (rate == RAY_RATE_ADAPTIVE)
+		return dot(N, neighbour.xyz) > rateNormalThreshold && abs(t - neighbour.w) < rateDepthThreshold * t;
+	return true;
+}
+
+// shades the primary hit (or miss) at P and traces the rays it spawns at the rates of the settings.
+// borrowed shadows take the visibility of the neighbour's direct light, borrowed secondary rays its radiance
+// per contribution
+vec4 shadePrimary(vec3 P, vec3 V, bool hit, vec3 N_world, int triangle, vec3 tuv, int lod) {
+	RayStack stack;
+	stack.num = 0;
+	primaryDirect = vec3(0);
+	primaryVisibility = 1;
+	float t = tuv.x;
+
+	bool borrowShadows = borrowsRays(shadowRayRate, hit, N_world, t);
+	skipShadowRays = borrowShadows;
+	vec2 cone = vec2(pixelSpread() * t, pixelSpread());
+	vec4 color = hit ? shadeHit(P, V, N_world, triangle, tuv, lod, cone, 1, 1, stack) : shadeMiss(V, 1);
+	skipShadowRays = false;
+	if (pairsRays(shadowRayRate)) {
+		float neighbourVisibility = swapPair(primaryVisibility);
+		if (borrowShadows)
+			color.xyz -= (1 - neighbourVisibility) * primaryDirect;
+	}
+
+	float weight = 0;
+	for (int i = 0; i < stack.num; i++)
+		weight += stack.contribution[i];
+	bool borrowSecondary = borrowsRays(secondaryRayRate, hit, N_world, t) && weight > 0;
+	vec4 secondary = vec4(0);
+	float tracedWeight = 0;
+	if (!borrowSecondary) {
+		secondary = traceRayStack(stack, 1, t);
+		tracedWeight = weight;
+	}
+	vec4 neighbourSecondary = vec4(0);
+	float neighbourWeight = 0;
+	if (pairsRays(secondaryRayRate)) {
+		neighbourSecondary = swapPair(secondary);
+		neighbourWeight = swapPair(tracedWeight);
+	}
+	if (borrowSecondary) {
+		// a neighbour without reflections or transmission has nothing to lend
+		if (neighbourWeight > 0)
+			secondary = neighbourSecondary * (weight / neighbourWeight);
+		else
+			secondary = traceRayStack(stack, 1, t);
+	}
+	return color + secondary;
+}
+
+// the ray trace function, traces a ray and recursion up to a maximum total traversal count
+// uses its own little stack
+vec4 rayTrace(vec3 rayOrigin, vec3 rayDirection, out float t) {
+	t = MAX_T;
+	if (DEBUG_VIEW && displayTriangles) {
+		int triangle = -1;
+		TraversalResult load;
+		vec3 tuv;
+		if (ray_trace_loop(rayOrigin, rayDirection, MAX_T, rootSceneNode,0,-1, tuv, triangle, load))
+			return vec4(1, 1, 1, 1);
+		else
+			return vec4(0, 0, 0, 1);
+	}
+
+	// the primary ray on its own, the pixels of a quad meet again before the rays it spawns
+	int triangle = -1;
+	TraversalResult load;
+	vec3 tuv;
+	bool hit = ray_trace_loop(rayOrigin, rayDirection, MAX_T, rootSceneNode, 0, -1, tuv, triangle, load);
+	vec3 N_world = vec3(0);
+	if (hit) {
+		t = tuv.x;
+		N_world = normalize(transpose(mat3(load.world_to_object)) * getHitNormal(triangle, tuv));
+	}
+	return shadePrimary(rayOrigin + tuv.x * rayDirection, rayDirection, hit, N_world, triangle, tuv, load.lod);
+}
+
 // generates a ray for a pixel
 void generatePixelRay(out vec3 rayOrigin, out vec3 rayDirection) {
-	ivec2 xy = ivec2(gl_FragCoord.xy);
+	ivec2 xy = pixelCoord;
 	float x = xy.x;
 	float y = xy.y;
 
@@ -533,5 +1003,8 @@ void generatePixelRay(out vec3 rayOrigin, out vec3 rayDirection) {
 
 	rayOrigin = origin_world_space.xyz;
 	rayDirection = direction_world_space.xyz;
+	coneWidth = 0;
+	coneSpread = pixelSpread();
+	lodBias = 0;
 }
 
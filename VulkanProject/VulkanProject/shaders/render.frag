@@ -0,0 +1,187 @@
+// shared body of the fragment and compute entry points, traces and shades a single pixel
+#include "intersections.frag"
+
+#define STRUCTS
+#include "structs.frag"
+
+#define DEBUG
+#include "debug.frag"
+
+#define RAYTRACE
+#include "raytrace.frag"
+
+// per frame aggregates for the profiler plots and csv, reset by the host once the frame is read
+layout(binding = FRAME_STATS_BINDING, set = 2) buffer FrameStats {
+	uint statQueries;
+	uint statTraversals;
+	uint statMaxTraversalDepth;
+	uint statPixels;
+	uint statInstanceHits;
+	uint statTriangleCandidates;
+	uint statOverflowDrops;
+	uint statMaxStack;
+	uint statQueryHistogram[STATS_HISTOGRAM_BINS];
+	uint statInstanceHistogram[STATS_HISTOGRAM_BINS];
+	uint statCandidateHistogram[STATS_HISTOGRAM_BINS];
+	uint statStackHistogram[STATS_HISTOGRAM_BINS];
+	uint statLodHistogram[STATS_LOD_LEVELS];
+	uint statSecondaryRays;
+	uint statPrunedRays;
+	uint statEvictedRays;
+};
+
+// log2 bins: 0, 1, 2-3, 4-7 ...
+uint log2Bin(uint value) {
+	return min(uint(findMSB(value) + 1), uint(STATS_HISTOGRAM_BINS - 1));
+}
+
+// pixel is false for a pass that traces rays of pixels another pass already counted (the deferred shading and the
+// wavefront passes), it adds to the totals but leaves the pixel count and the per pixel histograms alone
+#ifdef NO_SUBGROUP_ARITHMETIC
+// every invocation does its own atomics, for devices without subgroup arithmetic
+void recordFrameStats(bool pixel) {
+	if (!collectStats) return;
+	atomicAdd(statQueries, queryCount);
+	atomicAdd(statTraversals, numTraversals);
+	atomicMax(statMaxTraversalDepth, uint(traversalDepth));
+	if (pixel) atomicAdd(statPixels, 1);
+	if (instanceHits > 0) atomicAdd(statInstanceHits, instanceHits);
+	if (triangleCandidates > 0) atomicAdd(statTriangleCandidates, triangleCandidates);
+	if (overflowDrops > 0) atomicAdd(statOverflowDrops, overflowDrops);
+	atomicMax(statMaxStack, uint(stackHighWater));
+	if (secondaryRays > 0) atomicAdd(statSecondaryRays, secondaryRays);
+	if (prunedRays > 0) atomicAdd(statPrunedRays, prunedRays);
+	if (evictedRays > 0) atomicAdd(statEvictedRays, evictedRays);
+	if (pixel) {
+		atomicAdd(statQueryHistogram[min(queryCount, uint(STATS_HISTOGRAM_BINS - 1))], 1);
+		atomicAdd(statInstanceHistogram[log2Bin(instanceHits)], 1);
+		atomicAdd(statCandidateHistogram[log2Bin(triangleCandidates)], 1);
+		atomicAdd(statStackHistogram[min(uint(stackHighWater) / 4, uint(STATS_HISTOGRAM_BINS - 1))], 1);
+	}
+	for (uint level = 0; level < STATS_LOD_LEVELS; level++)
+		if (lodSelections[level] > 0) atomicAdd(statLodHistogram[level], lodSelections[level]);
+}
+#else
+// the subgroup sums its lanes first, one lane does the atomics
+void recordFrameStats(bool pixel) {
+	if (!collectStats) return;
+	uint queries = subgroupAdd(queryCount);
+	uint traversals = subgroupAdd(numTraversals);
+	uint depth = subgroupMax(uint(traversalDepth));
+	uint pixels = subgroupAdd(pixel ? 1 : 0);
+	uint instances = subgroupAdd(instanceHits);
+	uint candidates = subgroupAdd(triangleCandidates);
+	uint drops = subgroupAdd(overflowDrops);
+	uint stack = subgroupMax(uint(stackHighWater));
+	uint secondary = subgroupAdd(secondaryRays);
+	uint pruned = subgroupAdd(prunedRays);
+	uint evicted = subgroupAdd(evictedRays);
+	if (subgroupElect()) {
+		atomicAdd(statQueries, queries);
+		atomicAdd(statTraversals, traversals);
+		atomicMax(statMaxTraversalDepth, depth);
+		if (pixels > 0) atomicAdd(statPixels, pixels);
+		atomicAdd(statInstanceHits, instances);
+		atomicAdd(statTriangleCandidates, candidates);
+		atomicAdd(statOverflowDrops, drops);
+		atomicMax(statMaxStack, stack);
+		if (secondary > 0) atomicAdd(statSecondaryRays, secondary);
+		if (pruned > 0) atomicAdd(statPrunedRays, pruned);
+		if (evicted > 0) atomicAdd(statEvictedRays, evicted);
+	}
+
+	// every bin is counted over the subgroup, empty bins skip the atomic
+	for (uint level = 0; level < STATS_LOD_LEVELS; level++) {
+		uint l = subgroupAdd(lodSelections[level]);
+		if (subgroupElect() && l > 0) atomicAdd(statLodHistogram[level], l);
+	}
+	if (!pixel) return;
+	uint queryBin = min(queryCount, uint(STATS_HISTOGRAM_BINS - 1));
+	uint instanceBin = log2Bin(instanceHits);
+	uint candidateBin = log2Bin(triangleCandidates);
+	uint stackBin = min(uint(stackHighWater) / 4, uint(STATS_HISTOGRAM_BINS - 1));
+	for (uint bin = 0; bin < STATS_HISTOGRAM_BINS; bin++) {
+		uint q = subgroupAdd(uint(queryBin == bin));
+		uint i = subgroupAdd(uint(instanceBin == bin));
+		uint c = subgroupAdd(uint(candidateBin == bin));
+		uint s = subgroupAdd(uint(stackBin == bin));
+		if (subgroupElect()) {
+			if (q > 0) atomicAdd(statQueryHistogram[bin], q);
+			if (i > 0) atomicAdd(statInstanceHistogram[bin], i);
+			if (c > 0) atomicAdd(statCandidateHistogram[bin], c);
+			if (s > 0) atomicAdd(statStackHistogram[bin], s);
+		}
+	}
+}
+#endif
+
+vec4 renderPixel(ivec2 pixel) {
+	pixelCoord = pixel;
+	vec4 color;
+	debugColor = vec4(0,0,0,0);
+	// from https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-generating-camera-rays/generating-camera-rays
+	vec3 rayOrigin, rayDirection;
+	generatePixelRay(rayOrigin, rayDirection);
+
+	int triangle_index = -1;
+
+	float t_hit;
+	startTraceRecord();
+	color = rayTrace(rayOrigin, rayDirection, t_hit);
+	endRecord();
+	checkQueryTrace(rayOrigin, rayDirection);
+	recordFrameStats(true);
+	// release variants skip the debug views entirely
+	if (!DEBUG_VIEW) return color;
+
+	if(displayIntersectionT) {
+		debugColor = vec4(hsv2rgb(vec3(min(t_hit * 1.f/colorSensitivity,0.66f),1,1)),1);
+	} 
+	if (displayTraversalDepth){
+		debugColor = vec4(hsv2rgb(vec3(0.66f - min(traversalDepth * 1.f /colorSensitivity,0.66f),1,1)),1);
+	}
+	if (displayTraversalCount){
+		debugColor = vec4(hsv2rgb(vec3(0.66f - min(numTraversals * 1.f/colorSensitivity,0.66f),1,1)),1);
+	}
+
+	if(displayLights) {
+		int closestLight = -1;
+		float light_t = t_hit;
+		for(int i = 0;i<numLights;i++){
+			Light light = lights[i];
+			if((light.type & LIGHT_TYPE_POINT) != 0){
+				float t;
+				if(vertexIntersect(rayOrigin, rayDirection, light.position, t)){
+					if(t<light_t){
+						light_t = t;
+						closestLight = i;
+					}
+				}
+			}
+			if((light.type & LIGHT_TYPE_SUN) != 0){
+				float t;
+				if(vertexIntersect(rayOrigin, rayDirection, rayOrigin + 10 * (-light.direction), t)){
+					if(t<light_t){
+						light_t = t;
+						closestLight = i;
+					}
+				}
+			}
+		}
+		if(closestLight>=0){
+			Light light = lights[closestLight];
+			if((light.type & LIGHT_ON) != 0){
+				debugColor = vec4(0,1,0,1);
+			} else {
+				debugColor = vec4(0,0,0,1);
+			}
+		} else {
+
+		}
+	}
+	if(displayQueryCount && queryCount > 1){
+		debugColor = vec4(hsv2rgb(vec3(0.66f - min(queryCount * 1.f /colorSensitivity,0.66f),1,1)),1);
+	}
+	if(DEBUG_VIEW && debugColor[3] == 1) color = debugColor;
+	return color;
+}
\ No newline at end of file
@@ -1,3 +1,9 @@
+// pipeline variant, the ids follow ShaderVariant in Globals.h. ids 0-3 belong to the entry points
+layout(constant_id = 4) const bool OPAQUE_CHECK = true; // alpha test for triangle candidates
+layout(constant_id = 5) const bool DEBUG_DISPLAYS = true; // false compiles the debug views out of the traversal
+layout(constant_id = 6) const int TRAVERSAL_STACK_SIZE = 30;
+layout(constant_id = 7) const uint MAX_RAY_DEPTH = 10; // the rayMaxDepth setting is clamped to this
+
 struct Vertex {
 	vec3 position; // 0 - 16
 	float pad1;
@@ -47,13 +53,21 @@ struct Light {
 	vec3 direction;
 	float minDst;
 };
+// node of the light tree, see LightTree.c
+struct LightNode {
+	vec3 aabbMin; // of the light positions
+	int child; // inner node: the first of its two children, leaf: -1 - index of the light
+	vec3 aabbMax;
+	float maxDst; // the farthest any light below reaches
+	vec3 power; // constant, linear and quadratic falloff of the lights below that are on
+	float pad;
+};
 
 #define SCENE_DATA_BINDING 0
-#define VERTEX_BUFFER_BINDING 1
-#define INDEX_BUFFER_BINDING 2
+#define SCENE_POINTER_BINDING 1
 #define MATERIAL_BUFFER_BINDING 3
 #define LIGHT_BUFFER_BINDING 4
-#define NODE_BUFFER_BINDING 5
+#define LIGHT_TREE_BINDING 5
 #define TRANSFORM_BUFFER_BINDING 6
 #define NODE_CHILDREN_BINDING 7
 #define SAMPLER_BINDING 8
@@ -62,6 +76,27 @@ struct Light {
 #define FRAME_DATA_BINDING 11
 #define TLAS_BINDING 12
 #define TRACE_BINDING 13
+#define OUTPUT_IMAGE_BINDING 14
+#define WAVEFRONT_RAY_BINDING 15
+#define WAVEFRONT_HIT_BINDING 16
+#define WAVEFRONT_SHADOW_BINDING 17
+#define WAVEFRONT_COUNTER_BINDING 18
+#define WAVEFRONT_ACCUM_BINDING 19
+#define WAVEFRONT_STATS_BINDING 20
+#define VISIBILITY_BINDING 21
+#define FRAME_STATS_BINDING 22
+#define NODE_COST_BINDING 23
+#define HISTORY_BINDING 24
+#define REPROJECTION_BINDING 25
+#define INVERSE_TRANSFORM_BINDING 26
+
+// FrameStats sizes, same as Globals.h
+#define STATS_HISTOGRAM_BINS 16
+#define STATS_LOD_LEVELS 8
+#define NODE_PROFILE_STRIDE 4
+
+// the pixel this invocation traces, set by the entry point (fragment or compute)
+ivec2 pixelCoord;
 
 layout(binding = SCENE_DATA_BINDING, set = 0) uniform SceneData{
 	uint numVertices;
@@ -71,14 +106,45 @@ layout(binding = SCENE_DATA_BINDING, set = 0) uniform SceneData{
 	uint numNodeIndices;
 	uint numLights;
 	uint rootSceneNode;
+	uint numLightNodes;
+	uint numEnabledLights;
+};
+
+// vertices, indices and nodes are split over several buffers (chunks) and reached through their device address,
+// so a scene is not limited by the size of a single storage buffer. see SceneBuffers.c
+#define MAX_SCENE_CHUNKS 32
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer VertexChunk { Vertex data[]; };
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer TriangleChunk { int data[]; }; // 3 indices per triangle
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer NodeChunk { SceneNode data[]; };
+
+layout(binding = SCENE_POINTER_BINDING, set = 0) uniform ScenePointers{
+	uint vertexChunkShift; // log2 of the elements per chunk
+	uint triangleChunkShift;
+	uint nodeChunkShift;
+	VertexChunk vertexChunks[MAX_SCENE_CHUNKS];
+	TriangleChunk triangleChunks[MAX_SCENE_CHUNKS];
+	NodeChunk nodeChunks[MAX_SCENE_CHUNKS];
 };
 
-layout(binding = VERTEX_BUFFER_BINDING, set = 0) buffer VertexBuffer { Vertex[] vertices; };
-layout(binding = INDEX_BUFFER_BINDING, set = 0) buffer IndexBuffer { int[] indices; };
+Vertex loadVertex(uint index) {
+	return vertexChunks[index >> vertexChunkShift].data[index & ((1u << vertexChunkShift) - 1u)];
+}
+
+// the index of a corner (0-2) of the triangle
+uint loadIndex(uint triangle, uint corner) {
+	uint local = triangle & ((1u << triangleChunkShift) - 1u);
+	return uint(triangleChunks[triangle >> triangleChunkShift].data[local * 3u + corner]);
+}
+
+SceneNode loadNode(uint index) {
+	return nodeChunks[index >> nodeChunkShift].data[index & ((1u << nodeChunkShift) - 1u)];
+}
+
 layout(binding = MATERIAL_BUFFER_BINDING, set = 0) buffer MaterialBuffer { Material[] materials; };
 layout(binding = LIGHT_BUFFER_BINDING, set = 0) buffer LightBuffer { Light[] lights; };
-layout(binding = NODE_BUFFER_BINDING, set = 0, row_major) buffer NodeBuffer { SceneNode[] nodes; }; // the array of sceneNodes
+layout(binding = LIGHT_TREE_BINDING, set = 0) buffer LightTreeBuffer { LightNode[] lightNodes; };
 layout(binding = TRANSFORM_BUFFER_BINDING, set = 0, row_major) buffer TransformBuffer { mat4x3[] transforms; }; // the array of node transforms
+layout(binding = INVERSE_TRANSFORM_BINDING, set = 0, row_major) readonly buffer InverseTransformBuffer { mat4x3[] inverseTransforms; }; // inverted on the host
 layout(binding = NODE_CHILDREN_BINDING, set = 0) buffer ChildBuffer { uint[] childIndices; }; // the index array for node children
 
 layout(binding = SAMPLER_BINDING, set = 1) uniform sampler samp;
@@ -125,4 +191,25 @@ layout(binding = FRAME_DATA_BINDING, set = 2) uniform FrameData{
 	uint pixelX;			// for the pixel with this X
 	uint pixelY;			// and this Y coordinate
 	uint traceMax;			// max amount (buffer size)
-};
\ No newline at end of file
+	uint traceWidth;		// size of the recorded region
+	uint traceHeight;
+	uint traceStride;		// records every traceStride-th pixel of the region
+	uint secondaryRayRate; // RAY_RATE_* of the reflection and transmission rays
+	uint shadowRayRate; // RAY_RATE_* of the shadow rays
+	float rateNormalThreshold; // adaptive rate: min cosine between the normals of a pixel pair
+	float rateDepthThreshold; // adaptive rate: max relative difference of the hit distances
+	float minContribution; // reflection and transmission rays below this share of the pixel are pruned
+	bool russianRoulette; // pruned rays survive with contribution / minContribution instead
+	int shadowLodBias; // levels added to the lod of the shaded surface for its shadow rays
+	int secondaryLodBias; // levels added to the selection of reflection and transmission rays
+	uint lightSamples; // lights picked from the light tree per shading point, 0 traces every light
+	uint settingsPad0;
+	uint settingsPad1;
+	uint settingsPad2;
+	bool collectStats; // adds this frame up in FrameStats for the profiler
+	bool collectNodeCosts; // adds this frame up in the node profile
+	mat4 previous_view_to_world; // camera of the hits in the history buffer
+	bool reuseHistory; // reprojects the previous primary hits, deferred mode only
+};
+// the debug settings only count in the variant that was built with them
+#define DEBUG_VIEW (DEBUG_DISPLAYS && debug)
\ No newline at end of file
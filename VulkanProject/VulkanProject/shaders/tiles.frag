@@ -0,0 +1,47 @@
+// tiled dispatch shared by the compute entry points
+// the workgroup shape and the tile order are specialization constants 0-2, see create_compute_pipeline
+#define TILED_DISPATCH
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+layout(constant_id = 2) const uint TILE_ORDER = 0;
+// set if the pipeline requires full subgroups, see create_compute_variants
+layout(constant_id = 9) const bool FULL_SUBGROUPS = false;
+
+#define TILE_ORDER_ROW 0
+#define TILE_ORDER_COLUMN 1
+#define TILE_ORDER_STRIPS 2
+
+// width of a strip in workgroups for TILE_ORDER_STRIPS
+#define TILE_STRIP_WIDTH 8
+
+// remaps the linear workgroup index to a tile, neighbouring groups then trace neighbouring pixels
+// and hit the same parts of the BVH, textures and skybox
+uvec2 tileFromGroup(uvec2 group, uvec2 numGroups) {
+	uint linear = group.y * numGroups.x + group.x;
+	if (TILE_ORDER == TILE_ORDER_COLUMN) {
+		return uvec2(linear / numGroups.y, linear % numGroups.y);
+	}
+	if (TILE_ORDER == TILE_ORDER_STRIPS) {
+		// vertical strips of TILE_STRIP_WIDTH groups, walked top to bottom, the last one may be narrower
+		uint groupsPerStrip = TILE_STRIP_WIDTH * numGroups.y;
+		uint strip = linear / groupsPerStrip;
+		uint inStrip = linear % groupsPerStrip;
+		uint fullStrips = numGroups.x / TILE_STRIP_WIDTH;
+		uint stripWidth = strip < fullStrips ? TILE_STRIP_WIDTH : numGroups.x % TILE_STRIP_WIDTH;
+		return uvec2(strip * TILE_STRIP_WIDTH + inStrip % stripWidth, inStrip / stripWidth);
+	}
+	return group;
+}
+
+// position of this invocation in the tile. vulkan does not tie gl_SubgroupInvocationID to gl_LocalInvocationID,
+// so in full subgroups the position is taken from the subgroup instead, then the quad pairs are horizontal neighbours
+uvec2 tileInvocation() {
+	if (!FULL_SUBGROUPS) return gl_LocalInvocationID.xy;
+	uint index = gl_SubgroupID * gl_SubgroupSize + gl_SubgroupInvocationID;
+	return uvec2(index % gl_WorkGroupSize.x, index / gl_WorkGroupSize.x);
+}
+
+// the pixel of this invocation, may be outside of the image for the border tiles
+ivec2 tilePixel() {
+	uvec2 tile = tileFromGroup(gl_WorkGroupID.xy, gl_NumWorkGroups.xy);
+	return ivec2(tile * gl_WorkGroupSize.xy + tileInvocation());
+}